@@ -0,0 +1,800 @@
+#define WIN32_LEAN_AND_MEAN
+
+#include <windows.h>
+#include <psapi.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <deque>
+
+#include "..\SecureSocket\Log.h"
+#include "..\SecureSocket\SecureSocket.h"
+#include "..\SecureSocket\NullTls.h"
+#include "..\SecureSocket\HandshakeStats.h"
+#include "..\SecureSocket\CredentialCache.h"
+
+// Need to link with Ws2_32.lib
+#pragma comment (lib, "Ws2_32.lib")
+#pragma comment (lib, "Psapi.lib")
+
+#define DEFAULT_PORT "27015"
+#define DEFAULT_CLIENTS 64
+#define DEFAULT_HANDSHAKES 10000
+#define PROBE_MESSAGE_SIZE 64
+#define STREAM_MESSAGE_SIZE (1024 * 16)
+
+//Results of one client thread
+struct ClientResult {
+    //Handshake latencies in milliseconds
+    std::vector<double> latencies;
+    //Time in milliseconds since the start of the test when each handshake is done
+    std::vector<double> done_at;
+    size_t failures = 0;
+    //Bytes per second echoed on the connection, in the stream mode
+    double stream_rate = 0;
+    //The client streams bulk data among small request/response clients, see Options::bulk_clients.
+    bool bulk = false;
+    //Latencies in milliseconds of the echoes of a small client
+    std::vector<double> echo_latencies;
+};
+
+struct Options {
+    const char* server = nullptr;
+    std::wstring server_name;
+    size_t clients = DEFAULT_CLIENTS;
+    size_t handshakes = DEFAULT_HANDSHAKES;
+    //Size of the message to echo after a handshake. No message is sent if it's 0.
+    size_t message_size = 0;
+    bool null_tls = false;
+    DWORD server_pid = 0;
+    //Interval in milliseconds of the echo probe on an established connection, or 0 for no probe.
+    DWORD probe_interval = 0;
+    const char* result_file = nullptr;
+    //Seconds each client streams on one connection, or 0 for the handshake test.
+    DWORD stream_seconds = 0;
+    //Seconds the connections stay idle after streaming, for the soak test of server memory, or 0 for none.
+    DWORD idle_seconds = 0;
+    //In the stream mode, the number of clients that stream bulk data, while the rest echo small messages and
+    //measure the latency. 0 means all stream.
+    size_t bulk_clients = 0;
+    //Milliseconds of delay each way, added by a proxy between the clients and the server, or 0 for none.
+    DWORD delay_ms = 0;
+};
+
+LARGE_INTEGER g_frequency;
+LARGE_INTEGER g_start;
+volatile LONG64 g_next = 0;
+volatile bool g_flood_done = false;
+//Stages of the soak test. Clients count themselves in when they're connected and when they've streamed, and
+//wait to be let go on.
+volatile LONG g_connected = 0;
+volatile bool g_stream = false;
+volatile LONG g_streamed = 0;
+volatile bool g_close = false;
+My::NullTlsProvider g_null_provider;
+//The delay proxy, see start_proxy.
+SOCKET g_proxy_listener = INVALID_SOCKET;
+sockaddr_in g_proxy_addr = {};
+addrinfo g_proxy_addrinfo = {};
+volatile LONG g_relays = 0;
+
+double elapsed_ms(const LARGE_INTEGER& start, const LARGE_INTEGER& end) {
+    return (end.QuadPart - start.QuadPart) * 1000.0 / g_frequency.QuadPart;
+}
+
+double now_ms() {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart * 1000.0 / g_frequency.QuadPart;
+}
+
+SOCKET connect_server(const addrinfo* addr) {
+    for (auto p = addr; p; p = p->ai_next) {
+        auto s = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (s == INVALID_SOCKET) {
+            return INVALID_SOCKET;
+        }
+        if (connect(s, p->ai_addr, (int)p->ai_addrlen) != SOCKET_ERROR) {
+            return s;
+        }
+        closesocket(s);
+    }
+    return INVALID_SOCKET;
+}
+
+bool send_all(SOCKET s, const char* data, size_t size) {
+    while (size) {
+        auto result = send(s, data, (int)size, 0);
+        if (result == SOCKET_ERROR) {
+            return false;
+        }
+        data += result;
+        size -= result;
+    }
+    return true;
+}
+
+//Relay the bytes from one socket to the other, each chunk delay_ms after it's received, until from is closed.
+void relay(SOCKET from, SOCKET to, DWORD delay_ms) {
+    //Chunks received, with the time they're due to be sent
+    std::deque<std::pair<double, std::vector<char>>> chunks;
+    std::vector<char> buf(1024 * 16);
+    bool reading = true;
+    while (reading || !chunks.empty()) {
+        while (!chunks.empty() && chunks.front().first <= now_ms()) {
+            auto& data = chunks.front().second;
+            if (!send_all(to, data.data(), data.size())) {
+                reading = false;
+                chunks.clear();
+                break;
+            }
+            chunks.pop_front();
+        }
+        double wait = chunks.empty() ? 0 : chunks.front().first - now_ms();
+        if (wait < 0) {
+            wait = 0;
+        }
+        if (!reading) {
+            Sleep((DWORD)wait);
+            continue;
+        }
+        //Wait for more bytes, but no later than the next chunk is due.
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(from, &readable);
+        timeval timeout;
+        timeout.tv_sec = (long)(wait / 1000);
+        timeout.tv_usec = (long)((wait - timeout.tv_sec * 1000.0) * 1000);
+        auto ready = select(0, &readable, nullptr, nullptr, chunks.empty() ? nullptr : &timeout);
+        if (ready == SOCKET_ERROR) {
+            reading = false;
+        }
+        else if (ready > 0) {
+            auto result = recv(from, buf.data(), (int)buf.size(), 0);
+            if (result <= 0) {
+                reading = false;
+            }
+            else {
+                chunks.emplace_back(now_ms() + delay_ms, std::vector<char>(buf.data(), buf.data() + result));
+            }
+        }
+    }
+    //The close is passed on after the bytes, the same as it came.
+    shutdown(to, SD_SEND);
+}
+
+//Relay a connection of a client to the server, a thread each way.
+void run_relay(SOCKET client, const addrinfo* server, DWORD delay_ms) {
+    auto s = connect_server(server);
+    if (s != INVALID_SOCKET) {
+        //Small handshake messages go out at once, so the delay is all the proxy adds.
+        BOOL no_delay = TRUE;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char*)&no_delay, sizeof(no_delay));
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&no_delay, sizeof(no_delay));
+        std::thread back(relay, s, client, delay_ms);
+        relay(client, s, delay_ms);
+        back.join();
+        closesocket(s);
+    }
+    closesocket(client);
+    InterlockedDecrement(&g_relays);
+}
+
+//Listen on a port of loopback and relay each connection to the server, with delay_ms added each way, so that
+//handshakes are measured over the round trips of a real link rather than the microseconds of loopback. Clients
+//connect to g_proxy_addrinfo instead of the server. A proxy is used rather than netem, which Windows lacks.
+bool start_proxy(const addrinfo* server, DWORD delay_ms) {
+    g_proxy_listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (g_proxy_listener == INVALID_SOCKET) {
+        return false;
+    }
+    g_proxy_addr.sin_family = AF_INET;
+    g_proxy_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    g_proxy_addr.sin_port = 0;
+    int size = sizeof(g_proxy_addr);
+    if (bind(g_proxy_listener, (sockaddr*)&g_proxy_addr, sizeof(g_proxy_addr)) == SOCKET_ERROR ||
+        getsockname(g_proxy_listener, (sockaddr*)&g_proxy_addr, &size) == SOCKET_ERROR ||
+        listen(g_proxy_listener, SOMAXCONN) == SOCKET_ERROR) {
+        closesocket(g_proxy_listener);
+        g_proxy_listener = INVALID_SOCKET;
+        return false;
+    }
+    g_proxy_addrinfo.ai_family = AF_INET;
+    g_proxy_addrinfo.ai_socktype = SOCK_STREAM;
+    g_proxy_addrinfo.ai_protocol = IPPROTO_TCP;
+    g_proxy_addrinfo.ai_addrlen = sizeof(g_proxy_addr);
+    g_proxy_addrinfo.ai_addr = (sockaddr*)&g_proxy_addr;
+    std::thread([server, delay_ms]() {
+        while (true) {
+            auto client = accept(g_proxy_listener, nullptr, nullptr);
+            if (client == INVALID_SOCKET) {
+                break;
+            }
+            InterlockedIncrement(&g_relays);
+            std::thread(run_relay, client, server, delay_ms).detach();
+        }
+    }).detach();
+    return true;
+}
+
+//Stop accepting, and wait for the connections relayed to be closed.
+void stop_proxy() {
+    if (g_proxy_listener == INVALID_SOCKET) {
+        return;
+    }
+    closesocket(g_proxy_listener);
+    while (g_relays) {
+        Sleep(10);
+    }
+}
+
+bool echo(My::SecureSocket& s, const std::vector<char>& message, std::vector<char>& reply) {
+    size_t sent = 0;
+    while (sent < message.size()) {
+        int result = s.send(message.data() + sent, (int)(message.size() - sent));
+        if (result < 0) {
+            return false;
+        }
+        sent += result;
+    }
+    size_t read = 0;
+    while (read < message.size()) {
+        int result = s.receive(reply.data() + read, (int)(reply.size() - read));
+        if (result <= 0) {
+            return false;
+        }
+        read += result;
+    }
+    return !memcmp(message.data(), reply.data(), message.size());
+}
+
+//Each client takes handshakes from a shared counter until all are done, so that the load stays at the
+//concurrency of the clients till the end.
+void run_client(const Options& options, const addrinfo* addr, ClientResult& result) {
+    std::vector<char> message(options.message_size, 'x');
+    //NOTE: The reply buffer must hold a whole TLS record, to avoid the short-buffer problem of SecureSocket.
+    std::vector<char> reply(options.message_size + 1024 * 16);
+    auto name = options.server_name.empty() ? nullptr : options.server_name.c_str();
+    while ((size_t)InterlockedIncrement64(&g_next) <= options.handshakes) {
+        auto s = connect_server(addr);
+        if (s == INVALID_SOCKET) {
+            result.failures++;
+            continue;
+        }
+        //The latency is of the handshake only, from ClientHello to Finished, with no TCP connect.
+        LARGE_INTEGER start;
+        LARGE_INTEGER end;
+        QueryPerformanceCounter(&start);
+        std::unique_ptr<My::SecureSocket> ss(options.null_tls ? new My::SecureSocket(s, &g_null_provider, false, name) :
+            new My::SecureSocket(s, false, name));
+        bool ok = ss->init();
+        QueryPerformanceCounter(&end);
+        if (ok && (message.empty() || echo(*ss, message, reply))) {
+            result.latencies.push_back(elapsed_ms(start, end));
+            result.done_at.push_back(elapsed_ms(g_start, end));
+        }
+        else {
+            result.failures++;
+        }
+        ss->shutdown();
+        ss.reset();
+        closesocket(s);
+    }
+}
+
+//Echo a small message on an established connection at the interval while the handshakes go on, to see how
+//handshakes hold up the data I/O of the server. The echo latencies in milliseconds are put in result.
+void run_probe(const Options& options, const addrinfo* addr, ClientResult& result) {
+    auto s = connect_server(addr);
+    if (s == INVALID_SOCKET) {
+        result.failures++;
+        return;
+    }
+    auto name = options.server_name.empty() ? nullptr : options.server_name.c_str();
+    std::unique_ptr<My::SecureSocket> ss(options.null_tls ? new My::SecureSocket(s, &g_null_provider, false, name) :
+        new My::SecureSocket(s, false, name));
+    if (ss->init()) {
+        std::vector<char> message(PROBE_MESSAGE_SIZE, 'p');
+        std::vector<char> reply(PROBE_MESSAGE_SIZE + 1024 * 16);
+        while (!g_flood_done) {
+            LARGE_INTEGER start;
+            LARGE_INTEGER end;
+            QueryPerformanceCounter(&start);
+            if (!echo(*ss, message, reply)) {
+                result.failures++;
+                break;
+            }
+            QueryPerformanceCounter(&end);
+            result.latencies.push_back(elapsed_ms(start, end));
+            Sleep(options.probe_interval);
+        }
+        ss->shutdown();
+    }
+    else {
+        result.failures++;
+    }
+    ss.reset();
+    closesocket(s);
+}
+
+//Echo messages on one connection for the seconds of the option, as fast as the server lets it, to measure the
+//rate of each connection when the server limits them.
+void wait_for(volatile bool& flag) {
+    while (!flag) {
+        Sleep(10);
+    }
+}
+
+void run_stream(const Options& options, const addrinfo* addr, ClientResult& result) {
+    auto s = connect_server(addr);
+    if (s == INVALID_SOCKET) {
+        result.failures++;
+        InterlockedIncrement(&g_connected);
+        InterlockedIncrement(&g_streamed);
+        return;
+    }
+    auto name = options.server_name.empty() ? nullptr : options.server_name.c_str();
+    std::unique_ptr<My::SecureSocket> ss(options.null_tls ? new My::SecureSocket(s, &g_null_provider, false, name) :
+        new My::SecureSocket(s, false, name));
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&start);
+    if (ss->init()) {
+        QueryPerformanceCounter(&end);
+        result.latencies.push_back(elapsed_ms(start, end));
+        result.done_at.push_back(elapsed_ms(g_start, end));
+        if (options.idle_seconds) {
+            InterlockedIncrement(&g_connected);
+            wait_for(g_stream);
+            QueryPerformanceCounter(&end);
+        }
+        bool small = options.bulk_clients && !result.bulk;
+        std::vector<char> message(small ? PROBE_MESSAGE_SIZE :
+            (options.message_size ? options.message_size : STREAM_MESSAGE_SIZE), 's');
+        std::vector<char> reply(message.size() + 1024 * 16);
+        size_t bytes = 0;
+        start = end;
+        while (elapsed_ms(start, end) < options.stream_seconds * 1000.0) {
+            LARGE_INTEGER echo_start = end;
+            if (!echo(*ss, message, reply)) {
+                result.failures++;
+                break;
+            }
+            bytes += message.size();
+            QueryPerformanceCounter(&end);
+            if (small) {
+                result.echo_latencies.push_back(elapsed_ms(echo_start, end));
+            }
+        }
+        auto ms = elapsed_ms(start, end);
+        if (!small) {
+            result.stream_rate = ms > 0 ? bytes * 1000 / ms : 0;
+        }
+        if (options.idle_seconds) {
+            InterlockedIncrement(&g_streamed);
+            wait_for(g_close);
+        }
+        ss->shutdown();
+    }
+    else {
+        result.failures++;
+        InterlockedIncrement(&g_connected);
+        InterlockedIncrement(&g_streamed);
+    }
+    ss.reset();
+    closesocket(s);
+}
+
+//CPU time of the process in milliseconds, in both user and kernel mode.
+bool get_cpu_ms(HANDLE process, double& ms) {
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(process, &creation, &exit, &kernel, &user)) {
+        My::Log::error("[get_cpu_ms] GetProcessTimes failed with error: ", GetLastError());
+        return false;
+    }
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    //In 100 nanoseconds
+    ms = (k.QuadPart + u.QuadPart) / 10000.0;
+    return true;
+}
+
+//Private bytes of the process in KiB
+bool get_memory_kb(HANDLE process, size_t& kb) {
+    PROCESS_MEMORY_COUNTERS_EX counters = {};
+    if (!GetProcessMemoryInfo(process, (PROCESS_MEMORY_COUNTERS*)&counters, sizeof(counters))) {
+        My::Log::error("[get_memory_kb] GetProcessMemoryInfo failed with error: ", GetLastError());
+        return false;
+    }
+    kb = counters.PrivateUsage / 1024;
+    return true;
+}
+
+//Memory of the server in the soak test
+struct SoakResult {
+    //With all connections established, before streaming
+    size_t baseline_kb = 0;
+    size_t peak_kb = 0;
+    //After the connections have been idle for a while
+    size_t idle_kb = 0;
+};
+
+//Take the soak test through its stages while the clients run: measure the baseline, let them stream, and measure
+//again after they've been idle for the seconds of the option.
+void run_soak(const Options& options, HANDLE server_process, SoakResult& result) {
+    size_t kb = 0;
+    while ((size_t)g_connected < options.clients) {
+        Sleep(10);
+    }
+    get_memory_kb(server_process, result.baseline_kb);
+    result.peak_kb = result.baseline_kb;
+    g_stream = true;
+    LARGE_INTEGER idle_start = {};
+    LARGE_INTEGER now;
+    while (true) {
+        Sleep(100);
+        if (get_memory_kb(server_process, kb) && kb > result.peak_kb) {
+            result.peak_kb = kb;
+        }
+        QueryPerformanceCounter(&now);
+        if (!idle_start.QuadPart) {
+            if ((size_t)g_streamed == options.clients) {
+                idle_start = now;
+            }
+        }
+        else if (elapsed_ms(idle_start, now) >= options.idle_seconds * 1000.0) {
+            break;
+        }
+    }
+    get_memory_kb(server_process, result.idle_kb);
+    g_close = true;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    auto index = (size_t)(p / 100 * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+void usage(const char* program) {
+    printf("usage: %s server [-s server-name] [-c clients] [-n handshakes] [-m message-size] [-p] "
+        "[-i server-pid] [-e probe-interval-ms] [-d stream-seconds [-w idle-seconds] [-b bulk-clients]] "
+        "[-l delay-ms] [-u] [-f result-file]\n", program);
+}
+
+int __cdecl main(int argc, char** argv)
+{
+    My::Log::level = My::Log::Level::Error;
+
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    Options options;
+    options.server = argv[1];
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            //Host names are in ASCII.
+            std::string name(argv[++i]);
+            options.server_name = std::wstring(name.begin(), name.end());
+        }
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            options.clients = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            options.handshakes = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+            options.message_size = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-p")) {
+            options.null_tls = true;
+        }
+        else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+            options.server_pid = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+            options.probe_interval = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            options.stream_seconds = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            options.bulk_clients = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            options.idle_seconds = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            options.delay_ms = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-u")) {
+            //Each client connection acquires a credential of its own, as before CredentialCache.
+            My::CredentialCache::shared = false;
+        }
+        else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            options.result_file = argv[++i];
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    //The soak test measures the memory of the server, which is found by its process ID.
+    if (!options.clients || !options.handshakes ||
+        (options.idle_seconds && (!options.stream_seconds || !options.server_pid))) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    WSADATA wsa_data;
+    int result = WSAStartup(MAKEWORD(2, 2), &wsa_data);
+    if (result != 0) {
+        printf("WSAStartup failed with error: %d\n", result);
+        return 1;
+    }
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    addrinfo* addr = nullptr;
+    result = getaddrinfo(options.server, DEFAULT_PORT, &hints, &addr);
+    if (result != 0) {
+        printf("getaddrinfo failed with error: %d\n", result);
+        WSACleanup();
+        return 1;
+    }
+
+    //The server CPU is measured by the process times of the server, which is on the same machine.
+    HANDLE server_process = nullptr;
+    double server_cpu_start = 0;
+    if (options.server_pid) {
+        server_process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, options.server_pid);
+        if (!server_process || !get_cpu_ms(server_process, server_cpu_start)) {
+            printf("Can't get CPU time of process %lu, error: %lu\n", options.server_pid, GetLastError());
+            freeaddrinfo(addr);
+            WSACleanup();
+            return 1;
+        }
+    }
+
+    QueryPerformanceFrequency(&g_frequency);
+    //The server is still looked up by addr, by the proxy.
+    const addrinfo* client_addr = addr;
+    if (options.delay_ms) {
+        if (!start_proxy(addr, options.delay_ms)) {
+            printf("Can't start the delay proxy, error: %d\n", WSAGetLastError());
+            freeaddrinfo(addr);
+            WSACleanup();
+            return 1;
+        }
+        client_addr = &g_proxy_addrinfo;
+    }
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    std::vector<ClientResult> results(options.clients);
+    std::vector<std::thread> threads;
+    ClientResult probe_result;
+    std::thread probe;
+    if (options.probe_interval) {
+        probe = std::thread(run_probe, std::cref(options), client_addr, std::ref(probe_result));
+    }
+    QueryPerformanceCounter(&start);
+    g_start = start;
+    for (size_t i = 0; i < options.clients; i++) {
+        results[i].bulk = i < options.bulk_clients;
+        threads.emplace_back(options.stream_seconds ? run_stream : run_client, std::cref(options), client_addr,
+            std::ref(results[i]));
+    }
+    SoakResult soak;
+    if (options.idle_seconds) {
+        run_soak(options, server_process, soak);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    QueryPerformanceCounter(&end);
+    g_flood_done = true;
+    if (probe.joinable()) {
+        probe.join();
+    }
+    stop_proxy();
+    freeaddrinfo(addr);
+    auto& probe_latencies = probe_result.latencies;
+    std::sort(probe_latencies.begin(), probe_latencies.end());
+
+    double server_cpu_ms = 0;
+    if (server_process) {
+        double server_cpu_end = 0;
+        if (get_cpu_ms(server_process, server_cpu_end)) {
+            server_cpu_ms = server_cpu_end - server_cpu_start;
+        }
+        CloseHandle(server_process);
+    }
+
+    std::vector<double> latencies;
+    size_t failures = 0;
+    auto seconds = elapsed_ms(start, end) / 1000;
+    //Handshakes done in each second of the test. Under overload, the goodput should hold steady over time
+    //rather than collapse.
+    std::vector<size_t> goodput((size_t)seconds + 1);
+    for (auto& r : results) {
+        latencies.insert(latencies.end(), r.latencies.begin(), r.latencies.end());
+        failures += r.failures;
+        for (auto t : r.done_at) {
+            auto second = (size_t)(t / 1000);
+            if (second < goodput.size()) {
+                goodput[second]++;
+            }
+        }
+    }
+    //The last second is partial.
+    if (goodput.size() > 1) {
+        goodput.pop_back();
+    }
+    std::sort(latencies.begin(), latencies.end());
+    //Rates of the connections that have streamed, in bytes per second. The spread tells how evenly a limit holds
+    //across connections.
+    std::vector<double> stream_rates;
+    double stream_total = 0;
+    for (auto& r : results) {
+        if (r.stream_rate > 0) {
+            stream_rates.push_back(r.stream_rate);
+            stream_total += r.stream_rate;
+        }
+    }
+    std::sort(stream_rates.begin(), stream_rates.end());
+    std::vector<double> echo_latencies;
+    for (auto& r : results) {
+        echo_latencies.insert(echo_latencies.end(), r.echo_latencies.begin(), r.echo_latencies.end());
+    }
+    std::sort(echo_latencies.begin(), echo_latencies.end());
+    auto stream_mean = stream_rates.empty() ? 0 : stream_total / stream_rates.size();
+    //Total bytes echoed by all connections
+    auto stream_bytes = stream_total * options.stream_seconds;
+    auto cpu_per_mb = stream_bytes > 0 ? server_cpu_ms * 1024 * 1024 / stream_bytes : 0;
+    double total_ms = 0;
+    for (auto l : latencies) {
+        total_ms += l;
+    }
+
+    auto done = latencies.size();
+    auto rate = done / seconds;
+    auto mean = done ? total_ms / done : 0;
+    auto cpu_per_handshake = done ? server_cpu_ms / done : 0;
+
+    //Counted by the clients, which resume sessions the server lets them resume.
+    auto full = My::HandshakeStats::get_full();
+    auto resumed = My::HandshakeStats::get_resumed();
+    printf("Handshakes: %zu, failures: %zu, full: %lld, resumed: %lld, in %.3f seconds\n", done, failures, full,
+        resumed, seconds);
+    printf("Handshakes per second: full %.1f, resumed %.1f, hit rate %.1f%%\n", full / seconds, resumed / seconds,
+        My::HandshakeStats::get_hit_rate());
+    printf("Handshakes per second: %.1f, per second over time: min %zu, max %zu\n", rate,
+        *std::min_element(goodput.begin(), goodput.end()), *std::max_element(goodput.begin(), goodput.end()));
+    printf("Latency in ms: mean %.3f, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n", mean, percentile(latencies, 50),
+        percentile(latencies, 90), percentile(latencies, 99), done ? latencies.back() : 0);
+    if (options.delay_ms) {
+        //A TLS 1.3 handshake takes one round trip and TLS 1.2 two, which is what's left over the delay.
+        printf("Delay each way in ms: %lu, latency in round trips: p50 %.2f\n", options.delay_ms,
+            percentile(latencies, 50) / (2.0 * options.delay_ms));
+    }
+    if (server_process) {
+        printf("Server CPU per handshake in ms: %.3f\n", cpu_per_handshake);
+    }
+    if (options.stream_seconds) {
+        printf("Stream rate per connection in bytes/s: mean %.0f, min %.0f, p50 %.0f, max %.0f, total %.0f\n",
+            stream_mean, stream_rates.empty() ? 0 : stream_rates.front(), percentile(stream_rates, 50),
+            stream_rates.empty() ? 0 : stream_rates.back(), stream_total);
+        if (server_process) {
+            printf("Server CPU per MiB echoed in ms: %.3f\n", cpu_per_mb);
+        }
+    }
+    if (options.bulk_clients) {
+        printf("Small echoes: %zu, latency in ms: p50 %.3f, p99 %.3f, p99.9 %.3f, max %.3f\n", echo_latencies.size(),
+            percentile(echo_latencies, 50), percentile(echo_latencies, 99), percentile(echo_latencies, 99.9),
+            echo_latencies.empty() ? 0 : echo_latencies.back());
+    }
+    //Most of the memory taken by the burst should be given back when the connections are idle.
+    bool soak_ok = soak.idle_kb <= soak.baseline_kb + (soak.peak_kb - soak.baseline_kb) / 10;
+    if (options.idle_seconds) {
+        printf("Server memory in KiB: baseline %zu, peak %zu, after %lu seconds idle %zu, %s\n", soak.baseline_kb,
+            soak.peak_kb, options.idle_seconds, soak.idle_kb, soak_ok ? "returned to baseline" : "NOT returned");
+    }
+    if (options.probe_interval) {
+        printf("Probe echoes: %zu, failures: %zu, latency in ms: p50 %.3f, p99 %.3f, max %.3f\n",
+            probe_latencies.size(), probe_result.failures, percentile(probe_latencies, 50),
+            percentile(probe_latencies, 99), probe_latencies.empty() ? 0 : probe_latencies.back());
+    }
+
+    if (options.result_file) {
+        //NOTE: A flat JSON object, so that the results of runs can be compared by a script for regressions.
+        auto f = fopen(options.result_file, "w");
+        if (!f) {
+            printf("Can't open %s\n", options.result_file);
+            WSACleanup();
+            return 1;
+        }
+        fprintf(f, "{\n");
+        fprintf(f, "  \"provider\": \"%s\",\n", options.null_tls ? "null" : "schannel");
+        fprintf(f, "  \"clients\": %zu,\n", options.clients);
+        fprintf(f, "  \"message_size\": %zu,\n", options.message_size);
+        fprintf(f, "  \"delay_ms\": %lu,\n", options.delay_ms);
+        fprintf(f, "  \"shared_credentials\": %s,\n", My::CredentialCache::shared ? "true" : "false");
+        fprintf(f, "  \"handshakes\": %zu,\n", done);
+        fprintf(f, "  \"failures\": %zu,\n", failures);
+        fprintf(f, "  \"full\": %lld,\n", full);
+        fprintf(f, "  \"resumed\": %lld,\n", resumed);
+        fprintf(f, "  \"full_per_second\": %.1f,\n", full / seconds);
+        fprintf(f, "  \"resumed_per_second\": %.1f,\n", resumed / seconds);
+        fprintf(f, "  \"hit_rate\": %.1f,\n", My::HandshakeStats::get_hit_rate());
+        fprintf(f, "  \"seconds\": %.3f,\n", seconds);
+        fprintf(f, "  \"handshakes_per_second\": %.1f,\n", rate);
+        fprintf(f, "  \"goodput_per_second\": [");
+        for (size_t i = 0; i < goodput.size(); i++) {
+            fprintf(f, i ? ", %zu" : "%zu", goodput[i]);
+        }
+        fprintf(f, "],\n");
+        fprintf(f, "  \"latency_ms_mean\": %.3f,\n", mean);
+        fprintf(f, "  \"latency_ms_p50\": %.3f,\n", percentile(latencies, 50));
+        fprintf(f, "  \"latency_ms_p90\": %.3f,\n", percentile(latencies, 90));
+        fprintf(f, "  \"latency_ms_p99\": %.3f,\n", percentile(latencies, 99));
+        fprintf(f, "  \"latency_ms_max\": %.3f,\n", done ? latencies.back() : 0);
+        if (options.probe_interval) {
+            fprintf(f, "  \"probe_echoes\": %zu,\n", probe_latencies.size());
+            fprintf(f, "  \"probe_failures\": %zu,\n", probe_result.failures);
+            fprintf(f, "  \"probe_latency_ms_p50\": %.3f,\n", percentile(probe_latencies, 50));
+            fprintf(f, "  \"probe_latency_ms_p99\": %.3f,\n", percentile(probe_latencies, 99));
+            fprintf(f, "  \"probe_latency_ms_max\": %.3f,\n", probe_latencies.empty() ? 0 : probe_latencies.back());
+        }
+        if (options.stream_seconds) {
+            fprintf(f, "  \"stream_seconds\": %lu,\n", options.stream_seconds);
+            fprintf(f, "  \"stream_rate_mean\": %.0f,\n", stream_mean);
+            fprintf(f, "  \"stream_rate_min\": %.0f,\n", stream_rates.empty() ? 0 : stream_rates.front());
+            fprintf(f, "  \"stream_rate_p50\": %.0f,\n", percentile(stream_rates, 50));
+            fprintf(f, "  \"stream_rate_max\": %.0f,\n", stream_rates.empty() ? 0 : stream_rates.back());
+            if (server_process) {
+                fprintf(f, "  \"server_cpu_ms_per_mib\": %.3f,\n", cpu_per_mb);
+            }
+        }
+        if (options.bulk_clients) {
+            fprintf(f, "  \"bulk_clients\": %zu,\n", options.bulk_clients);
+            fprintf(f, "  \"small_echoes\": %zu,\n", echo_latencies.size());
+            fprintf(f, "  \"small_latency_ms_p50\": %.3f,\n", percentile(echo_latencies, 50));
+            fprintf(f, "  \"small_latency_ms_p99\": %.3f,\n", percentile(echo_latencies, 99));
+            fprintf(f, "  \"small_latency_ms_p999\": %.3f,\n", percentile(echo_latencies, 99.9));
+            fprintf(f, "  \"small_latency_ms_max\": %.3f,\n", echo_latencies.empty() ? 0 : echo_latencies.back());
+        }
+        if (options.idle_seconds) {
+            fprintf(f, "  \"soak_idle_seconds\": %lu,\n", options.idle_seconds);
+            fprintf(f, "  \"soak_memory_kb_baseline\": %zu,\n", soak.baseline_kb);
+            fprintf(f, "  \"soak_memory_kb_peak\": %zu,\n", soak.peak_kb);
+            fprintf(f, "  \"soak_memory_kb_idle\": %zu,\n", soak.idle_kb);
+            fprintf(f, "  \"soak_memory_returned\": %s,\n", soak_ok ? "true" : "false");
+        }
+        if (server_process) {
+            fprintf(f, "  \"server_cpu_ms_per_handshake\": %.3f\n", cpu_per_handshake);
+        }
+        else {
+            fprintf(f, "  \"server_cpu_ms_per_handshake\": null\n");
+        }
+        fprintf(f, "}\n");
+        fclose(f);
+    }
+
+    WSACleanup();
+    return (failures || probe_result.failures || !soak_ok) ? 1 : 0;
+}
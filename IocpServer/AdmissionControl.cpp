@@ -0,0 +1,28 @@
+#include "AdmissionControl.h"
+
+AdmissionControl::AdmissionControl(size_t max_connections, size_t max_handshakes, double rate, double burst) :
+    m_max_connections(max_connections), m_max_handshakes(max_handshakes), m_bucket(rate, burst, GetTickCount64())
+{
+}
+
+AdmissionControl::Verdict AdmissionControl::check(size_t connections, size_t handshakes)
+{
+    if (m_max_connections && connections >= m_max_connections) {
+        return Verdict::TooManyConnections;
+    }
+    if (m_max_handshakes && handshakes >= m_max_handshakes) {
+        return Verdict::TooManyHandshakes;
+    }
+    if (m_bucket.is_limited() && m_bucket.get_tokens(GetTickCount64()) < 1) {
+        return Verdict::OverRate;
+    }
+    return Verdict::Admit;
+}
+
+void AdmissionControl::admit()
+{
+    if (m_bucket.is_limited()) {
+        m_bucket.take(1);
+    }
+    m_admitted++;
+}
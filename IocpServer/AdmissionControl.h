@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Common.h"
+#include "TokenBucket.h"
+
+//Decide whether to take a new connection, by limits of concurrent connections, concurrent handshakes and the
+//accept rate. The rate is limited by a token bucket, which allows a burst of accepts after an idle time.
+//
+//It's used by the accepting thread only, so nothing is atomic.
+class AdmissionControl
+{
+public:
+    enum class Verdict {
+        Admit = 0,
+        TooManyConnections,
+        TooManyHandshakes,
+        OverRate,
+        Count
+    };
+
+    //A limit of 0 means no limit. burst is the size of the bucket, and it's at least 1 when rate is limited.
+    AdmissionControl(size_t max_connections, size_t max_handshakes, double rate, double burst);
+
+    //Tell if a connection can be taken now. It takes no token, see admit.
+    Verdict check(size_t connections, size_t handshakes);
+
+    //Take a token for a connection accepted.
+    void admit();
+
+    //Count a connection that is deferred or closed because of the verdict.
+    void shed(Verdict verdict) {
+        m_shed[(int)verdict]++;
+    }
+
+    LONG64 get_shed(Verdict verdict) const {
+        return m_shed[(int)verdict];
+    }
+
+    LONG64 get_admitted() const {
+        return m_admitted;
+    }
+
+    bool is_limited() const {
+        return m_max_connections || m_max_handshakes || m_bucket.is_limited();
+    }
+
+private:
+    size_t m_max_connections;
+    size_t m_max_handshakes;
+    TokenBucket m_bucket;
+    LONG64 m_admitted = 0;
+    LONG64 m_shed[(int)Verdict::Count] = {};
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Common.h"
+
+//Count the allocations of the process, by replacing the global operator new and delete, to tell how many a
+//handshake takes. The count is split by thread over cache lines, so that the workers don't contend on one.
+class AllocationCounter
+{
+public:
+    //Allocations by operator new since the start of the process
+    static LONG64 get_count();
+
+    static void add() {
+        InterlockedIncrement64(&shards[(GetCurrentThreadId() >> 2) % shard_count].count);
+    }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        volatile LONG64 count = 0;
+    };
+
+    static const size_t shard_count = 64;
+
+    static Shard shards[shard_count];
+};
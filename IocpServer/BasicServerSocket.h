@@ -0,0 +1,482 @@
+#pragma once
+
+#include "Common.h"
+#include "ServerSocket.h"
+#include "Event.h"
+#include "Log.h"
+#include "TimerWheel.h"
+#include <type_traits>
+#include <cassert>
+
+//Transport policies of BasicServerSocket
+struct PlainTransport
+{
+    static constexpr bool fixed = true;
+    static constexpr bool tls = false;
+};
+
+//TLS by the provider of ServerSocket::tls_init.
+struct TlsTransport
+{
+    static constexpr bool fixed = true;
+    static constexpr bool tls = true;
+};
+
+//A data event of Base completed on the path of Socket, with no virtual call from the worker to the handler but run.
+template <typename Base, typename Socket>
+class BasicDataEvent final : public Base
+{
+public:
+    template <typename... Args>
+    BasicDataEvent(Args&&... args) : Base(std::forward<Args>(args)...) {}
+
+    virtual void run() override {
+        this->m_server->dispatch(this);
+    }
+
+    virtual void complete() override {
+        if constexpr (std::is_base_of_v<SendEvent, Base>) {
+            this->m_server->template do_send_event<Socket>(this);
+        }
+        else {
+            this->m_server->template do_receive_event<Socket>(this);
+        }
+    }
+};
+
+//A ServerSocket with the transport and the handler fixed at compile time, for the hot path of a server that knows
+//both. There's no branch on TLS, and the callbacks of Handler are direct calls, so that a path like echo inlines
+//from the completion down to the next WSASend. The only indirect call is Event::run, by which a worker dispatches a
+//completion of any kind.
+//
+//Handler is a final IServerSocketHandler, with callbacks for Socket* as well, like
+//    template <typename Socket> void on_received(Socket* socket, char* buf, size_t size, size_t received);
+//where socket->receive and socket->send stay on the path of Socket. See EchoServer.
+//
+//Everything else is ServerSocket's: the handshake, the registry, timeouts, rate limits, buffer budgets, the send
+//queue, strands and shutdown. A connection goes back to the path of ServerSocket only through a callback taking
+//ServerSocket*, like the task of ServerSocket::post.
+template <typename Transport, typename Handler>
+class BasicServerSocket final : public ServerSocket
+{
+    static_assert(std::is_base_of_v<IServerSocketHandler, Handler> && std::is_final_v<Handler>,
+        "Handler must be a final IServerSocketHandler.");
+
+public:
+    typedef Transport TransportType;
+    typedef Handler HandlerType;
+
+    //On failure it returns nullptr, and handler and socket are left to the caller.
+    static BasicServerSocket* create(HANDLE iocp, SOCKET socket, Handler* handler) {
+        assert(iocp && socket && handler);
+        return static_cast<BasicServerSocket*>(init(new BasicServerSocket(iocp, socket, handler)));
+    }
+
+    bool receive(char* buf, size_t size) {
+        return ServerSocket::receive<BasicServerSocket>(buf, size);
+    }
+
+    bool send(const char* buf, size_t size) {
+        return ServerSocket::send<BasicServerSocket>(buf, size);
+    }
+
+private:
+    BasicServerSocket(HANDLE iocp, SOCKET socket, Handler* handler) :
+        ServerSocket(iocp, socket, handler, Transport::tls) {}
+
+    virtual void do_started() override {
+        handler_of<BasicServerSocket>()->on_started(this);
+    }
+
+    virtual bool restart_receive(char* buf, size_t size) override {
+        return start_paced_receive<BasicServerSocket>(buf, size);
+    }
+
+    virtual bool restart_send(const char* buf, size_t size) override {
+        return start_paced_send<BasicServerSocket>(buf, size);
+    }
+};
+
+//The data path of ServerSocket, for Socket of ServerSocket or a BasicServerSocket.
+
+template <typename Socket>
+bool ServerSocket::receive(char* buf, size_t size)
+{
+    if (m_state != State::Started) {
+        LOG_ERROR("Invalid state.");
+        return false;
+    }
+    if (m_receive_flow != Flowing) {
+        //NOTE: The buffer is saved before the flag, so that resume_receive sees it once it sees Held. If it has
+        //been resumed in between, the receive goes on here.
+        m_held_buf = buf;
+        m_held_size = size;
+        if (InterlockedCompareExchange(&m_receive_flow, Held, Paused) == Paused) {
+            //A paused connection is not idle.
+            m_receive_deadline = 0;
+            return true;
+        }
+    }
+    if (yield_receive(buf, size)) {
+        return true;
+    }
+    return start_paced_receive<Socket>(buf, size);
+}
+
+template <typename Socket>
+bool ServerSocket::start_receive(char* buf, size_t size)
+{
+    assert(m_state == State::Started && buf && size);
+    auto event = new BasicDataEvent<ReceiveEvent, Socket>(this, buf, size);
+    DWORD flags = 0;
+    WSABUF wsabuf;
+    wsabuf.buf = buf;
+    wsabuf.len = size;
+    m_receive_pending = true;
+    auto result = WSARecv(m_socket, &wsabuf, 1, nullptr, &flags, event, nullptr);
+    if (result == SOCKET_ERROR && (ERROR_IO_PENDING != WSAGetLastError())) {
+        LOG_ERROR("WSARecv failed with error: ", WSAGetLastError());
+        m_receive_pending = false;
+        delete event;
+        return false;
+    }
+    if (result == SOCKET_ERROR) {
+        //No data is ready, so the connection waits and its turn ends.
+        InterlockedIncrement(&m_receive_waits);
+    }
+    return true;
+}
+
+template <typename Socket>
+bool ServerSocket::tls_start_receive(char* user_buf, size_t user_buf_size, bool force_start)
+{
+    assert(m_state == State::Started && user_buf && user_buf_size);
+    if (!force_start && (m_buf_used > 0 || m_tls->has_pending())) {
+        tls_do_receive<Socket>(user_buf, user_buf_size, 0);
+        //Error will be handled by user handler if any. Returning true mimics starting an async sending without error.
+        return true;
+    }
+    if (InterlockedCompareExchange(&m_tls_receiving, 1, 0)) {
+        LOG_ERROR("Concurrent receiving is not supported.");
+        return false;
+    }
+    //We don't use user buf for receiving TLS message. But we save it in a ReceiveEvent for later use.
+    resize_buf_when_necessary();
+    auto event = new BasicDataEvent<ReceiveEvent, Socket>(this, user_buf, user_buf_size);
+    DWORD flags = 0;
+    WSABUF wsabuf;
+    wsabuf.buf = m_buf.data() + m_buf_used;
+    wsabuf.len = m_buf.size() - m_buf_used;
+    m_receive_pending = true;
+    auto result = WSARecv(m_socket, &wsabuf, 1, nullptr, &flags, event, nullptr);
+    if (result == SOCKET_ERROR && (ERROR_IO_PENDING != WSAGetLastError())) {
+        LOG_ERROR("WSARecv failed with error: ", WSAGetLastError());
+        m_receive_pending = false;
+        InterlockedExchange(&m_tls_receiving, 0);
+        delete event;
+        return false;
+    }
+    if (result == SOCKET_ERROR) {
+        InterlockedIncrement(&m_receive_waits);
+    }
+    return true;
+}
+
+template <typename Socket>
+void ServerSocket::do_receive_event(ReceiveEvent* event)
+{
+    m_receive_pending = false;
+    DWORD io_size;
+    DWORD flags;
+    if (!WSAGetOverlappedResult(m_socket, event, &io_size, FALSE, &flags)) {
+        LOG_ERROR("WSAGetOverlappedResult failed with error: ", WSAGetLastError());
+        delete event;
+        if (m_state == State::Started) {
+            handler_of<Socket>()->on_error(self<Socket>());
+        }
+        return;
+    }
+    if (!io_size) {
+        LOG_INFO("Client is shutting down.");
+        delete event;
+        shutdown();
+        return;
+    }
+    set_deadline(m_receive_deadline, idle_timeout);
+    //A receive that has waited for data starts a new turn, so the budget only covers receives that complete back
+    //to back.
+    //NOTE: The completion may run before start_receive counts the wait, and then the turn starts at the next
+    //receive that waits instead.
+    long waits = m_receive_waits;
+    if (waits != m_turn_waits) {
+        m_turn_waits = waits;
+        m_turn_bytes = 0;
+        m_turn_receives = 0;
+    }
+    m_turn_bytes += io_size;
+    if (m_receive_bucket.is_limited()) {
+        m_receive_bucket.take(io_size);
+    }
+    if (is_tls<Socket>()) {
+        tls_do_receive<Socket>(event->m_buf, event->m_size, io_size);
+    }
+    else {
+        handler_of<Socket>()->on_received(self<Socket>(), event->m_buf, event->m_size, io_size);
+    }
+    delete event;
+}
+
+template <typename Socket>
+void ServerSocket::tls_do_receive(char* user_buf, size_t user_buf_size, size_t received)
+{
+    InterlockedExchange(&m_tls_receiving, 0);
+
+    assert(m_state == State::Started);
+
+    m_buf_used += received;
+
+    //There may be already some (extra) content received in buffer in previous call of receive, or from negotiation.
+    auto status = My::TlsStatus::Incomplete;
+    size_t result = 0;
+    auto& out = m_handshake_out;
+    out.clear();
+    while (m_buf_used > 0 || m_tls->has_pending()) {
+        size_t consumed = 0;
+        status = m_tls->decrypt(m_buf.data(), m_buf_used, consumed, user_buf, user_buf_size, result, out);
+        LOG_VERBOSE("decrypt: ", (int)status);
+        if (consumed) {
+            //NOTE: Here memmove is used, rather than memcpy, because there may be overlap in src and dst.
+            memmove(m_buf.data(), m_buf.data() + consumed, m_buf_used - consumed);
+            m_buf_used -= consumed;
+        }
+        if (status != My::TlsStatus::Continue) {
+            break;
+        }
+        //A post-handshake message of TLS 1.3 is processed. Go on with what's left.
+        //NOTE: A send may be encrypting on another worker meanwhile. The session holds it off while a message
+        //that may change the keys is processed, see ITlsSession.
+        status = My::TlsStatus::Incomplete;
+    }
+    //The buffer grows for a burst of records. Give it back once they're all taken.
+    if (!m_buf_used && m_buf.size() > init_buf_size) {
+        std::vector<char>(init_buf_size).swap(m_buf);
+        count_buffer(m_receive_buffer_bytes, m_buf.capacity());
+    }
+
+    //Response to post-handshake messages, if any
+    if (!out.empty()) {
+        if (!tls_start_handshake_send(out)) {
+            handler_of<Socket>()->on_error(self<Socket>());
+            return;
+        }
+        free_handshake_out();
+    }
+
+    if (status == My::TlsStatus::Incomplete) {
+        LOG_INFO("An incomplete message is received. Continue receiving...");
+        if (!tls_start_receive<Socket>(user_buf, user_buf_size, true)) {
+            handler_of<Socket>()->on_error(self<Socket>());
+        }
+        return;
+    }
+
+    if (status == My::TlsStatus::Closed) {
+        LOG_INFO("TLS session is closed by client!");
+        //TLS is shutting down.
+        shutdown();
+        return;
+    }
+
+    if (status != My::TlsStatus::Ok) {
+        LOG_ERROR("decrypt failed!");
+        handler_of<Socket>()->on_error(self<Socket>());
+        return;
+    }
+
+    //NOTE: The payload size can be 0, according to the document. HOWEVER, receiving zero-size buf is a sign of
+    //SHUTDOWN for plain socket recv call. And we'd better have the same semantics for higher level user no
+    //matter TLS is on or off.
+    if (result == 0) {
+        LOG_WARN("Received a message of empty payload.");
+    }
+    handler_of<Socket>()->on_received(self<Socket>(), user_buf, user_buf_size, result);
+}
+
+template <typename Socket>
+bool ServerSocket::send(const char* buf, size_t size)
+{
+    if (m_state != State::Started) {
+        LOG_ERROR("Invalid state.");
+        return false;
+    }
+    return start_paced_send<Socket>(buf, size);
+}
+
+template <typename Socket>
+bool ServerSocket::start_send(const char* buf, size_t size)
+{
+    assert(m_state == State::Started);
+    auto event = new BasicDataEvent<SendEvent, Socket>(this, buf, size);
+    WSABUF wsabuf;
+    wsabuf.buf = (char*)buf;
+    wsabuf.len = size;
+    m_send_pending = true;
+    set_deadline(m_send_deadline, send_timeout);
+    auto result = WSASend(m_socket, &wsabuf, 1, nullptr, 0, event, nullptr);
+    if (result == SOCKET_ERROR && (ERROR_IO_PENDING != WSAGetLastError())) {
+        LOG_ERROR("WSASend failed with error: ", WSAGetLastError());
+        m_send_pending = false;
+        delete event;
+        return false;
+    }
+    return true;
+}
+
+template <typename Socket>
+bool ServerSocket::start_paced_send(const char* buf, size_t size)
+{
+    if (m_send_bucket.is_limited() && pacing_wheel) {
+        auto now = GetTickCount64();
+        auto wait = m_send_bucket.get_wait(now);
+        if (wait) {
+            m_paced_send_buf = buf;
+            m_paced_send_size = size;
+            m_send_release = now + wait;
+            pacing_wheel->add(m_handle.value, now + wait);
+            return true;
+        }
+    }
+    return is_tls<Socket>() ? tls_start_send<Socket>(buf, size) : start_send<Socket>(buf, size);
+}
+
+template <typename Socket>
+bool ServerSocket::start_paced_receive(char* buf, size_t size)
+{
+    bool over_budget = buffer_budget && buffer_bytes > buffer_budget;
+    if ((m_receive_bucket.is_limited() || over_budget) && pacing_wheel) {
+        auto now = GetTickCount64();
+        ULONGLONG wait = m_receive_bucket.is_limited() ? m_receive_bucket.get_wait(now) : 0;
+        if (!wait && over_budget) {
+            wait = budget_retry_ms;
+            InterlockedIncrement64(&budget_delays);
+        }
+        if (wait) {
+            m_paced_receive_buf = buf;
+            m_paced_receive_size = size;
+            m_receive_release = now + wait;
+            pacing_wheel->add(m_handle.value, now + wait);
+            return true;
+        }
+    }
+    return is_tls<Socket>() ? tls_start_receive<Socket>(buf, size, false) : start_receive<Socket>(buf, size);
+}
+
+template <typename Socket>
+void ServerSocket::do_sent(const char* buf, size_t size, size_t sent)
+{
+    if (m_sending_queue) {
+        do_queue_sent(sent);
+    }
+    else {
+        handler_of<Socket>()->on_sent(self<Socket>(), buf, size, sent);
+    }
+}
+
+template <typename Socket>
+bool ServerSocket::tls_start_send(const char* buf, size_t size)
+{
+    assert(m_state == State::Started);
+
+    //NOTE: m_send_buf is taken before encrypting into it, which would overwrite a record being sent otherwise.
+    //It may be taken by trim_buffers for a moment, which is waited for.
+    long sending;
+    while ((sending = InterlockedCompareExchange(&m_tls_sending, 1, 0)) == trimming) {
+        YieldProcessor();
+    }
+    if (sending) {
+        LOG_ERROR("Concurrent sending is not supported.");
+        return false;
+    }
+
+    size_t send_size = m_sizes.max_payload();
+    if (send_size > size) {
+        send_size = size;
+    }
+    size_t ensure_size = send_size + m_sizes.header + m_sizes.trailer;
+    if (ensure_size < init_buf_size) {
+        ensure_size = init_buf_size;
+    }
+    m_send_buf.resize(ensure_size);
+    count_buffer(m_send_buffer_bytes, m_send_buf.capacity());
+    m_last_send = GetTickCount64();
+
+    size_t total = 0;
+    if (!m_tls->encrypt(buf, send_size, m_send_buf.data(), m_send_buf.size(), total)) {
+        LOG_ERROR("encrypt failed!");
+        InterlockedExchange(&m_tls_sending, 0);
+        return false;
+    }
+
+    auto event = new BasicDataEvent<TlsSendEvent, Socket>(this, buf, size, send_size, total);
+    WSABUF wsabuf;
+    wsabuf.buf = m_send_buf.data();
+    wsabuf.len = total;
+    m_send_pending = true;
+    set_deadline(m_send_deadline, send_timeout);
+    auto result = WSASend(m_socket, &wsabuf, 1, nullptr, 0, event, nullptr);
+    if (result == SOCKET_ERROR && (ERROR_IO_PENDING != WSAGetLastError())) {
+        LOG_ERROR("WSASend failed with error: ", WSAGetLastError());
+        m_send_pending = false;
+        InterlockedExchange(&m_tls_sending, 0);
+        delete event;
+        return false;
+    }
+    return true;
+}
+
+template <typename Socket>
+void ServerSocket::do_send_event(SendEvent* event)
+{
+    m_send_pending = false;
+    m_send_deadline = 0;
+    DWORD io_size;
+    DWORD flags;
+    if (!WSAGetOverlappedResult(m_socket, event, &io_size, FALSE, &flags)) {
+        LOG_ERROR("WSAGetOverlappedResult failed with error: ", WSAGetLastError());
+        delete event;
+        //A flight of the queue failed, which is dropped with what's queued behind it, like on a failed start.
+        if (m_sending_queue) {
+            drop_queue();
+        }
+        if (m_state == State::Started) {
+            handler_of<Socket>()->on_error(self<Socket>());
+        }
+        return;
+    }
+    //The bytes on the wire are counted, including the overhead of TLS.
+    if (m_send_bucket.is_limited()) {
+        m_send_bucket.take(io_size);
+    }
+    if (is_tls<Socket>()) {
+        tls_do_send<Socket>((TlsSendEvent*)event, io_size);
+    }
+    else {
+        do_sent<Socket>(event->m_buf, event->m_size, io_size);
+    }
+    delete event;
+}
+
+template <typename Socket>
+void ServerSocket::tls_do_send(TlsSendEvent* event, size_t sent)
+{
+    InterlockedExchange(&m_tls_sending, 0);
+    if (sent == event->m_encrypted_send_size) {
+        do_sent<Socket>(event->m_buf, event->m_size, event->m_send_size);
+    }
+    else {
+        if (m_sending_queue) {
+            drop_queue();
+        }
+        handler_of<Socket>()->on_error(self<Socket>());
+    }
+}
@@ -4,3 +4,7 @@
 
 #include <windows.h>
 #include <winsock2.h>
+
+//Size of a cache line on x86/x64. Data written by different threads at the same time should be aligned to it
+//to avoid false sharing.
+#define CACHE_LINE_SIZE 64
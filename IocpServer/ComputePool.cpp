@@ -0,0 +1,230 @@
+#include "ComputePool.h"
+#include <process.h>
+#include "Log.h"
+
+ComputePool::Worker* ComputePool::workers = nullptr;
+size_t ComputePool::thread_count = 0;
+HANDLE ComputePool::wakeup = nullptr;
+volatile long ComputePool::sleepers = 0;
+volatile bool ComputePool::stopping = false;
+volatile LONG64 ComputePool::steals = 0;
+thread_local ComputePool::Worker* ComputePool::current = nullptr;
+
+bool ComputePool::Deque::push(Work* work)
+{
+    auto bottom = m_bottom;
+    if (bottom - m_top >= capacity) {
+        return false;
+    }
+    m_items[bottom % capacity] = work;
+    //NOTE: The item must be visible before the new bottom, to a thief that reads the bottom.
+    InterlockedExchange64(&m_bottom, bottom + 1);
+    return true;
+}
+
+ComputePool::Work* ComputePool::Deque::pop()
+{
+    auto bottom = m_bottom - 1;
+    //NOTE: The bottom must be taken before the top is read, or a thief and the owner could both take the last item.
+    InterlockedExchange64(&m_bottom, bottom);
+    auto top = m_top;
+    if (top > bottom) {
+        m_bottom = bottom + 1;
+        return nullptr;
+    }
+    auto work = m_items[bottom % capacity];
+    if (top == bottom) {
+        //The last one, which a thief may be taking too
+        if (InterlockedCompareExchange64(&m_top, top + 1, top) != top) {
+            work = nullptr;
+        }
+        m_bottom = bottom + 1;
+    }
+    return work;
+}
+
+ComputePool::Work* ComputePool::Deque::steal()
+{
+    auto top = m_top;
+    MemoryBarrier();
+    auto bottom = m_bottom;
+    if (top >= bottom) {
+        return nullptr;
+    }
+    auto work = m_items[top % capacity];
+    if (InterlockedCompareExchange64(&m_top, top + 1, top) != top) {
+        return nullptr;
+    }
+    return work;
+}
+
+bool ComputePool::start(size_t threads)
+{
+    if (!threads) {
+        return true;
+    }
+    wakeup = CreateSemaphore(nullptr, 0, (LONG)threads, nullptr);
+    if (!wakeup) {
+        LOG_ERROR("CreateSemaphore failed with error: ", GetLastError());
+        return false;
+    }
+    workers = new Worker[threads];
+    for (size_t i = 0; i < threads; i++) {
+        InitializeSListHead(&workers[i].inbox);
+    }
+    //NOTE: All workers are set up before any thread starts, since a thread steals from all of them.
+    thread_count = threads;
+    for (size_t i = 0; i < threads; i++) {
+        workers[i].thread = (HANDLE)_beginthreadex(nullptr, 0, run, &workers[i], 0, nullptr);
+        if (!workers[i].thread) {
+            LOG_ERROR("_beginthreadex failed with error: ", GetLastError());
+            stop();
+            return false;
+        }
+    }
+    return true;
+}
+
+void ComputePool::stop()
+{
+    if (!workers) {
+        return;
+    }
+    stopping = true;
+    ReleaseSemaphore(wakeup, (LONG)thread_count, nullptr);
+    for (size_t i = 0; i < thread_count; i++) {
+        if (workers[i].thread) {
+            WaitForSingleObject(workers[i].thread, INFINITE);
+            CloseHandle(workers[i].thread);
+        }
+    }
+    //No thread is running now, so the deques and inboxes can be drained from here.
+    for (size_t i = 0; i < thread_count; i++) {
+        while (auto work = workers[i].deque.pop()) {
+            delete work;
+        }
+        auto entry = InterlockedFlushSList(&workers[i].inbox);
+        while (entry) {
+            auto work = (Work*)entry;
+            entry = entry->Next;
+            delete work;
+        }
+    }
+    delete[] workers;
+    workers = nullptr;
+    thread_count = 0;
+    CloseHandle(wakeup);
+    wakeup = nullptr;
+}
+
+bool ComputePool::submit(std::function<void()> work)
+{
+    if (!thread_count) {
+        work();
+        return true;
+    }
+    auto item = new Work;
+    item->run = std::move(work);
+    if (current) {
+        if (!current->deque.push(item)) {
+            //The deque is full of work spawned by work, so the thread is busy for a while. Run it at once.
+            execute(item);
+            return true;
+        }
+    }
+    else {
+        InterlockedPushEntrySList(&workers[pick()].inbox, &item->entry);
+    }
+    //NOTE: The work is pushed by an interlocked operation before sleepers is read, and a thread going to sleep
+    //increments sleepers before it looks for work once more, so either one sees the other.
+    if (sleepers) {
+        ReleaseSemaphore(wakeup, 1, nullptr);
+    }
+    return true;
+}
+
+unsigned int __stdcall ComputePool::run(void* arg)
+{
+    auto self = (Worker*)arg;
+    current = self;
+    while (!stopping) {
+        auto work = find(self);
+        if (!work) {
+            InterlockedIncrement(&sleepers);
+            work = find(self);
+            if (!work && !stopping) {
+                WaitForSingleObject(wakeup, INFINITE);
+            }
+            InterlockedDecrement(&sleepers);
+        }
+        if (work) {
+            execute(work);
+        }
+    }
+    current = nullptr;
+    return 1;
+}
+
+ComputePool::Work* ComputePool::find(Worker* self)
+{
+    auto work = self->deque.pop();
+    if (!work) {
+        work = take_inbox(self);
+    }
+    if (!work) {
+        work = steal(self);
+    }
+    return work;
+}
+
+ComputePool::Work* ComputePool::steal(Worker* self)
+{
+    auto start = pick();
+    for (size_t i = 0; i < thread_count; i++) {
+        auto victim = &workers[(start + i) % thread_count];
+        if (victim == self) {
+            continue;
+        }
+        auto work = victim->deque.steal();
+        if (!work) {
+            work = (Work*)InterlockedPopEntrySList(&victim->inbox);
+        }
+        if (work) {
+            InterlockedIncrement64(&steals);
+            return work;
+        }
+    }
+    return nullptr;
+}
+
+ComputePool::Work* ComputePool::take_inbox(Worker* self)
+{
+    //The list is in the reverse order of submits.
+    auto entry = InterlockedFlushSList(&self->inbox);
+    if (!entry) {
+        return nullptr;
+    }
+    while (entry->Next) {
+        auto work = (Work*)entry;
+        entry = entry->Next;
+        if (!self->deque.push(work)) {
+            InterlockedPushEntrySList(&self->inbox, &work->entry);
+        }
+    }
+    return (Work*)entry;
+}
+
+size_t ComputePool::pick()
+{
+    static thread_local unsigned int seed = GetCurrentThreadId() * 2654435761u | 1;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed % thread_count;
+}
+
+void ComputePool::execute(Work* work)
+{
+    work->run();
+    delete work;
+}
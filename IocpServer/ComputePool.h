@@ -0,0 +1,97 @@
+#pragma once
+
+#include "Common.h"
+#include <functional>
+
+//Threads for CPU heavy work of handlers, like parsing, compression and hashing, so that it doesn't hold up the IOCP
+//workers and the completions queued behind it. The pool is sized apart from the workers.
+//
+//Each thread has a deque of work. Work submitted on a pool thread is pushed to the bottom of its own deque, and the
+//owner pops from the bottom, while an idle thread steals from the top of the deque of another one, picked at
+//random. Work submitted from other threads, like the workers, goes to the inbox of a pool thread picked at random,
+//which moves it to its deque in order. Idle threads steal from inboxes too, so no work waits for a busy thread.
+//
+//Work runs on no connection, so it must not touch a ServerSocket, which may be freed meanwhile. See
+//ServerSocket::offload to get a result back to a connection.
+class ComputePool
+{
+public:
+    //Start threads, where 0 starts none and work is run by submit at once. It's called once, before any submit.
+    static bool start(size_t threads);
+
+    //Stop the threads. Work not started yet is dropped.
+    static void stop();
+
+    //Run work on a pool thread. It may be called from any thread.
+    static bool submit(std::function<void()> work);
+
+    static size_t get_threads() {
+        return thread_count;
+    }
+
+    //Work taken by a thread from the deque or inbox of another, in total
+    static LONG64 get_steals() {
+        return steals;
+    }
+
+private:
+    struct alignas(MEMORY_ALLOCATION_ALIGNMENT) Work {
+        //Link of an inbox
+        SLIST_ENTRY entry;
+        std::function<void()> run;
+    };
+
+    //The deque of Chase and Lev, in a fixed ring. Only the owner pushes and pops at the bottom, and any thread may
+    //steal from the top.
+    class Deque
+    {
+    public:
+        //Return false if it's full.
+        bool push(Work* work);
+
+        Work* pop();
+
+        //Return nullptr if it's empty, or if another thread has taken the top meanwhile.
+        Work* steal();
+
+    private:
+        static const LONG64 capacity = 1024;
+
+        volatile LONG64 m_top = 0;
+        volatile LONG64 m_bottom = 0;
+        Work* volatile m_items[capacity] = {};
+    };
+
+    //A cache line each, so that threads don't share the lines of their deques.
+    struct alignas(64) Worker {
+        Deque deque;
+        SLIST_HEADER inbox;
+        HANDLE thread = nullptr;
+    };
+
+    static unsigned int __stdcall run(void* arg);
+
+    //Take work for self, from its own deque and inbox, or from others.
+    static Work* find(Worker* self);
+
+    static Work* steal(Worker* self);
+
+    //Move work in the inbox of self to its deque, oldest at the bottom, and return the oldest.
+    static Work* take_inbox(Worker* self);
+
+    //A random index of the workers, by a xorshift of each thread
+    static size_t pick();
+
+    static void execute(Work* work);
+
+    static Worker* workers;
+    static size_t thread_count;
+    //Idle threads wait on it. It's released once for each submit while there are threads asleep.
+    static HANDLE wakeup;
+    static volatile long sleepers;
+    static volatile bool stopping;
+    static volatile LONG64 steals;
+
+    //The worker of the pool thread, or nullptr on other threads
+    static thread_local Worker* current;
+};
@@ -0,0 +1,100 @@
+#include "Connection.h"
+#include "Log.h"
+
+bool Connection::IoAwaiter::await_suspend(std::coroutine_handle<> awaiting)
+{
+    //NOTE: The awaiter is in the frame of the coroutine, which may be resumed and even destroyed by another
+    //thread once the I/O is started. So nothing of the awaiter is touched after that.
+    auto connection = m_connection;
+    connection->m_awaiting = awaiting;
+    connection->m_result = 0;
+    connection->m_sync = Issuing;
+    if (m_send) {
+        connection->m_send_size = m_size;
+    }
+    auto ok = m_send ? connection->m_socket->send(m_buf, m_size) : connection->m_socket->receive(m_buf, m_size);
+    if (!ok) {
+        connection->m_sync = Idle;
+        connection->m_awaiting = nullptr;
+        return false;
+    }
+    if (InterlockedCompareExchange(&connection->m_sync, Suspended, Issuing) == Issuing) {
+        return true;
+    }
+    //It has completed in the call, so go on with the result at once.
+    connection->m_sync = Idle;
+    connection->m_awaiting = nullptr;
+    return false;
+}
+
+Connection::~Connection()
+{
+    //The frame is destroyed with m_task, even if the coroutine is still suspended, like on an I/O that was pending
+    //at shutdown.
+}
+
+void Connection::complete(size_t result)
+{
+    m_result = result;
+    if (InterlockedCompareExchange(&m_sync, Completed, Issuing) == Issuing) {
+        return;
+    }
+    if (InterlockedCompareExchange(&m_sync, Idle, Suspended) != Suspended) {
+        //No coroutine awaits.
+        return;
+    }
+    auto awaiting = m_awaiting;
+    m_awaiting = nullptr;
+    awaiting.resume();
+    if (m_task.done() && !m_finished) {
+        m_finished = true;
+        m_socket->shutdown();
+    }
+}
+
+void Connection::on_started(ServerSocket* socket)
+{
+    m_socket = socket;
+    m_task = m_serve(*this);
+    m_task.start();
+    if (m_task.done() && !m_finished) {
+        m_finished = true;
+        socket->shutdown();
+    }
+}
+
+void Connection::on_shutdown(ServerSocket* socket)
+{
+    LOG_INFO("Retiring ServerSocket...");
+    //An awaiting coroutine sees the connection closed, and then should return.
+    //NOTE: When the socket is shut down with the I/O awaited still pending, like from another thread, the coroutine
+    //isn't resumed, since it may free the buffer, in a local or the frame of a task it awaits, before the I/O is
+    //canceled. It stays suspended, and its frame is destroyed with the connection, once the socket is freed after
+    //all of its I/O.
+    if (!socket->is_io_pending()) {
+        complete(0);
+    }
+    socket->retire();
+}
+
+void Connection::on_received(ServerSocket* socket, char* buf, size_t size, size_t received)
+{
+    complete(received);
+}
+
+void Connection::on_sent(ServerSocket* socket, const char* buf, size_t size, size_t sent)
+{
+    if (size > sent) {
+        if (!socket->send(buf + sent, size - sent)) {
+            complete(0);
+        }
+        return;
+    }
+    complete(m_send_size);
+}
+
+void Connection::on_error(ServerSocket* socket)
+{
+    LOG_ERROR("ServerSocket error in state: ", (int)socket->get_state());
+    socket->shutdown();
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "ServerSocket.h"
+#include "Task.h"
+#include <span>
+
+//A handler that runs a coroutine for the connection, so that a protocol is written as straight-line code that
+//awaits receives and sends, rather than a state machine of callbacks. The coroutine is started in on_started and
+//resumed by the completions of the socket on the workers, one await at a time. When it returns, the socket is
+//shut down. When the socket is shut down while an I/O is pending, the coroutine is destroyed, still suspended,
+//rather than resumed, so destructors of its locals run but not the code after the await.
+//
+//An await allocates nothing, and the frames of the coroutines come from FramePool.
+class Connection : public IServerSocketHandler
+{
+public:
+    typedef Task<> (*Serve)(Connection& connection);
+
+    //Await receive or send on a Connection. It's a part of the frame of the awaiting coroutine.
+    class IoAwaiter
+    {
+    public:
+        IoAwaiter(Connection* connection, bool send, char* buf, size_t size) :
+            m_connection(connection), m_send(send), m_buf(buf), m_size(size) {}
+
+        bool await_ready() noexcept {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> awaiting);
+
+        size_t await_resume() noexcept {
+            return m_connection->m_result;
+        }
+
+    private:
+        Connection* m_connection;
+        bool m_send;
+        char* m_buf;
+        size_t m_size;
+    };
+
+    explicit Connection(Serve serve) : m_serve(serve) {}
+
+    ~Connection();
+
+    //Resume with the bytes received, or 0 when the connection is closed or has failed.
+    IoAwaiter receive(char* buf, size_t size) {
+        return IoAwaiter(this, false, buf, size);
+    }
+
+    IoAwaiter receive(std::span<char> buf) {
+        return receive(buf.data(), buf.size());
+    }
+
+    //Resume when all of data is sent, with its size, or with 0 when the connection has failed.
+    IoAwaiter send(const char* data, size_t size) {
+        return IoAwaiter(this, true, (char*)data, size);
+    }
+
+    IoAwaiter send(std::span<const char> data) {
+        return send(data.data(), data.size());
+    }
+
+    ServerSocket* get_socket() const {
+        return m_socket;
+    }
+
+    virtual void on_started(ServerSocket* socket) override;
+
+    virtual void on_shutdown(ServerSocket* socket) override;
+
+    virtual void on_received(ServerSocket* socket, char* buf, size_t size, size_t received) override;
+
+    virtual void on_sent(ServerSocket* socket, const char* buf, size_t size, size_t sent) override;
+
+    virtual void on_error(ServerSocket* socket) override;
+
+private:
+    enum Sync {
+        Idle = 0,
+        //The I/O is being started by the awaiter.
+        Issuing,
+        Suspended,
+        //The I/O has completed before the awaiter has suspended the coroutine.
+        Completed
+    };
+
+    //Resume the awaiting coroutine with the result.
+    void complete(size_t result);
+
+    Serve m_serve;
+    ServerSocket* m_socket = nullptr;
+    Task<> m_task;
+    std::coroutine_handle<> m_awaiting;
+    size_t m_result = 0;
+    //Size of the data being sent, which the send awaiter resumes with
+    size_t m_send_size = 0;
+    //NOTE: An I/O may complete on another worker before the awaiter has suspended the coroutine, or within the
+    //call that starts it, like a receive served from buffered TLS records. Whichever of the two comes second
+    //resumes the coroutine, decided by this.
+    volatile long m_sync = Idle;
+    bool m_finished = false;
+};
@@ -0,0 +1,114 @@
+#include "ConnectionRegistry.h"
+#include "Log.h"
+#include <cassert>
+
+ConnectionRegistry::ConnectionRegistry()
+{
+}
+
+ConnectionRegistry::~ConnectionRegistry()
+{
+    for (auto& shard : m_shards) {
+        for (size_t c = 0; c < shard.chunk_count; c++) {
+            delete[] shard.chunks[c];
+        }
+    }
+}
+
+ConnectionHandle ConnectionRegistry::add(ServerSocket* socket)
+{
+    assert(socket);
+    size_t s = (ULONG)InterlockedIncrement(&m_next_shard) % shard_count;
+    auto& shard = m_shards[s];
+    AcquireSRWLockExclusive(&shard.lock);
+    if (!shard.free_head) {
+        if (shard.chunk_count == max_chunks) {
+            ReleaseSRWLockExclusive(&shard.lock);
+            LOG_ERROR("Shard ", s, " is full.");
+            return ConnectionHandle();
+        }
+        //Chunks are never freed before the registry itself, so lock-free readers can always dereference them.
+        auto chunk = new Slot[chunk_size];
+        size_t base = shard.chunk_count * chunk_size;
+        for (size_t i = 0; i < chunk_size; i++) {
+            chunk[i].next_free = (i + 1 < chunk_size) ? base + i + 2 : 0;
+        }
+        shard.chunks[shard.chunk_count++] = chunk;
+        shard.free_head = base + 1;
+    }
+    size_t index = shard.free_head - 1;
+    auto slot = get_slot(s, index);
+    shard.free_head = slot->next_free;
+    slot->socket = socket;
+    auto handle = make_handle(slot->generation, s, index);
+    InterlockedIncrement(&shard.count);
+    ReleaseSRWLockExclusive(&shard.lock);
+    return handle;
+}
+
+bool ConnectionRegistry::remove(ConnectionHandle handle)
+{
+    LONG generation;
+    size_t s, index;
+    split_handle(handle, generation, s, index);
+    if (s >= shard_count) {
+        return false;
+    }
+    auto& shard = m_shards[s];
+    AcquireSRWLockExclusive(&shard.lock);
+    auto slot = get_slot(s, index);
+    if (!slot || slot->generation != generation) {
+        ReleaseSRWLockExclusive(&shard.lock);
+        return false;
+    }
+    //Bump the generation before clearing the pointer, so a concurrent find that has read the old pointer
+    //will see the generation change on its second check and fail.
+    if (InterlockedIncrement(&slot->generation) == 0) {
+        //Generation 0 is reserved for the invalid handle.
+        InterlockedIncrement(&slot->generation);
+    }
+    slot->socket = nullptr;
+    slot->next_free = shard.free_head;
+    shard.free_head = index + 1;
+    InterlockedDecrement(&shard.count);
+    ReleaseSRWLockExclusive(&shard.lock);
+    return true;
+}
+
+ServerSocket* ConnectionRegistry::find(ConnectionHandle handle) const
+{
+    LONG generation;
+    size_t s, index;
+    split_handle(handle, generation, s, index);
+    if (!generation || s >= shard_count) {
+        return nullptr;
+    }
+    auto slot = get_slot(s, index);
+    if (!slot || slot->generation != generation) {
+        return nullptr;
+    }
+    ServerSocket* socket = slot->socket;
+    if (slot->generation != generation) {
+        return nullptr;
+    }
+    return socket;
+}
+
+size_t ConnectionRegistry::size() const
+{
+    size_t total = 0;
+    for (auto& shard : m_shards) {
+        total += shard.count;
+    }
+    return total;
+}
+
+ConnectionRegistry::Slot* ConnectionRegistry::get_slot(size_t shard, size_t index) const
+{
+    size_t c = index / chunk_size;
+    if (c >= max_chunks) {
+        return nullptr;
+    }
+    Slot* chunk = m_shards[shard].chunks[c];
+    return chunk ? &chunk[index % chunk_size] : nullptr;
+}
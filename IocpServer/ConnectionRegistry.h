@@ -0,0 +1,119 @@
+#pragma once
+
+#include "Common.h"
+#include <cstdint>
+
+class ServerSocket;
+
+//A generation-tagged reference to a registered ServerSocket. The generation of a slot is bumped every time
+//the slot is released, so a handle to a connection that is gone is rejected in O(1) by comparing generations,
+//even after the slot has been reused by another connection.
+struct ConnectionHandle
+{
+    uint64_t value = 0;
+
+    bool valid() const {
+        return value != 0;
+    }
+
+    bool operator == (const ConnectionHandle& other) const {
+        return value == other.value;
+    }
+
+    bool operator != (const ConnectionHandle& other) const {
+        return value != other.value;
+    }
+};
+
+//A sharded table of live ServerSockets. Lookups and iterations are lock-free. Adding and removing an entry
+//takes the lock of one shard only. Connections are added to the shards in turn, so they're spread evenly over
+//the shards, and the removes from the workers, which come in any order, rarely contend.
+//
+//NOTE: The table only tells whether a handle is still valid at the time of lookup. A pointer got from it may
+//still be deleted by another thread afterwards. Whoever holds the pointer must make sure the socket is not
+//freed under it.
+class ConnectionRegistry
+{
+public:
+    static const size_t shard_count = 16;
+    static const size_t chunk_size = 1024;
+    static const size_t max_chunks = 256;
+
+    ConnectionRegistry();
+
+    ~ConnectionRegistry();
+
+    ConnectionRegistry(const ConnectionRegistry&) = delete;
+
+    ConnectionRegistry& operator = (const ConnectionRegistry&) = delete;
+
+    //Return an invalid handle when the shard is full.
+    ConnectionHandle add(ServerSocket* socket);
+
+    bool remove(ConnectionHandle handle);
+
+    ServerSocket* find(ConnectionHandle handle) const;
+
+    size_t size() const;
+
+    //Call f(ConnectionHandle, ServerSocket*) for each live connection. Connections added or removed during the
+    //iteration may or may not be visited.
+    template <typename F>
+    void for_each(F f) const {
+        for (size_t s = 0; s < shard_count; s++) {
+            auto& shard = m_shards[s];
+            for (size_t c = 0; c < max_chunks; c++) {
+                Slot* chunk = shard.chunks[c];
+                if (!chunk) {
+                    break;
+                }
+                for (size_t i = 0; i < chunk_size; i++) {
+                    auto& slot = chunk[i];
+                    LONG generation = slot.generation;
+                    ServerSocket* socket = slot.socket;
+                    if (socket && slot.generation == generation) {
+                        f(make_handle(generation, s, c * chunk_size + i), socket);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        volatile LONG generation = 1;
+        ServerSocket* volatile socket = nullptr;
+        size_t next_free = 0;
+    };
+
+    //Each shard sits on its own cache line(s) so that adds/removes on different shards don't interfere.
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        SRWLOCK lock = SRWLOCK_INIT;
+        Slot* volatile chunks[max_chunks] = {};
+        size_t chunk_count = 0;
+        //Index of the first free slot plus one, or 0 when there's none.
+        size_t free_head = 0;
+        volatile LONG count = 0;
+    };
+
+    static const int index_bits = 24;
+    static const int shard_bits = 8;
+
+    static inline ConnectionHandle make_handle(LONG generation, size_t shard, size_t index) {
+        ConnectionHandle handle;
+        handle.value = ((uint64_t)(uint32_t)generation << 32) | ((uint64_t)shard << index_bits) | (uint64_t)index;
+        return handle;
+    }
+
+    static inline void split_handle(ConnectionHandle handle, LONG& generation, size_t& shard, size_t& index) {
+        generation = (LONG)(uint32_t)(handle.value >> 32);
+        shard = (size_t)((handle.value >> index_bits) & ((1 << shard_bits) - 1));
+        index = (size_t)(handle.value & ((1 << index_bits) - 1));
+    }
+
+    Slot* get_slot(size_t shard, size_t index) const;
+
+    Shard m_shards[shard_count];
+    //The shard of the next add, by a counter rather than the processor, since all adds may come from one thread.
+    volatile LONG m_next_shard = 0;
+};
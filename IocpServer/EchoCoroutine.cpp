@@ -0,0 +1,18 @@
+#include "EchoCoroutine.h"
+#include "Log.h"
+#include <vector>
+
+Task<> echo_coroutine(Connection& connection, size_t buf_size)
+{
+    std::vector<char> buf(buf_size);
+    while (true) {
+        auto received = co_await connection.receive(buf.data(), buf.size());
+        if (!received) {
+            break;
+        }
+        LOG_VERBOSE("received: ", received);
+        if (!co_await connection.send(buf.data(), received)) {
+            break;
+        }
+    }
+}
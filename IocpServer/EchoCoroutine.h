@@ -0,0 +1,6 @@
+#pragma once
+
+#include "Connection.h"
+
+//The same echo as EchoServer, as a coroutine for Connection.
+Task<> echo_coroutine(Connection& connection, size_t buf_size);
@@ -1,48 +1,49 @@
 #include "EchoServer.h"
 #include "Log.h"
 
+namespace {
+    //Spin for microseconds, as CPU bound work.
+    void burn_cpu(LONG64 microseconds) {
+        LARGE_INTEGER frequency;
+        LARGE_INTEGER start;
+        LARGE_INTEGER now;
+        QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&start);
+        auto ticks = microseconds * frequency.QuadPart / 1000000;
+        do {
+            QueryPerformanceCounter(&now);
+        } while (now.QuadPart - start.QuadPart < ticks);
+    }
+}
 
 EchoServer::~EchoServer()
 {
     LOG_INFO("");
 }
 
-void EchoServer::on_started(ServerSocket* socket)
-{
-    LOG_INFO("Start receiving...");
-    if (!socket->receive(m_buf.data(), m_buf.size())) {
-        LOG_ERROR("receive failed!");
-        socket->shutdown();
-    }
-}
-
 void EchoServer::on_shutdown(ServerSocket* socket)
 {
-    LOG_INFO("Destroying ServerSocket...");
-    //NOTE: Delete the socket in the shutdown handler once and avoid deleting the socket multiple times.
-    delete socket;
-}
-
-void EchoServer::on_received(ServerSocket* socket, char* buf, size_t size, size_t received)
-{
-    LOG_VERBOSE("received: ", received);
-    if (!socket->send(buf, received)) {
-        socket->shutdown();
-    }
+    LOG_INFO("Retiring ServerSocket...");
+    //NOTE: Retire the socket in the shutdown handler once and avoid retiring the socket multiple times.
+    //Other completions of the socket may still be queued, so it must not be deleted here.
+    socket->retire();
 }
 
-void EchoServer::on_sent(ServerSocket* socket, const char* buf, size_t size, size_t sent)
+void EchoServer::offload_echo(ServerSocket* socket, char* buf, size_t received)
 {
-    LOG_VERBOSE("sent: ", sent, "target: ", size);
-    if (size > sent) {
-        if (!socket->send(buf + sent, size - sent)) {
-            socket->shutdown();
-        }
-    }
-    else {
-        if (!socket->receive(m_buf.data(), m_buf.size())) {
+    //NOTE: The work only takes the size. buf is sent in done, which runs on the socket, while the next receive
+    //into it waits for the send.
+    auto microseconds = (LONG64)m_work_per_kib * received / 1024;
+    auto ok = socket->offload([microseconds]() {
+        burn_cpu(microseconds);
+        return true;
+    }, [buf, received](ServerSocket* socket, bool) {
+        if (!socket->send(buf, received)) {
             socket->shutdown();
         }
+    });
+    if (!ok) {
+        socket->shutdown();
     }
 }
 
@@ -51,3 +52,15 @@ void EchoServer::on_error(ServerSocket* socket)
     LOG_ERROR("ServerSocket error in state: ", (int)socket->get_state());
     socket->shutdown();
 }
+
+void EchoServer::on_backpressure(ServerSocket* socket, size_t queued)
+{
+    LOG_VERBOSE("Pausing receive with ", queued, " bytes queued.");
+    socket->pause_receive();
+}
+
+void EchoServer::on_writable(ServerSocket* socket)
+{
+    LOG_VERBOSE("Resuming receive.");
+    socket->resume_receive();
+}
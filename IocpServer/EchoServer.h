@@ -1,28 +1,93 @@
 #pragma once
 
 #include "ServerSocket.h"
+#include "Log.h"
 #include <vector>
 
-class EchoServer : public IServerSocketHandler
+class EchoServer final : public IServerSocketHandler
 {
 public:
-    EchoServer(size_t buf_size) {
+    //With queued, data is echoed through the send queue, and the next receive starts at once rather than after the
+    //data is sent. Receiving is paused while the peer doesn't read fast enough.
+    //
+    //With work_per_kib, it burns that many microseconds of CPU per KiB received before echoing, as a synthetic
+    //handler with real work to do, off the workers by ServerSocket::offload. It applies when not queued.
+    EchoServer(size_t buf_size, bool queued = false, DWORD work_per_kib = 0) : m_queued(queued),
+        m_work_per_kib(work_per_kib) {
         m_buf.resize(buf_size);
     }
 
     ~EchoServer();
 
-    virtual void on_started(ServerSocket* socket) override;
+    virtual void on_started(ServerSocket* socket) override {
+        on_started<ServerSocket>(socket);
+    }
 
     virtual void on_shutdown(ServerSocket* socket) override;
 
-    virtual void on_received(ServerSocket* socket, char* buf, size_t size, size_t received) override;
+    virtual void on_received(ServerSocket* socket, char* buf, size_t size, size_t received) override {
+        on_received<ServerSocket>(socket, buf, size, received);
+    }
 
-    virtual void on_sent(ServerSocket* socket, const char* buf, size_t size, size_t sent) override;
+    virtual void on_sent(ServerSocket* socket, const char* buf, size_t size, size_t sent) override {
+        on_sent<ServerSocket>(socket, buf, size, sent);
+    }
 
     virtual void on_error(ServerSocket* socket) override;
 
+    virtual void on_backpressure(ServerSocket* socket, size_t queued) override;
+
+    virtual void on_writable(ServerSocket* socket) override;
+
+    //The callbacks of the echo for a socket of any type, so that a BasicServerSocket goes on with its own receive
+    //and send.
+    template <typename Socket>
+    void on_started(Socket* socket) {
+        LOG_INFO("Start receiving...");
+        if (!socket->receive(m_buf.data(), m_buf.size())) {
+            LOG_ERROR("receive failed!");
+            socket->shutdown();
+        }
+    }
+
+    template <typename Socket>
+    void on_received(Socket* socket, char* buf, size_t size, size_t received) {
+        LOG_VERBOSE("received: ", received);
+        if (m_queued) {
+            if (!socket->queue_send(buf, received) || !socket->receive(m_buf.data(), m_buf.size())) {
+                socket->shutdown();
+            }
+            return;
+        }
+        if (m_work_per_kib) {
+            offload_echo(socket, buf, received);
+            return;
+        }
+        if (!socket->send(buf, received)) {
+            socket->shutdown();
+        }
+    }
+
+    template <typename Socket>
+    void on_sent(Socket* socket, const char* buf, size_t size, size_t sent) {
+        LOG_VERBOSE("sent: ", sent, "target: ", size);
+        if (size > sent) {
+            if (!socket->send(buf + sent, size - sent)) {
+                socket->shutdown();
+            }
+        }
+        else {
+            if (!socket->receive(m_buf.data(), m_buf.size())) {
+                socket->shutdown();
+            }
+        }
+    }
+
 private:
+    //Echo after the work of work_per_kib, off the workers.
+    void offload_echo(ServerSocket* socket, char* buf, size_t received);
+
     std::vector<char> m_buf;
+    bool m_queued;
+    DWORD m_work_per_kib;
 };
-
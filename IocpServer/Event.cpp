@@ -1 +1,54 @@
 #include "Event.h"
+#include "ServerSocket.h"
+#include "Strand.h"
+
+void HandshakeReceiveEvent::run()
+{
+    m_server->do_handshake_receive_event(this);
+}
+
+void HandshakeSendEvent::run()
+{
+    m_server->do_handshake_send_event(this);
+}
+
+void HandshakeWorkEvent::run()
+{
+    m_server->do_handshake_work_event(this);
+}
+
+void YieldEvent::run()
+{
+    m_server->dispatch(this);
+}
+
+void YieldEvent::complete()
+{
+    m_server->do_yield_event(this);
+}
+
+void QueueSendEvent::run()
+{
+    m_server->dispatch(this);
+}
+
+void QueueSendEvent::complete()
+{
+    m_server->do_queue_send_event(this);
+}
+
+void TaskEvent::run()
+{
+    if (m_strand) {
+        m_strand->dispatch(this);
+    }
+    else {
+        complete();
+    }
+}
+
+void TaskEvent::complete()
+{
+    m_task();
+    delete this;
+}
@@ -1,14 +1,37 @@
 #pragma once
 
 #include "Common.h"
-#include "ServerSocket.h"
+#include <cstring>
+#include <vector>
+#include <functional>
+
+class ServerSocket;
+class Strand;
 
 class Event : public OVERLAPPED
 {
+    friend class Strand;
+
 public:
+    //OVERLAPPED must be zeroed before it's passed to an I/O call.
+    Event() : OVERLAPPED() {}
+
+    //Called by the worker that dequeues the event.
     virtual void run() = 0;
 
+    //Called by a Strand that the event is dispatched to.
+    virtual void complete() {}
+
+    //Clear the OVERLAPPED part for reuse, after the previous I/O has completed.
+    void reset() {
+        memset(static_cast<OVERLAPPED*>(this), 0, sizeof(OVERLAPPED));
+    }
+
     virtual ~Event() {}
+
+private:
+    //Link of the queue of a Strand
+    Event* m_next = nullptr;
 };
 
 class IoEvent : public Event 
@@ -23,15 +46,13 @@ protected:
     size_t m_size;
 };
 
+//NOTE: A data event is run through the strand of the socket, if it has one, see ServerSocket::enable_strand. The
+//handshake events are not, since no handler runs before the handshake is done.
+//A data event is created as a BasicDataEvent, which completes it on the path of the socket type.
 class ReceiveEvent : public IoEvent
 {
     friend class ServerSocket;
 
-public:
-    virtual void run() override {
-        m_server->do_receive_event(this);
-    }
-
 protected:
     ReceiveEvent(ServerSocket* s, char* buf, size_t size) : IoEvent(s, buf, size) {}
 };
@@ -40,11 +61,6 @@ class SendEvent : public IoEvent
 {
     friend class ServerSocket;
 
-public:
-    virtual void run() override {
-        m_server->do_send_event(this);
-    }
-
 protected:
     SendEvent(ServerSocket* s, const char* buf, size_t size) : IoEvent(s, (char *)buf, size) {}
 };
@@ -54,12 +70,10 @@ class HandshakeReceiveEvent : public ReceiveEvent
     friend class ServerSocket;
 
 public:
-    virtual void run() override {
-        m_server->do_handshake_receive_event(this);
-    }
+    virtual void run() override;
 
 protected:
-    HandshakeReceiveEvent(ServerSocket* s, char* buf, size_t size) : ReceiveEvent(s, buf, size) {}
+    explicit HandshakeReceiveEvent(ServerSocket* s) : ReceiveEvent(s, nullptr, 0) {}
 };
 
 class HandshakeSendEvent : public SendEvent
@@ -67,22 +81,70 @@ class HandshakeSendEvent : public SendEvent
     friend class ServerSocket;
 
 public:
-    virtual void run() override {
-        m_server->do_handshake_send_event(this);
+    virtual void run() override;
+
+protected:
+    explicit HandshakeSendEvent(ServerSocket* s) : SendEvent(s, nullptr, 0) {}
+
+    //Take the content of data, and give back the buffer of the last send in it, so that both are reused.
+    void swap_data(std::vector<char>& data) {
+        m_data.swap(data);
+        m_buf = m_data.data();
+        m_size = m_data.size();
     }
 
+    std::vector<char> m_data;
+};
+
+//Run the CPU heavy part of a handshake on the handshake lane, after the receive completes on a data worker.
+class HandshakeWorkEvent : public Event
+{
+    friend class ServerSocket;
+
+public:
+    virtual void run() override;
+
 protected:
-    HandshakeSendEvent(ServerSocket* s, const char* buf, size_t size) : SendEvent(s, buf, size) {}
+    explicit HandshakeWorkEvent(ServerSocket* s) : m_server(s) {}
+
+    ServerSocket* m_server;
 };
 
-class TlsSendEvent : public SendEvent
+//Start the receive of a connection that has used up its turn, behind the completions queued meanwhile.
+class YieldEvent : public Event
 {
     friend class ServerSocket;
 
 public:
-    virtual void run() override {
-        m_server->do_send_event(this);
-    }
+    virtual void run() override;
+
+    virtual void complete() override;
+
+protected:
+    explicit YieldEvent(ServerSocket* s) : m_server(s) {}
+
+    ServerSocket* m_server;
+};
+
+//Start sending from the queue of a socket on a worker, posted by the thread of queue_send that finds it idle.
+class QueueSendEvent : public Event
+{
+    friend class ServerSocket;
+
+public:
+    virtual void run() override;
+
+    virtual void complete() override;
+
+protected:
+    explicit QueueSendEvent(ServerSocket* s) : m_server(s) {}
+
+    ServerSocket* m_server;
+};
+
+class TlsSendEvent : public SendEvent
+{
+    friend class ServerSocket;
 
 protected:
     TlsSendEvent(ServerSocket* s, const char* buf, size_t size, size_t send_size, size_t encrypted_send_size) :
@@ -90,4 +152,19 @@ protected:
 
     size_t m_send_size;
     size_t m_encrypted_send_size;
-};
\ No newline at end of file
+};
+
+//A task posted to a completion port, see Executor. It deletes itself when it's done.
+class TaskEvent : public Event
+{
+public:
+    TaskEvent(std::function<void()>&& task, Strand* strand) : m_task(std::move(task)), m_strand(strand) {}
+
+    virtual void run() override;
+
+    virtual void complete() override;
+
+private:
+    std::function<void()> m_task;
+    Strand* m_strand;
+};
@@ -0,0 +1,17 @@
+#include "Executor.h"
+#include "Event.h"
+#include "Log.h"
+
+HANDLE Executor::iocp = nullptr;
+
+bool Executor::post(std::function<void()> task, Strand* strand)
+{
+    auto event = new TaskEvent(std::move(task), strand);
+    //NOTE: The key is 0 for a task, which a worker tells from the stop signal by the event.
+    if (!PostQueuedCompletionStatus(iocp, 0, 0, event)) {
+        LOG_WARN("PostQueuedCompletionStatus failed with error: ", GetLastError());
+        delete event;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Common.h"
+#include <functional>
+
+class Strand;
+
+//Run tasks on the IOCP workers, from any thread. A task is posted to the completion port in a TaskEvent, and
+//run by the worker that dequeues it, in between I/O completions.
+class Executor
+{
+public:
+    static void init(HANDLE iocp) {
+        Executor::iocp = iocp;
+    }
+
+    //Run task on a worker later, or on strand, one at a time with the other events of it, when it's given.
+    //strand must outlive the task.
+    static bool post(std::function<void()> task, Strand* strand = nullptr);
+
+private:
+    static HANDLE iocp;
+};
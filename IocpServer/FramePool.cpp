@@ -0,0 +1,36 @@
+#include "FramePool.h"
+#include <new>
+
+SLIST_HEADER FramePool::free_lists[FramePool::class_count];
+
+void* FramePool::allocate(size_t size)
+{
+    auto size_class = (size + sizeof(Header) + class_size - 1) / class_size;
+    Header* header = nullptr;
+    if (size_class < class_count) {
+        header = (Header*)InterlockedPopEntrySList(&free_lists[size_class]);
+        if (!header) {
+            header = (Header*)_aligned_malloc(size_class * class_size, MEMORY_ALLOCATION_ALIGNMENT);
+        }
+    }
+    else {
+        size_class = 0;
+        header = (Header*)_aligned_malloc(size + sizeof(Header), MEMORY_ALLOCATION_ALIGNMENT);
+    }
+    if (!header) {
+        throw std::bad_alloc();
+    }
+    header->size_class = size_class;
+    return header + 1;
+}
+
+void FramePool::free(void* p)
+{
+    auto header = (Header*)p - 1;
+    if (header->size_class) {
+        InterlockedPushEntrySList(&free_lists[header->size_class], &header->entry);
+    }
+    else {
+        _aligned_free(header);
+    }
+}
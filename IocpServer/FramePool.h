@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Common.h"
+
+//A pool of coroutine frames in size classes of 128 bytes up to 4KiB, so that a coroutine doesn't go to the heap
+//once the pool is warm. A frame is often freed on another thread than the one that allocated it, as a connection
+//moves between workers, so the free lists are the lock-free SLists of Windows. Frames are never given back.
+class FramePool
+{
+public:
+    static const size_t class_size = 128;
+    static const size_t class_count = 32;
+
+    static void* allocate(size_t size);
+
+    static void free(void* p);
+
+private:
+    //Put before each frame. It's the link of the free list while the frame is free, and the size class otherwise,
+    //where 0 is for a frame too big for the pool. It keeps frames aligned as SLIST_ENTRY requires.
+    union alignas(MEMORY_ALLOCATION_ALIGNMENT) Header {
+        SLIST_ENTRY entry;
+        size_t size_class;
+    };
+
+    //A zeroed SLIST_HEADER is an empty list.
+    static SLIST_HEADER free_lists[class_count];
+};
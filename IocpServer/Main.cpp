@@ -4,13 +4,123 @@
 #include "Log.h"
 #include "ServerSocket.h"
 #include "EchoServer.h"
+#include "EchoCoroutine.h"
+#include "BasicServerSocket.h"
 #include "Event.h"
+#include "Reclaimer.h"
+#include "TimerWheel.h"
+#include "Executor.h"
+#include "Strand.h"
+#include "ComputePool.h"
+#include "AdmissionControl.h"
+#include "AllocationCounter.h"
+#include "..\SecureSocket\HandshakeStats.h"
+#include "..\SecureSocket\CredentialCache.h"
+#include "..\SecureSocket\OpenSslTls.h"
+#include "..\SecureSocket\NullTls.h"
+
+using My::HandshakeStats;
+using My::CredentialCache;
 
 #pragma comment (lib, "Ws2_32.lib")
 
 #define DEFAULT_PORT "27015"
 #define MAX_WORKERS 64
 #define BUF_SIZE (1024 * 16)
+//In milliseconds. An idle worker wakes up at this interval to announce a quiescent state.
+#define QUIESCENT_INTERVAL 100
+//In milliseconds
+#define STATS_INTERVAL 10000
+//In milliseconds. Timeouts fire up to a tick late.
+#define TIMER_TICK 100
+//In milliseconds. A worker with I/O held by rate limits wakes up at this interval.
+#define PACING_TICK 10
+//In milliseconds. The buffers of a connection that has sent nothing for TRIM_IDLE are freed, checked every
+//TRIM_INTERVAL.
+#define TRIM_IDLE 5000
+#define TRIM_INTERVAL 1000
+//Bytes queued to a connection, over which producers of the benchmark of queue_send wait for the peer
+#define QUEUE_BENCHMARK_LIMIT (1024 * 1024)
+//Bytes of each receive and send of the benchmark of a connection busy both ways, small for many completions
+#define DUPLEX_BENCHMARK_SIZE (1024 * 4)
+//Bytes of each message of the benchmark of echo
+#define ECHO_BENCHMARK_SIZE 256
+//Bytes of each send of the benchmark of sends without a kernel copy, large for the copy to matter
+#define ZERO_COPY_BENCHMARK_SIZE (1024 * 64)
+
+void log_handshake_stats(ULONGLONG elapsed, LONG64& last_full, LONG64& last_resumed, LONG64& last_allocations) {
+    auto full = HandshakeStats::get_full();
+    auto resumed = HandshakeStats::get_resumed();
+    auto allocations = AllocationCounter::get_count();
+    if (full == last_full && resumed == last_resumed) {
+        last_allocations = allocations;
+        return;
+    }
+    double seconds = elapsed / 1000.0;
+    //NOTE: All allocations of the process in the interval are counted, so it's the cost of a handshake only when
+    //the clients do nothing else, like HandshakeBench with no message.
+    auto handshakes = (full - last_full) + (resumed - last_resumed);
+    LOG_INFO("Handshakes per second: full ", (full - last_full) / seconds, ", resumed ", (resumed - last_resumed) / seconds,
+        ", allocations per handshake ", (double)(allocations - last_allocations) / handshakes, ". In total: full ", full,
+        ", resumed ", resumed, ", hit rate ", HandshakeStats::get_hit_rate(), "%, TLS 1.3 ", HandshakeStats::get_tls13());
+    last_full = full;
+    last_resumed = resumed;
+    last_allocations = allocations;
+}
+
+#ifdef MY_TLS_OPENSSL
+//Resumption by session IDs of the OpenSSL server, which is all of it with -N.
+void log_session_cache_stats() {
+    auto& cache = My::OpenSslTlsProvider::get_server_sessions();
+    auto hits = cache.get_hits();
+    auto misses = cache.get_misses();
+    LOG_INFO("Session cache: ", cache.size(), " sessions, hits ", hits, ", misses ", misses, ", hit rate ",
+        hits + misses ? hits * 100.0 / (hits + misses) : 0.0, "%");
+}
+#endif
+
+void log_buffer_stats(LONG64& last_bytes) {
+    auto bytes = ServerSocket::get_total_buffer_bytes();
+    if (bytes == last_bytes) {
+        return;
+    }
+    auto connections = ServerSocket::get_connections().size();
+    LOG_INFO("I/O buffers: ", bytes / 1024, " KiB, ", connections ? bytes / connections : 0, " bytes per connection. ",
+        "Receives held by the budget: ", ServerSocket::get_budget_delays());
+    last_bytes = bytes;
+}
+
+void log_yield_stats(ULONGLONG elapsed, LONG64& last_yields) {
+    auto yields = ServerSocket::get_yields();
+    if (yields == last_yields) {
+        return;
+    }
+    LOG_INFO("Connections yielded per second: ", (yields - last_yields) / (elapsed / 1000.0));
+    last_yields = yields;
+}
+
+void log_compute_stats(ULONGLONG elapsed, LONG64& last_steals) {
+    auto steals = ComputePool::get_steals();
+    if (steals == last_steals) {
+        return;
+    }
+    LOG_INFO("Work stolen per second in the compute pool: ", (steals - last_steals) / (elapsed / 1000.0));
+    last_steals = steals;
+}
+
+void log_admission_stats(const AdmissionControl& admission, LONG64& last_shed) {
+    auto connections = admission.get_shed(AdmissionControl::Verdict::TooManyConnections);
+    auto handshakes = admission.get_shed(AdmissionControl::Verdict::TooManyHandshakes);
+    auto rate = admission.get_shed(AdmissionControl::Verdict::OverRate);
+    auto shed = connections + handshakes + rate;
+    if (shed == last_shed) {
+        return;
+    }
+    LOG_INFO("Connections: ", ServerSocket::get_connections().size(), ", handshakes: ", ServerSocket::get_handshakes(),
+        ". In total: admitted ", admission.get_admitted(), ", shed for connections ", connections, ", handshakes ",
+        handshakes, ", rate ", rate);
+    last_shed = shed;
+}
 
 SOCKET create_server_socket() {
     struct addrinfo hints = {}; //ZeroMemory
@@ -55,37 +165,484 @@ SOCKET create_server_socket() {
 
 unsigned int __stdcall iocp_worker(void* arg);
 
-HANDLE g_workers[MAX_WORKERS] = {};
-size_t g_worker_count = 0;
+//Workers of a completion port
+struct WorkerPool {
+    HANDLE workers[MAX_WORKERS] = {};
+    size_t count = 0;
+};
+
+WorkerPool g_workers;
+//Workers of the handshake lane, see ServerSocket::set_handshake_lane.
+WorkerPool g_handshake_workers;
 
-bool create_iocp_workers(HANDLE iocp) {
+size_t get_processor_count() {
     SYSTEM_INFO system_info;
     GetSystemInfo(&system_info);
-    g_worker_count = system_info.dwNumberOfProcessors * 2;
-    if (g_worker_count > MAX_WORKERS) {
-        g_worker_count = MAX_WORKERS;
+    return system_info.dwNumberOfProcessors;
+}
+
+bool create_pool_workers(HANDLE iocp, WorkerPool& pool, size_t count) {
+    pool.count = count;
+    if (pool.count > MAX_WORKERS) {
+        pool.count = MAX_WORKERS;
     }
-    for (size_t i = 0; i < g_worker_count; i++) {
-        g_workers[i] = (HANDLE)_beginthreadex(nullptr, 0, iocp_worker, iocp, 0, nullptr);
-        if (!g_workers[i]) {
+    for (size_t i = 0; i < pool.count; i++) {
+        pool.workers[i] = (HANDLE)_beginthreadex(nullptr, 0, iocp_worker, iocp, 0, nullptr);
+        if (!pool.workers[i]) {
             LOG_ERROR("_beginthreadex failed with error: ", GetLastError());
+            pool.count = i;
             return false;
         }
     }
     return true;
 }
 
-void stop_iocp_workers(HANDLE iocp) {
-    for (size_t i = 0; i < g_worker_count; i++) {
+void stop_pool_workers(HANDLE iocp, WorkerPool& pool) {
+    if (!pool.count) {
+        return;
+    }
+    for (size_t i = 0; i < pool.count; i++) {
         PostQueuedCompletionStatus(iocp, 0, 0, 0);
     }
-    WaitForMultipleObjects(g_worker_count, g_workers, TRUE, 1000 * 3);
-    for (size_t i = 0; i < g_worker_count; i++) {
-        CloseHandle(g_workers[i]);
+    WaitForMultipleObjects(pool.count, pool.workers, TRUE, 1000 * 3);
+    for (size_t i = 0; i < pool.count; i++) {
+        CloseHandle(pool.workers[i]);
+    }
+    pool.count = 0;
+}
+
+void stop_iocp_workers(HANDLE iocp, HANDLE lane) {
+    stop_pool_workers(iocp, g_workers);
+    stop_pool_workers(lane, g_handshake_workers);
+}
+
+//lane is optional.
+bool create_iocp_workers(HANDLE iocp, HANDLE lane, size_t lane_threads) {
+    if (!create_pool_workers(iocp, g_workers, get_processor_count() * 2) ||
+        (lane && !create_pool_workers(lane, g_handshake_workers, lane_threads))) {
+        stop_iocp_workers(iocp, lane);
+        return false;
+    }
+    return true;
+}
+
+void close_iocp(HANDLE iocp, HANDLE lane) {
+    CloseHandle(iocp);
+    if (lane) {
+        CloseHandle(lane);
+    }
+}
+
+//Post count tasks that do nothing but count, freely and then all on one strand, and log how many run per second
+//on the workers.
+void benchmark_post(size_t count) {
+    static volatile LONG64 done;
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    Strand strand;
+    for (auto on_strand : { false, true }) {
+        done = 0;
+        LARGE_INTEGER start;
+        LARGE_INTEGER end;
+        QueryPerformanceCounter(&start);
+        for (size_t i = 0; i < count; i++) {
+            if (!Executor::post([] { InterlockedIncrement64(&done); }, on_strand ? &strand : nullptr)) {
+                return;
+            }
+        }
+        while ((size_t)done < count || strand.is_busy()) {
+            YieldProcessor();
+        }
+        QueryPerformanceCounter(&end);
+        auto seconds = (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart;
+        LOG_INFO(on_strand ? "Tasks on a strand" : "Tasks", " per second: ", count / seconds);
     }
 }
 
+//Deadlines of the timers of benchmark_timers by key, where 0 is cancelled
+std::vector<ULONGLONG> g_timer_deadlines;
+
+ULONGLONG expire_benchmark_timer(uint64_t key, ULONGLONG now) {
+    return g_timer_deadlines[key];
+}
+
+//Add count timers spread over a minute to a wheel, cancel half of them, push back the rest by a minute, and expire
+//them all on a clock run ahead by ticks, the same as the timers of connections on a worker. Log the nanoseconds of
+//each operation.
+void benchmark_timers(size_t count) {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    auto nanoseconds = [&frequency](const LARGE_INTEGER& start) {
+        LARGE_INTEGER end;
+        QueryPerformanceCounter(&end);
+        return (double)(end.QuadPart - start.QuadPart) * 1000000000 / frequency.QuadPart;
+    };
+    const ULONGLONG span = 60 * 1000;
+    auto base = GetTickCount64();
+    TimerWheel wheel(base, TIMER_TICK);
+    g_timer_deadlines.assign(count, 0);
+    LARGE_INTEGER start;
+
+    QueryPerformanceCounter(&start);
+    for (size_t i = 0; i < count; i++) {
+        //Spread over the span in a scattered order, as connections come and go
+        auto deadline = base + 1 + (i * 7919) % span;
+        g_timer_deadlines[i] = deadline;
+        wheel.add(i, deadline);
+    }
+    auto add = nanoseconds(start);
+
+    //A cancel is a store to the deadline, see TimerWheel.
+    QueryPerformanceCounter(&start);
+    for (size_t i = 0; i < count; i += 2) {
+        g_timer_deadlines[i] = 0;
+    }
+    auto cancel = nanoseconds(start);
+
+    QueryPerformanceCounter(&start);
+    for (size_t i = 1; i < count; i += 2) {
+        g_timer_deadlines[i] += span;
+    }
+    auto push_back = nanoseconds(start);
+
+    size_t expired = 0;
+    QueryPerformanceCounter(&start);
+    for (auto now = base; wheel.size(); now += TIMER_TICK) {
+        expired += wheel.advance(now, expire_benchmark_timer);
+    }
+    auto expire = nanoseconds(start);
+
+    auto cancels = (count + 1) / 2;
+    auto push_backs = count / 2;
+    LOG_INFO("Timers: ", count, ", add: ", add / count, " ns, cancel: ", cancels ? cancel / cancels : 0,
+        " ns, push back: ", push_backs ? push_back / push_backs : 0, " ns, expire: ", expired ? expire / expired : 0,
+        " ns each of ", expired, " expired.");
+    std::vector<ULONGLONG>().swap(g_timer_deadlines);
+}
+
 bool g_exit = false;
+//Echo through the send queue of sockets, see EchoServer.
+bool g_queued_echo = false;
+//Echo by a coroutine, see Connection.
+bool g_coroutine_echo = false;
+//Microseconds of CPU burned per KiB echoed, see EchoServer.
+DWORD g_work_per_kib = 0;
+//Echo by sockets with the transport and handler fixed at compile time, see BasicServerSocket.
+bool g_typed_echo = false;
+
+typedef BasicServerSocket<PlainTransport, EchoServer> PlainEchoSocket;
+typedef BasicServerSocket<TlsTransport, EchoServer> TlsEchoSocket;
+
+template <typename Socket>
+void start_typed_echo(HANDLE iocp, SOCKET socket) {
+    auto handler = new EchoServer(BUF_SIZE, g_queued_echo, g_work_per_kib);
+    auto server = Socket::create(iocp, socket, handler);
+    if (!server) {
+        delete handler;
+        closesocket(socket);
+        return;
+    }
+    if (!server->start()) {
+        closesocket(socket);
+        server->retire();
+    }
+}
+
+Task<> serve_echo(Connection& connection) {
+    return echo_coroutine(connection, BUF_SIZE);
+}
+
+//Connect to the server over loopback, for the benchmarks that read and write raw bytes.
+SOCKET connect_loopback() {
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((u_short)atoi(DEFAULT_PORT));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    auto client = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (client == INVALID_SOCKET || connect(client, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        LOG_ERROR("connect failed with error: ", WSAGetLastError());
+        if (client != INVALID_SOCKET) {
+            closesocket(client);
+        }
+        return INVALID_SOCKET;
+    }
+    return client;
+}
+
+//The benchmark of a connection busy both ways, see benchmark_duplex.
+struct DuplexBenchmark {
+    DWORD seconds = 0;
+    SOCKET client = INVALID_SOCKET;
+    volatile bool stop = false;
+    LONG64 sent = 0;
+};
+
+DuplexBenchmark g_duplex_benchmark;
+
+//Receive and send on the connection at once, each side going on from its own completions, so that the receive and
+//send completions of one ServerSocket run on two workers at the same time. With a peer that only reads, it sends
+//as fast as the peer reads.
+class DuplexHandler final : public IServerSocketHandler
+{
+public:
+    explicit DuplexHandler(size_t size) : m_in(size), m_out(size, 'd') {}
+
+    virtual void on_started(ServerSocket* socket) override {
+        if (!socket->receive(m_in.data(), m_in.size()) || !socket->send(m_out.data(), m_out.size())) {
+            socket->shutdown();
+        }
+    }
+
+    virtual void on_shutdown(ServerSocket* socket) override {
+        socket->retire();
+    }
+
+    virtual void on_received(ServerSocket* socket, char* buf, size_t size, size_t received) override {
+        if (!socket->receive(m_in.data(), m_in.size())) {
+            socket->shutdown();
+        }
+    }
+
+    virtual void on_sent(ServerSocket* socket, const char* buf, size_t size, size_t sent) override {
+        if (!socket->send(m_out.data(), m_out.size())) {
+            socket->shutdown();
+        }
+    }
+
+    virtual void on_error(ServerSocket* socket) override {
+        socket->shutdown();
+    }
+
+private:
+    std::vector<char> m_in;
+    std::vector<char> m_out;
+};
+
+//Send to the server as fast as it can, while benchmark_duplex reads.
+unsigned int __stdcall duplex_sender(void* arg) {
+    auto& benchmark = g_duplex_benchmark;
+    static char buf[DUPLEX_BENCHMARK_SIZE];
+    memset(buf, 'c', sizeof(buf));
+    while (!benchmark.stop) {
+        auto result = send(benchmark.client, buf, sizeof(buf), 0);
+        if (result <= 0) {
+            break;
+        }
+        benchmark.sent += result;
+    }
+    return 1;
+}
+
+//Connect to the server over loopback, and send and receive on the connection at once for the seconds of the
+//benchmark, and log the bytes per second each way. Then the server exits. Both ways are driven by the receive and
+//send completions of the same ServerSocket, whose sides are on separate cache lines. Build with
+//SOCKET_SHARED_LINES to run it with them packed together, for what the split saves.
+unsigned int __stdcall benchmark_duplex(void* arg) {
+    auto& benchmark = g_duplex_benchmark;
+    benchmark.client = connect_loopback();
+    if (benchmark.client == INVALID_SOCKET) {
+        g_exit = true;
+        return 0;
+    }
+    auto sender = (HANDLE)_beginthreadex(nullptr, 0, duplex_sender, nullptr, 0, nullptr);
+    if (!sender) {
+        LOG_ERROR("_beginthreadex failed with error: ", GetLastError());
+        closesocket(benchmark.client);
+        g_exit = true;
+        return 0;
+    }
+    static char buf[1024 * 64];
+    LONG64 received = 0;
+    auto start = GetTickCount64();
+    while (!g_exit && GetTickCount64() - start < benchmark.seconds * 1000ull) {
+        auto result = recv(benchmark.client, buf, sizeof(buf), 0);
+        if (result <= 0) {
+            break;
+        }
+        received += result;
+    }
+    auto seconds = (GetTickCount64() - start) / 1000.0;
+    benchmark.stop = true;
+    //The sender may be blocked in send, which fails once the socket is shut down.
+    shutdown(benchmark.client, SD_BOTH);
+    WaitForSingleObject(sender, INFINITE);
+    CloseHandle(sender);
+    closesocket(benchmark.client);
+    LOG_INFO("One connection received ", benchmark.sent / seconds / (1024 * 1024), " MiB per second and sent ",
+        received / seconds / (1024 * 1024), " MiB per second at once.");
+    g_exit = true;
+    return 1;
+}
+
+//Seconds of each run of the benchmark of sends without a kernel copy, see benchmark_zero_copy.
+DWORD g_zero_copy_benchmark = 0;
+
+//Connect to the server over loopback and read all it sends for the seconds of the benchmark, with a kernel copy of
+//each send and then without, see ServerSocket::set_zero_copy_send, and log the MiB per second of each. Then the
+//server exits.
+unsigned int __stdcall benchmark_zero_copy(void* arg) {
+    static char buf[1024 * 64];
+    for (auto zero_copy : { false, true }) {
+        //It applies to sockets created afterwards, so the connection of the run takes it.
+        ServerSocket::set_zero_copy_send(zero_copy);
+        auto client = connect_loopback();
+        if (client == INVALID_SOCKET) {
+            g_exit = true;
+            return 0;
+        }
+        LONG64 received = 0;
+        auto start = GetTickCount64();
+        while (!g_exit && GetTickCount64() - start < g_zero_copy_benchmark * 1000ull) {
+            auto result = recv(client, buf, sizeof(buf), 0);
+            if (result <= 0) {
+                break;
+            }
+            received += result;
+        }
+        auto seconds = (GetTickCount64() - start) / 1000.0;
+        closesocket(client);
+        LOG_INFO(zero_copy ? "Sent without a kernel copy: " : "Sent with a kernel copy: ",
+            received / seconds / (1024 * 1024), " MiB per second.");
+    }
+    g_exit = true;
+    return 1;
+}
+
+//Seconds of the benchmark of echo, see benchmark_echo.
+DWORD g_echo_benchmark = 0;
+
+//Connect to the server over loopback and have messages echoed one at a time for the seconds of the benchmark, and
+//log the round trips per second and the mean of each. Then the server exits. Run it with and without -C or -T, for
+//the echo of each.
+unsigned int __stdcall benchmark_echo(void* arg) {
+    auto client = connect_loopback();
+    if (client == INVALID_SOCKET) {
+        g_exit = true;
+        return 0;
+    }
+    BOOL no_delay = TRUE;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char*)&no_delay, sizeof(no_delay));
+    static char message[ECHO_BENCHMARK_SIZE];
+    static char buf[ECHO_BENCHMARK_SIZE];
+    memset(message, 'e', sizeof(message));
+    LONG64 round_trips = 0;
+    auto start = GetTickCount64();
+    while (!g_exit && GetTickCount64() - start < g_echo_benchmark * 1000ull) {
+        if (send(client, message, sizeof(message), 0) != sizeof(message)) {
+            break;
+        }
+        int received = 0;
+        while (received < (int)sizeof(buf)) {
+            auto result = recv(client, buf + received, sizeof(buf) - received, 0);
+            if (result <= 0) {
+                break;
+            }
+            received += result;
+        }
+        if (received < (int)sizeof(buf)) {
+            break;
+        }
+        round_trips++;
+    }
+    auto seconds = (GetTickCount64() - start) / 1000.0;
+    closesocket(client);
+    LOG_INFO("Echoed ", round_trips / seconds, " messages of ", ECHO_BENCHMARK_SIZE, " bytes per second, ",
+        round_trips ? seconds * 1000000 / round_trips : 0, " us each.");
+    g_exit = true;
+    return 1;
+}
+
+//The benchmark of queue_send, see benchmark_queue_send.
+struct QueueBenchmark {
+    size_t producers = 0;
+    DWORD seconds = 0;
+    ConnectionHandle handle;
+    volatile bool stop = false;
+    volatile LONG64 messages = 0;
+};
+
+QueueBenchmark g_queue_benchmark;
+
+//Queue messages of 64 bytes, like small notifications, to the connection of the benchmark as fast as it can.
+unsigned int __stdcall queue_producer(void* arg) {
+    auto& benchmark = g_queue_benchmark;
+    if (!Reclaimer::register_thread()) {
+        return 0;
+    }
+    char message[64];
+    memset(message, 'q', sizeof(message));
+    LONG64 messages = 0;
+    while (!benchmark.stop) {
+        auto socket = ServerSocket::find(benchmark.handle);
+        if (!socket) {
+            break;
+        }
+        //Wait for the peer to catch up, as a publisher would do on backpressure.
+        if (socket->get_state() != ServerSocket::State::Started || socket->get_send_queued() > QUEUE_BENCHMARK_LIMIT) {
+            Reclaimer::quiescent();
+            YieldProcessor();
+            continue;
+        }
+        if (!socket->queue_send(message, sizeof(message))) {
+            break;
+        }
+        messages++;
+        Reclaimer::quiescent();
+    }
+    InterlockedExchangeAdd64(&benchmark.messages, messages);
+    Reclaimer::unregister_thread();
+    return 1;
+}
+
+//Connect to the server over loopback, have the producers write to the connection all at once for the seconds of
+//the benchmark, while this thread reads all that's sent, and log how many messages are queued per second. Then
+//the server exits.
+unsigned int __stdcall benchmark_queue_send(void* arg) {
+    auto& benchmark = g_queue_benchmark;
+    auto client = connect_loopback();
+    if (client == INVALID_SOCKET) {
+        g_exit = true;
+        return 0;
+    }
+    //The only connection, once it's accepted
+    while (!benchmark.handle.valid() && !g_exit) {
+        Sleep(10);
+        ServerSocket::get_connections().for_each([&benchmark](ConnectionHandle handle, ServerSocket*) {
+            benchmark.handle = handle;
+        });
+    }
+
+    HANDLE producers[MAX_WORKERS] = {};
+    size_t count = 0;
+    for (; count < benchmark.producers && count < MAX_WORKERS; count++) {
+        producers[count] = (HANDLE)_beginthreadex(nullptr, 0, queue_producer, nullptr, 0, nullptr);
+        if (!producers[count]) {
+            LOG_ERROR("_beginthreadex failed with error: ", GetLastError());
+            break;
+        }
+    }
+    static char buf[1024 * 64];
+    LONG64 received = 0;
+    auto start = GetTickCount64();
+    while (!g_exit && GetTickCount64() - start < benchmark.seconds * 1000ull) {
+        auto result = recv(client, buf, sizeof(buf), 0);
+        if (result <= 0) {
+            break;
+        }
+        received += result;
+    }
+    auto seconds = (GetTickCount64() - start) / 1000.0;
+    benchmark.stop = true;
+    WaitForMultipleObjects((DWORD)count, producers, TRUE, INFINITE);
+    for (size_t i = 0; i < count; i++) {
+        CloseHandle(producers[i]);
+    }
+    LOG_INFO(count, " producers queued ", benchmark.messages / seconds, " messages per second to one connection, and ",
+        received / seconds / (1024 * 1024), " MiB per second was received.");
+    closesocket(client);
+    g_exit = true;
+    return 1;
+}
 
 BOOL WINAPI CtrlHandler(DWORD event) {
     LOG_INFO("Terminating...");
@@ -94,12 +651,127 @@ BOOL WINAPI CtrlHandler(DWORD event) {
     return FALSE; //Let default handler terminate the process
 }
 
+//Return true if a connection is waiting in the backlog.
+bool has_pending_accept(SOCKET server_socket) {
+    fd_set read_set;
+    FD_ZERO(&read_set);
+    FD_SET(server_socket, &read_set);
+    timeval timeout = {};
+    return select(0, &read_set, nullptr, nullptr, &timeout) == 1;
+}
+
+//Accept connections in the backlog as long as admission control allows. When the server is over capacity, the
+//rest are left in the backlog if defer is true, or otherwise closed at once with a reset, which costs nothing
+//more than the accept.
+void accept_connections(SOCKET server_socket, HANDLE iocp, bool using_tls, AdmissionControl& admission, bool defer) {
+    while (!g_exit) {
+        auto verdict = admission.check(ServerSocket::get_connections().size(), ServerSocket::get_handshakes());
+        if (verdict != AdmissionControl::Verdict::Admit && defer) {
+            //NOTE: A deferral is counted once per round, not per connection waiting.
+            if (has_pending_accept(server_socket)) {
+                admission.shed(verdict);
+            }
+            return;
+        }
+
+        //NOTE: Could also be:
+        //auto socket = WSAAccept(server_socket, nullptr, nullptr, nullptr, 0);
+        //if (socket == SOCKET_ERROR) {
+        auto socket = accept(server_socket, nullptr, 0);
+        if (socket == INVALID_SOCKET) {
+            if (WSAEWOULDBLOCK != WSAGetLastError()) {
+                LOG_ERROR("accept failed with error: ", WSAGetLastError());
+            }
+            return;
+        }
+
+        if (verdict != AdmissionControl::Verdict::Admit) {
+            //Reset rather than close gracefully, so that no TIME_WAIT is left.
+            linger no_linger = { 1, 0 };
+            setsockopt(socket, SOL_SOCKET, SO_LINGER, (const char*)&no_linger, sizeof(no_linger));
+            closesocket(socket);
+            admission.shed(verdict);
+            continue;
+        }
+        admission.admit();
+
+        LOG_INFO("Accepted a connection.");
+
+        if (g_typed_echo) {
+            using_tls ? start_typed_echo<TlsEchoSocket>(iocp, socket) : start_typed_echo<PlainEchoSocket>(iocp, socket);
+            continue;
+        }
+
+        IServerSocketHandler* handler;
+        if (g_duplex_benchmark.seconds) {
+            handler = new DuplexHandler(DUPLEX_BENCHMARK_SIZE);
+        }
+        else if (g_zero_copy_benchmark) {
+            handler = new DuplexHandler(ZERO_COPY_BENCHMARK_SIZE);
+        }
+        else if (g_coroutine_echo) {
+            handler = new Connection(serve_echo);
+        }
+        else {
+            handler = new EchoServer(BUF_SIZE, g_queued_echo, g_work_per_kib);
+        }
+        auto server = ServerSocket::create(iocp, socket, handler, using_tls);
+        if (!server) {
+            delete handler;
+            closesocket(socket);
+            continue;
+        }
+        if (!server->start()) {
+            //NOTE: The server owns the handler. And it has been registered so it must be retired rather than deleted.
+            closesocket(socket);
+            server->retire();
+        }
+    }
+}
+
 int main(int argc, char ** argv) {
-    if (!Log::init()) {
+    if (!Log::init() || !Reclaimer::init()) {
         return 1;
     }
     bool using_tls = false;
     bool verbose = false;
+    bool all_names = false;
+    std::vector<std::wstring> server_names;
+    const char* cert_file = nullptr;
+    const char* key_file = nullptr;
+    bool session_tickets = true;
+    bool null_tls = false;
+    //Limits of admission control, where 0 means no limit
+    size_t max_connections = 0;
+    size_t max_handshakes = 0;
+    double accept_rate = 0;
+    double accept_burst = 0;
+    bool defer_accept = true;
+    //Timeouts in seconds, where 0 means no timeout
+    DWORD handshake_timeout = 10;
+    DWORD idle_timeout = 300;
+    DWORD send_timeout = 60;
+    //Rate limits of each connection in bytes per second, where 0 means no limit
+    double send_rate = 0;
+    double receive_rate = 0;
+    //Budget of I/O buffers in MiB, where 0 means no limit
+    LONG64 buffer_budget = 0;
+    //Tasks to post in the benchmark of the executor, or 0 to serve
+    size_t post_benchmark = 0;
+    //Timers in the benchmark of the timer wheel
+    size_t timer_benchmark = 0;
+    //The thread of the benchmark of queue_send, of a connection busy both ways, of zero copy sends or of echo
+    HANDLE benchmark = nullptr;
+    //Budget of a turn of each connection, where 0 means no limit
+    size_t turn_bytes = 1024 * 256;
+    size_t turn_receives = 64;
+    //Half of the processors at most are for handshakes by default, so that data I/O always has the rest.
+    size_t handshake_threads = get_processor_count() / 2;
+    if (!handshake_threads) {
+        handshake_threads = 1;
+    }
+    //Threads of the compute pool, as many as for handshakes by default
+    size_t compute_threads = handshake_threads;
     for (int i = 1; i < argc; i++) {
         if (!strcmp(argv[i], "-t")) {
             using_tls = true;
@@ -107,13 +779,170 @@ int main(int argc, char ** argv) {
         else if (!strcmp(argv[i], "-v")) {
             verbose = true;
         }
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            //Host names are in ASCII.
+            std::string name(argv[++i]);
+            server_names.push_back(std::wstring(name.begin(), name.end()));
+        }
+        else if (!strcmp(argv[i], "-a")) {
+            all_names = true;
+        }
+        else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            //TLS session lifespan in seconds
+            CredentialCache::session_lifespan = (DWORD)strtoul(argv[++i], nullptr, 10) * 1000;
+        }
+        else if (!strcmp(argv[i], "-o") && i + 2 < argc) {
+            //TLS by OpenSSL, with the PEM certificate chain and private key files
+            cert_file = argv[++i];
+            key_file = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-N")) {
+            //No session tickets with -o, so sessions are resumed from the session cache
+            session_tickets = false;
+        }
+        else if (!strcmp(argv[i], "-h") && i + 1 < argc) {
+            //Threads for handshakes, or 0 to run them on the workers of data I/O
+            handshake_threads = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            max_connections = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+            max_handshakes = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            //Accepts per second
+            accept_rate = strtod(argv[++i], nullptr);
+        }
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            accept_burst = strtod(argv[++i], nullptr);
+        }
+        else if (!strcmp(argv[i], "-x")) {
+            //Close connections over capacity rather than leaving them in the backlog
+            defer_accept = false;
+        }
+        else if (!strcmp(argv[i], "-H") && i + 1 < argc) {
+            handshake_timeout = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-I") && i + 1 < argc) {
+            idle_timeout = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-S") && i + 1 < argc) {
+            send_timeout = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+            send_rate = strtod(argv[++i], nullptr);
+        }
+        else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+            receive_rate = strtod(argv[++i], nullptr);
+        }
+        else if (!strcmp(argv[i], "-B") && i + 1 < argc) {
+            post_benchmark = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-W") && i + 1 < argc) {
+            timer_benchmark = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-F") && i + 1 < argc) {
+            //Seconds of the benchmark of a connection busy both ways
+            g_duplex_benchmark.seconds = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-Q") && i + 2 < argc) {
+            //Producers and seconds of the benchmark of queue_send
+            g_queue_benchmark.producers = strtoul(argv[++i], nullptr, 10);
+            g_queue_benchmark.seconds = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-y") && i + 2 < argc) {
+            turn_bytes = strtoul(argv[++i], nullptr, 10);
+            turn_receives = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-M") && i + 1 < argc) {
+            buffer_budget = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-u") && i + 1 < argc) {
+            g_work_per_kib = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-P") && i + 1 < argc) {
+            //Threads of the compute pool, or 0 to run the work of handlers on the workers
+            compute_threads = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-T")) {
+            g_typed_echo = true;
+        }
+        else if (!strcmp(argv[i], "-C")) {
+            g_coroutine_echo = true;
+        }
+        else if (!strcmp(argv[i], "-q")) {
+            g_queued_echo = true;
+        }
+        else if (!strcmp(argv[i], "-E") && i + 1 < argc) {
+            //Seconds of the benchmark of echo
+            g_echo_benchmark = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-Z") && i + 1 < argc) {
+            //Seconds of each run of the benchmark of sends without a kernel copy
+            g_zero_copy_benchmark = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "-z")) {
+            ServerSocket::set_zero_copy_send(true);
+        }
+        else if (!strcmp(argv[i], "-p")) {
+            //TLS framing without crypto, for benchmarking only
+            using_tls = true;
+            null_tls = true;
+        }
+    }
+    if (g_queue_benchmark.producers) {
+        if (using_tls) {
+            LOG_ERROR("The benchmark of queue_send reads raw bytes, so it runs without TLS.");
+            return 1;
+        }
+        //A handler uses either send or queue_send.
+        g_queued_echo = true;
+    }
+    if ((g_duplex_benchmark.seconds || g_zero_copy_benchmark || g_echo_benchmark) && using_tls) {
+        LOG_ERROR("The benchmarks of -F, -Z and -E read raw bytes, so they run without TLS.");
+        return 1;
+    }
+    if (server_names.empty() && !all_names) {
+        server_names.push_back(L"localhost");
     }
 
     Log::level = verbose ? Log::Level::Verbose : Log::Level::Info;
+    ServerSocket::set_timeouts(handshake_timeout * 1000, idle_timeout * 1000, send_timeout * 1000);
+    ServerSocket::set_default_rate_limits(send_rate, receive_rate);
+    ServerSocket::set_buffer_budget(buffer_budget * 1024 * 1024);
+    ServerSocket::set_trim_idle(TRIM_IDLE);
+    ServerSocket::set_turn_budget(turn_bytes, turn_receives);
 
-    if (using_tls && !ServerSocket::tls_init()) {
-        LOG_ERROR("ServerSocket::tls_init failed!");
-        return 1;
+    if (using_tls) {
+        bool ok;
+        if (null_tls) {
+            LOG_WARN("TLS is NOT secure with -p. It's for benchmarking only.");
+            static My::NullTlsProvider null_provider;
+            ok = ServerSocket::tls_init(&null_provider);
+        }
+        else if (cert_file) {
+#ifdef MY_TLS_OPENSSL
+            static My::OpenSslTlsProvider openssl_provider;
+            ok = openssl_provider.init_server(cert_file, key_file, session_tickets) &&
+                ServerSocket::tls_init(&openssl_provider);
+#else
+            LOG_ERROR("OpenSSL is not built in. Define MY_TLS_OPENSSL to build it.");
+            ok = false;
+#endif
+        }
+        else {
+            ok = ServerSocket::tls_init(server_names);
+        }
+        if (!ok) {
+            LOG_ERROR("ServerSocket::tls_init failed!");
+            return 1;
+        }
+    }
+
+    if (timer_benchmark) {
+        benchmark_timers(timer_benchmark);
+        return 0;
     }
 
     if (!SetConsoleCtrlHandler(CtrlHandler, TRUE)) {
@@ -127,24 +956,45 @@ int main(int argc, char ** argv) {
         return 1;
     }
 
-    if (!create_iocp_workers(iocp)) {
-        CloseHandle(iocp);
+    //The handshake lane has its own port, whose concurrency is bound by the number of its workers.
+    HANDLE lane = nullptr;
+    if (using_tls && handshake_threads) {
+        lane = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, handshake_threads);
+        if (!lane) {
+            LOG_ERROR("CreateIoCompletionPort failed with error: ", GetLastError());
+            CloseHandle(iocp);
+            return 1;
+        }
+        ServerSocket::set_handshake_lane(lane);
+        LOG_INFO("Handshakes run on ", handshake_threads, " thread(s).");
+    }
+
+    Executor::init(iocp);
+    if (!create_iocp_workers(iocp, lane, handshake_threads)) {
+        close_iocp(iocp, lane);
         return 1;
     }
 
+    if (post_benchmark) {
+        benchmark_post(post_benchmark);
+        stop_iocp_workers(iocp, lane);
+        close_iocp(iocp, lane);
+        return 0;
+    }
+
     WSADATA wsa_data;
     int result = WSAStartup(MAKEWORD(2, 2), &wsa_data);
     if (result != 0) {
         LOG_ERROR("WSAStartup failed with error: ", result);
-        stop_iocp_workers(iocp);
-        CloseHandle(iocp);
+        stop_iocp_workers(iocp, lane);
+        close_iocp(iocp, lane);
         return 1;
     }
 
     SOCKET server_socket = create_server_socket();
     if (server_socket == INVALID_SOCKET) {
-        stop_iocp_workers(iocp);
-        CloseHandle(iocp);
+        stop_iocp_workers(iocp, lane);
+        close_iocp(iocp, lane);
         WSACleanup();
         return 1;
     }
@@ -153,57 +1003,140 @@ int main(int argc, char ** argv) {
     result = ioctlsocket(server_socket, FIONBIO, &nonblock);
     if (result == SOCKET_ERROR) {
         LOG_ERROR("ioctlsocket failed with error: ", WSAGetLastError());
-        stop_iocp_workers(iocp);
-        CloseHandle(iocp);
+        stop_iocp_workers(iocp, lane);
+        close_iocp(iocp, lane);
         closesocket(server_socket);
         WSACleanup();
         return 1;
     }
 
+    if (!ComputePool::start(compute_threads)) {
+        stop_iocp_workers(iocp, lane);
+        close_iocp(iocp, lane);
+        closesocket(server_socket);
+        WSACleanup();
+        return 1;
+    }
+    if (compute_threads) {
+        LOG_INFO("Compute pool runs on ", compute_threads, " thread(s).");
+    }
+
+    //The main thread starts sockets and so may run handlers, so it needs to take part in reclamation too.
+    Reclaimer::register_thread();
+    //It adds timers of the sockets it starts too.
+    TimerWheel wheel(GetTickCount64(), TIMER_TICK);
+    TimerWheel::current = &wheel;
+    TimerWheel pacing(GetTickCount64(), PACING_TICK);
+    ServerSocket::pacing_wheel = &pacing;
+
+    if (g_queue_benchmark.producers || g_duplex_benchmark.seconds || g_zero_copy_benchmark || g_echo_benchmark) {
+        auto run = g_queue_benchmark.producers ? benchmark_queue_send :
+            g_duplex_benchmark.seconds ? benchmark_duplex :
+            g_zero_copy_benchmark ? benchmark_zero_copy : benchmark_echo;
+        benchmark = (HANDLE)_beginthreadex(nullptr, 0, run, nullptr, 0, nullptr);
+        if (!benchmark) {
+            LOG_ERROR("_beginthreadex failed with error: ", GetLastError());
+            g_exit = true;
+        }
+    }
+
+    auto stats_time = GetTickCount64();
+    auto trim_time = stats_time;
+    LONG64 last_full = 0;
+    LONG64 last_resumed = 0;
+    LONG64 last_allocations = 0;
+    LONG64 last_shed = 0;
+    LONG64 last_buffer_bytes = 0;
+    LONG64 last_yields = 0;
+    LONG64 last_steals = 0;
+    AdmissionControl admission(max_connections, max_handshakes, accept_rate, accept_burst);
+
     while (!g_exit) {
         //NOTE: A better way is to use WSAEventSelect for socket and wait on FD_ACCEPT event.
         //Here we just sleep for simplicity.
         Sleep(20);
+        auto now = GetTickCount64();
+        wheel.advance(now, ServerSocket::on_timer);
+        pacing.advance(now, ServerSocket::on_pacing_timer);
+        Reclaimer::quiescent();
 
-        //NOTE: Could also be:
-        //auto socket = WSAAccept(server_socket, nullptr, nullptr, nullptr, 0);
-        //if (socket == SOCKET_ERROR) {
-        auto socket = accept(server_socket, nullptr, 0);
-        if (socket == INVALID_SOCKET) {
-            if (WSAEWOULDBLOCK != WSAGetLastError()) {
-                LOG_ERROR("accept failed with error: ", WSAGetLastError());
+        if (now - trim_time >= TRIM_INTERVAL) {
+            ServerSocket::trim_idle(now);
+            trim_time = now;
+        }
+        if (now - stats_time >= STATS_INTERVAL) {
+            if (using_tls) {
+                log_handshake_stats(now - stats_time, last_full, last_resumed, last_allocations);
+#ifdef MY_TLS_OPENSSL
+                if (cert_file) {
+                    log_session_cache_stats();
+                }
+#endif
             }
-            continue;
+            if (admission.is_limited()) {
+                log_admission_stats(admission, last_shed);
+            }
+            log_buffer_stats(last_buffer_bytes);
+            log_yield_stats(now - stats_time, last_yields);
+            log_compute_stats(now - stats_time, last_steals);
+            stats_time = now;
         }
 
-        LOG_INFO("Accepted a connection.");
-
-        //TODO: Some way to clean up handler and server in some exception cases, say iocp is closed.
-        auto handler = new EchoServer(BUF_SIZE);
-        auto server = ServerSocket::create(iocp, socket, handler, using_tls);
-        if (!server->start()) {
-            delete server;
-            delete handler;
-        }
+        accept_connections(server_socket, iocp, using_tls, admission, defer_accept);
     }
 
+    if (benchmark) {
+        WaitForSingleObject(benchmark, INFINITE);
+        CloseHandle(benchmark);
+    }
     LOG_INFO("Shutting down server socket...");
     shutdown(server_socket, SD_BOTH);
     closesocket(server_socket);
+    //Work in the pool may still post results to the workers, so it's stopped first.
+    LOG_INFO("Stopping compute pool...");
+    ComputePool::stop();
     LOG_INFO("Stopping IOCP workers...");
-    stop_iocp_workers(iocp);
-    CloseHandle(iocp);
+    stop_iocp_workers(iocp, lane);
+    //No worker is running now. So it's safe to shut down the remaining connections from this thread. Their
+    //handlers will retire them.
+    LOG_INFO("Closing ", ServerSocket::get_connections().size(), " connection(s)...");
+    ServerSocket::get_connections().for_each([](ConnectionHandle, ServerSocket* socket) {
+        socket->shutdown();
+    });
+    close_iocp(iocp, lane);
+    //Completions of the closed sockets will never be dequeued, so free them regardless of pending I/O.
+    Reclaimer::drain();
+    Reclaimer::unregister_thread();
+    TimerWheel::current = nullptr;
+    ServerSocket::pacing_wheel = nullptr;
     WSACleanup();
     return 0;
 }
 
 unsigned int __stdcall iocp_worker(void* arg) {
     HANDLE iocp = (HANDLE)arg;
+    if (!Reclaimer::register_thread()) {
+        return 0;
+    }
+    //Each worker has its own wheel for the timers added on it, so that no lock is taken.
+    TimerWheel wheel(GetTickCount64(), TIMER_TICK);
+    TimerWheel::current = &wheel;
+    TimerWheel pacing(GetTickCount64(), PACING_TICK);
+    ServerSocket::pacing_wheel = &pacing;
     while (true) {
         DWORD io_size;
         ServerSocket * socket;
         LPOVERLAPPED overlapped;
-        if (!GetQueuedCompletionStatus(iocp, &io_size, (PULONG_PTR)&socket, &overlapped, INFINITE)) {
+        DWORD timeout = pacing.size() ? PACING_TICK : QUIESCENT_INTERVAL;
+        if (!GetQueuedCompletionStatus(iocp, &io_size, (PULONG_PTR)&socket, &overlapped, timeout)) {
+            if (GetLastError() == WAIT_TIMEOUT) {
+                auto now = GetTickCount64();
+                wheel.advance(now, ServerSocket::on_timer);
+                pacing.advance(now, ServerSocket::on_pacing_timer);
+                Reclaimer::quiescent();
+                Reclaimer::reclaim();
+                continue;
+            }
             LOG_WARN("GetQueuedCompletionStatus failed with error: ", GetLastError());
             if (GetLastError() == ERROR_ABANDONED_WAIT_0) { //ERROR_ABANDONED_WAIT_0 means iocp has been closed.
                 break;
@@ -219,6 +1152,14 @@ unsigned int __stdcall iocp_worker(void* arg) {
         //it doesn't know if &event was passed to GetQueuedCompletionStatus as (LPOVERLAPPED *).
         Event* event = (Event *)overlapped;
         event->run();
+        auto now = GetTickCount64();
+        wheel.advance(now, ServerSocket::on_timer);
+        pacing.advance(now, ServerSocket::on_pacing_timer);
+        //Nothing from the completion is referenced after this point.
+        Reclaimer::quiescent();
     }
+    TimerWheel::current = nullptr;
+    ServerSocket::pacing_wheel = nullptr;
+    Reclaimer::unregister_thread();
     return 1; //Success, while 0 indicates an error
 }
@@ -0,0 +1,154 @@
+#include "Reclaimer.h"
+#include "Log.h"
+#include <cassert>
+
+Reclaimer::ThreadRecord Reclaimer::records[Reclaimer::max_threads];
+thread_local Reclaimer::ThreadRecord* Reclaimer::current = nullptr;
+volatile LONG Reclaimer::global_epoch = 1;
+volatile LONG Reclaimer::retired_count = 0;
+std::vector<Reclaimer::Retired> Reclaimer::retired;
+CRITICAL_SECTION Reclaimer::lock;
+
+bool Reclaimer::init()
+{
+    return InitializeCriticalSectionAndSpinCount(&lock, 0);
+}
+
+bool Reclaimer::register_thread()
+{
+    assert(!current);
+    for (size_t i = 0; i < max_threads; i++) {
+        if (!InterlockedCompareExchange(&records[i].in_use, 1, 0)) {
+            current = &records[i];
+            online();
+            return true;
+        }
+    }
+    LOG_ERROR("Too many threads.");
+    return false;
+}
+
+void Reclaimer::unregister_thread()
+{
+    if (current) {
+        offline();
+        InterlockedExchange(&current->in_use, 0);
+        current = nullptr;
+    }
+}
+
+void Reclaimer::offline()
+{
+    current->epoch = offline_epoch;
+}
+
+void Reclaimer::online()
+{
+    //NOTE: A full barrier is required here, so that the epoch is visible to reclaimer before this thread
+    //reads any shared pointer. Otherwise a reclaimer may see the thread offline and free an object the thread
+    //has just got.
+    InterlockedExchange(&current->epoch, global_epoch);
+}
+
+LONG Reclaimer::next_epoch()
+{
+    auto epoch = InterlockedIncrement(&global_epoch);
+    if (epoch == offline_epoch) {
+        epoch = InterlockedIncrement(&global_epoch);
+    }
+    return epoch;
+}
+
+LONG Reclaimer::min_epoch()
+{
+    LONG now = global_epoch;
+    LONG result = offline_epoch;
+    for (auto& record : records) {
+        LONG epoch = record.epoch;
+        if (epoch == offline_epoch) {
+            continue;
+        }
+        if (result == offline_epoch || (LONG)(epoch - result) < 0) {
+            result = epoch;
+        }
+    }
+    return result == offline_epoch ? now : result;
+}
+
+void Reclaimer::retire(void* obj, DestroyFunc destroy, BusyFunc busy)
+{
+    assert(obj && destroy);
+    Retired r;
+    r.obj = obj;
+    r.destroy = destroy;
+    r.busy = busy;
+    //NOTE: Check busy before getting a new epoch. A thread that has just finished the last I/O on obj may
+    //still be working on it, and it must not have passed the new epoch yet.
+    r.idle = !busy || !busy(obj);
+    r.epoch = next_epoch();
+    EnterCriticalSection(&lock);
+    retired.push_back(r);
+    retired_count = (LONG)retired.size();
+    LeaveCriticalSection(&lock);
+}
+
+void Reclaimer::reclaim()
+{
+    if (!retired_count || !TryEnterCriticalSection(&lock)) {
+        return;
+    }
+    //Objects found busy, or found idle for the first time, start a new grace period. Again, check all of
+    //them before getting the new epoch.
+    std::vector<size_t> restamp;
+    for (size_t i = 0; i < retired.size(); i++) {
+        auto& r = retired[i];
+        bool busy = r.busy && r.busy(r.obj);
+        if (busy || !r.idle) {
+            r.idle = !busy;
+            restamp.push_back(i);
+        }
+    }
+    if (!restamp.empty()) {
+        auto epoch = next_epoch();
+        for (auto i : restamp) {
+            retired[i].epoch = epoch;
+        }
+    }
+
+    std::vector<Retired> to_free;
+    auto passed = min_epoch();
+    for (size_t i = 0; i < retired.size();) {
+        auto& r = retired[i];
+        if (r.idle && (LONG)(passed - r.epoch) >= 0) {
+            to_free.push_back(r);
+            r = retired.back();
+            retired.pop_back();
+        }
+        else {
+            i++;
+        }
+    }
+    retired_count = (LONG)retired.size();
+    LeaveCriticalSection(&lock);
+
+    //Destroy objects out of the lock since a destructor may retire other objects.
+    for (auto& r : to_free) {
+        r.destroy(r.obj);
+    }
+    if (!to_free.empty()) {
+        LOG_VERBOSE("Reclaimed ", to_free.size(), " object(s).");
+    }
+}
+
+void Reclaimer::drain()
+{
+    EnterCriticalSection(&lock);
+    std::vector<Retired> to_free;
+    to_free.swap(retired);
+    retired_count = 0;
+    LeaveCriticalSection(&lock);
+    for (auto& r : to_free) {
+        r.destroy(r.obj);
+    }
+    LOG_INFO("Drained ", to_free.size(), " object(s).");
+}
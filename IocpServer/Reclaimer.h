@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Common.h"
+#include <vector>
+
+//Quiescent-state based reclamation (QSBR).
+//
+//An object that may still be referenced by other threads (e.g. a ServerSocket found in the ConnectionRegistry,
+//or one whose completions are being processed by another worker) is not deleted directly but retired. A retired
+//object is freed only after every registered thread has passed a quiescent point, i.e. a point at which it holds
+//no reference to any shared object, such as between two completions in an IOCP worker.
+//
+//Announcing a quiescent state is a plain store to a thread-private cache line, so there's no atomic operation
+//per completion. Only retiring and reclaiming, which happen once per connection, take a lock.
+//
+//A thread that blocks for a long time without announcing a quiescent state delays reclamation. So it should
+//either wake up periodically to call quiescent (as IOCP workers do by a timeout), or go offline before blocking.
+class Reclaimer
+{
+public:
+    //Return true if the object is still in use by something other than threads, say pending I/O.
+    typedef bool (*BusyFunc)(void* obj);
+
+    typedef void (*DestroyFunc)(void* obj);
+
+    static const size_t max_threads = 256;
+
+    static bool init();
+
+    //Must be called by a thread before it touches any object that may be retired by others.
+    static bool register_thread();
+
+    static void unregister_thread();
+
+    static inline void quiescent() {
+        auto self = current;
+        self->epoch = global_epoch;
+        if (retired_count && (++self->counter % reclaim_interval) == 0) {
+            reclaim();
+        }
+    }
+
+    //Tell reclaimer the thread holds no reference and won't announce quiescent states for a while.
+    static void offline();
+
+    //Come back from offline. The thread may then touch shared objects.
+    static void online();
+
+    //The object must already be unreachable for new references, e.g. removed from ConnectionRegistry.
+    static void retire(void* obj, DestroyFunc destroy, BusyFunc busy);
+
+    //Free retired objects that are no longer referenced. It's a no-op when another thread is reclaiming.
+    static void reclaim();
+
+    //Free all retired objects no matter whether they're referenced or not. Call it only when no other
+    //registered thread is running, say at exit.
+    static void drain();
+
+    static size_t pending() {
+        return retired_count;
+    }
+
+private:
+    //Epochs wrap around, so they must be compared by (LONG)(a - b). 0 is never used as an epoch.
+    static const LONG offline_epoch = 0;
+    static const unsigned int reclaim_interval = 64;
+
+    struct alignas(CACHE_LINE_SIZE) ThreadRecord {
+        volatile LONG epoch = offline_epoch;
+        volatile LONG in_use = 0;
+        unsigned int counter = 0;
+    };
+
+    struct Retired {
+        void* obj;
+        DestroyFunc destroy;
+        BusyFunc busy;
+        //All threads must have passed this epoch before obj can be freed.
+        LONG epoch;
+        //obj was found not busy when epoch was set.
+        bool idle;
+    };
+
+    static LONG next_epoch();
+
+    //Return the epoch all online threads have passed, or 0 when no thread is online.
+    static LONG min_epoch();
+
+    static ThreadRecord records[max_threads];
+    static thread_local ThreadRecord* current;
+    static volatile LONG global_epoch;
+    static volatile LONG retired_count;
+    static std::vector<Retired> retired;
+    static CRITICAL_SECTION lock;
+};
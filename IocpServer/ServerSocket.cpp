@@ -1,29 +1,74 @@
-#include "ServerSocket.h"
+#include "BasicServerSocket.h"
 #include "Event.h"
 #include "Log.h"
-#include "..\SecureSocket\Certificate.h"
-#include <schannel.h>
+#include "Reclaimer.h"
+#include "TimerWheel.h"
+#include "Executor.h"
+#include "..\SecureSocket\SspiTls.h"
+#include "..\SecureSocket\HandshakeStats.h"
 #include <cassert>
 
-using My::Certificate;
-
-#pragma comment(lib, "Secur32.lib")
+using My::HandshakeStats;
+
+ConnectionRegistry ServerSocket::connections;
+
+bool ServerSocket::zero_copy_send = false;
+HANDLE ServerSocket::handshake_lane = nullptr;
+volatile long ServerSocket::handshakes = 0;
+DWORD ServerSocket::handshake_timeout = 0;
+DWORD ServerSocket::idle_timeout = 0;
+DWORD ServerSocket::send_timeout = 0;
+DWORD ServerSocket::min_timeout = 0;
+volatile LONG64 ServerSocket::buffer_bytes = 0;
+LONG64 ServerSocket::buffer_budget = 0;
+volatile LONG64 ServerSocket::budget_delays = 0;
+DWORD ServerSocket::trim_idle_ms = 0;
+size_t ServerSocket::turn_bytes = 0;
+size_t ServerSocket::turn_receives = 0;
+volatile LONG64 ServerSocket::yields = 0;
+double ServerSocket::default_send_rate = 0;
+double ServerSocket::default_receive_rate = 0;
+thread_local TimerWheel* ServerSocket::pacing_wheel = nullptr;
 
 bool ServerSocket::tls_inited = false;
-PSecurityFunctionTable ServerSocket::sspi = nullptr;
-CredHandle ServerSocket::tls_cred = {};
+My::ITlsProvider* ServerSocket::tls_provider = nullptr;
+My::CredentialTable ServerSocket::tls_creds;
 
 ServerSocket* ServerSocket::create(HANDLE iocp, SOCKET socket, IServerSocketHandler* handler, bool enable_tls)
 {
     assert(iocp && socket && handler && (!enable_tls || (enable_tls && tls_inited)));
-    auto obj = new ServerSocket(iocp, socket, handler, enable_tls);
-    auto result = CreateIoCompletionPort((HANDLE)socket, iocp, (ULONG_PTR)obj, 0);
+    return init(new ServerSocket(iocp, socket, handler, enable_tls));
+}
+
+ServerSocket* ServerSocket::init(ServerSocket* obj)
+{
+    assert(!obj->m_tls_enabled || tls_inited);
+    auto socket = obj->m_socket;
+    obj->set_rate_limits(default_send_rate, default_receive_rate);
+    auto result = CreateIoCompletionPort((HANDLE)socket, obj->m_iocp, (ULONG_PTR)obj, 0);
     if (!result) {
         LOG_ERROR("CreateIoCompletionPort failed with error: ", GetLastError());
         obj->m_handler = nullptr; //Do not delete handler then.
         delete obj;
         return nullptr;
     }
+    if (zero_copy_send) {
+        //NOTE: With no send buffer, an overlapped send locks the pages of the user buffer and the stack sends
+        //from them, so the buffer is not copied into the kernel. It's safe here since a buffer being sent, either
+        //the user's or m_send_buf with a TLS record, is never touched until the send completes. Not failing on
+        //error, since it's only an optimization.
+        int size = 0;
+        if (setsockopt(socket, SOL_SOCKET, SO_SNDBUF, (const char*)&size, sizeof(size)) == SOCKET_ERROR) {
+            LOG_WARN("setsockopt SO_SNDBUF failed with error: ", WSAGetLastError());
+        }
+    }
+    obj->m_handle = connections.add(obj);
+    if (!obj->m_handle.valid()) {
+        LOG_ERROR("Too many connections.");
+        obj->m_handler = nullptr;
+        delete obj;
+        return nullptr;
+    }
     return obj;
 }
 
@@ -31,7 +76,22 @@ ServerSocket::~ServerSocket()
 {
     LOG_INFO("");
     shutdown();
+    if (m_handle.valid()) {
+        connections.remove(m_handle);
+    }
     delete m_handler;
+    delete m_tls;
+    end_handshake();
+    //Chunks left in the send queue, which are counted in m_queue_buffer_bytes
+    auto chunk = m_send_incoming;
+    while (chunk) {
+        auto next = chunk->next;
+        ::operator delete(chunk);
+        chunk = next;
+    }
+    ::operator delete(m_send_flight);
+    InterlockedExchangeAdd64(&buffer_bytes,
+        -(m_receive_buffer_bytes + m_send_buffer_bytes + m_handshake_buffer_bytes + m_queue_buffer_bytes));
 }
 
 bool ServerSocket::start()
@@ -48,20 +108,62 @@ bool ServerSocket::start_at_once()
 {
     assert(m_state == State::Init);
     m_state = State::Started;
-    m_handler->on_started(this);
+    set_deadline(m_receive_deadline, idle_timeout);
+    do_started();
     return true;
 }
 
+void ServerSocket::do_started()
+{
+    m_handler->on_started(this);
+}
+
+bool ServerSocket::restart_receive(char* buf, size_t size)
+{
+    return start_paced_receive<ServerSocket>(buf, size);
+}
+
+bool ServerSocket::restart_send(const char* buf, size_t size)
+{
+    return start_paced_send<ServerSocket>(buf, size);
+}
+
 void ServerSocket::shutdown()
 {
     LOG_INFO("");
-    if (m_state == State::Started) {
+    //NOTE: An error may shut it down from several threads at once, like a send and a receive completion of the
+    //handshake, or a canceled receive and a queued send. Only the first one closes the socket and calls on_shutdown,
+    //so that the socket isn't closed or retired twice.
+    if ((m_state == State::Started || m_state == State::HandShake) && !InterlockedExchange(&m_shutdown, 1)) {
         m_tls_enabled ? tls_shutdown() : shutdown_at_once();
     }
 }
 
+void ServerSocket::retire()
+{
+    LOG_INFO("");
+    if (m_handle.valid()) {
+        connections.remove(m_handle);
+        m_handle = ConnectionHandle();
+    }
+    Reclaimer::retire(this, destroy, is_busy);
+}
+
+bool ServerSocket::is_busy(void* obj)
+{
+    auto socket = (ServerSocket*)obj;
+    return socket->m_receive_pending || socket->m_send_pending || socket->m_handshake_sends || socket->m_handshake_queued ||
+        socket->m_yield_queued || socket->m_queue_send_queued || socket->m_tasks || socket->m_strand.is_busy();
+}
+
+void ServerSocket::destroy(void* obj)
+{
+    delete (ServerSocket*)obj;
+}
+
 void ServerSocket::shutdown_at_once()
 {
+    end_handshake();
     ::shutdown(m_socket, SD_BOTH);
     ::closesocket(m_socket);
     m_state = State::Shutdown;
@@ -70,328 +172,470 @@ void ServerSocket::shutdown_at_once()
 
 bool ServerSocket::receive(char* buf, size_t size)
 {
-    if (m_state != State::Started) {
-        LOG_ERROR("Invalid state.");
-        return false;
-    }
-    return m_tls_enabled ? tls_start_receive(buf, size, false) : start_receive(buf, size);
+    return receive<ServerSocket>(buf, size);
 }
 
-bool ServerSocket::start_receive(char* buf, size_t size)
+bool ServerSocket::yield_receive(char* buf, size_t size)
 {
-    assert(m_state == State::Started && buf && size);
-    auto event = new ReceiveEvent(this, buf, size);
-    DWORD flags = 0;
-    WSABUF wsabuf;
-    wsabuf.buf = buf;
-    wsabuf.len = size;
-    auto result = WSARecv(m_socket, &wsabuf, 1, nullptr, &flags, event, nullptr);
-    if (result == SOCKET_ERROR && (ERROR_IO_PENDING != WSAGetLastError())) {
-        LOG_ERROR("WSARecv failed with error: ", WSAGetLastError());
-        delete event;
+    //NOTE: A receive is counted when it's started, since with TLS it may be served at once from the records
+    //buffered, with no completion in between.
+    m_turn_receives++;
+    if ((!turn_bytes || m_turn_bytes < turn_bytes) && (!turn_receives || m_turn_receives <= turn_receives)) {
         return false;
     }
+    m_yield_buf = buf;
+    m_yield_size = size;
+    m_yield_queued = true;
+    m_yield_event.reset();
+    if (!PostQueuedCompletionStatus(m_iocp, 0, (ULONG_PTR)this, &m_yield_event)) {
+        LOG_WARN("PostQueuedCompletionStatus failed with error: ", GetLastError());
+        m_yield_queued = false;
+        return false;
+    }
+    InterlockedIncrement64(&yields);
     return true;
 }
 
-bool ServerSocket::tls_start_receive(char* user_buf, size_t user_buf_size, bool force_start)
+void ServerSocket::do_yield_event(YieldEvent* event)
 {
-    assert(m_state == State::Started && user_buf && user_buf_size);
-    if (!force_start && m_buf_used > 0) {
-        tls_do_receive(user_buf, user_buf_size, 0);
-        //Error will be handled by user handler if any. Returning true mimics starting an async sending without error.
-        return true;
-    }
-    if (InterlockedCompareExchange(&m_tls_receiving, 1, 0)) {
-        LOG_ERROR("Concurrent receiving is not supported.");
-        return false;
-    }
-    //We don't use user buf for receiving TLS message. But we save it in a ReceiveEvent for later use.
-    resize_buf_when_necessary();
-    auto event = new ReceiveEvent(this, user_buf, user_buf_size);
-    DWORD flags = 0;
-    WSABUF wsabuf;
-    wsabuf.buf = m_buf.data() + m_buf_used;
-    wsabuf.len = m_buf.size() - m_buf_used;
-    auto result = WSARecv(m_socket, &wsabuf, 1, nullptr, &flags, event, nullptr);
-    if (result == SOCKET_ERROR && (ERROR_IO_PENDING != WSAGetLastError())) {
-        LOG_ERROR("WSARecv failed with error: ", WSAGetLastError());
-        InterlockedExchange(&m_tls_receiving, 0);
-        delete event;
-        return false;
+    m_yield_queued = false;
+    m_turn_bytes = 0;
+    m_turn_receives = 0;
+    if (m_state == State::Started && !restart_receive(m_yield_buf, m_yield_size)) {
+        m_handler->on_error(this);
     }
-    return true;
 }
 
-void ServerSocket::do_receive_event(ReceiveEvent* event)
+void ServerSocket::pause_receive()
 {
-    DWORD io_size;
-    DWORD flags;
-    if (!WSAGetOverlappedResult(m_socket, event, &io_size, FALSE, &flags)) {
-        LOG_ERROR("WSAGetOverlappedResult failed with error: ", WSAGetLastError());
-        delete event;
-        return;
-    }
-    if (!io_size) {
-        LOG_INFO("Client is shutting down.");
-        delete event;
-        shutdown();
+    InterlockedCompareExchange(&m_receive_flow, Paused, Flowing);
+}
+
+void ServerSocket::resume_receive()
+{
+    if (InterlockedExchange(&m_receive_flow, Flowing) != Held || m_state != State::Started) {
         return;
     }
-    if (m_tls_enabled) {
-        tls_do_receive(event->m_buf, event->m_size, io_size);
-    }
-    else {
-        m_handler->on_received(this, event->m_buf, event->m_size, io_size);
+    set_deadline(m_receive_deadline, idle_timeout);
+    if (!restart_receive(m_held_buf, m_held_size)) {
+        m_handler->on_error(this);
     }
-    delete event;
 }
 
-void ServerSocket::tls_do_receive(char* user_buf, size_t user_buf_size, size_t received)
+bool ServerSocket::send(const char* buf, size_t size)
 {
-    InterlockedExchange(&m_tls_receiving, 0);
-
-    assert(m_state == State::Started);
+    return send<ServerSocket>(buf, size);
+}
 
-    m_buf_used += received;
+bool ServerSocket::post(ConnectionHandle handle, std::function<void(ServerSocket*)> task)
+{
+    //NOTE: The socket is looked up on the worker, where it's safe from being freed during the task.
+    return Executor::post([handle, task]() mutable {
+        auto socket = connections.find(handle);
+        if (socket) {
+            socket->run_task(std::move(task));
+        }
+    });
+}
 
-    //NOTE: according to https://docs.microsoft.com/en-us/windows/win32/secauthn/decryptmessage--schannel
-    //there should only be 2 buffers here, and the second must be of type SECBUFFER_TOKEN with a "security token"(what?).
-    SecBuffer in_buf[4];
-    SecBufferDesc msg;
-    msg.ulVersion = SECBUFFER_VERSION;
-    msg.cBuffers = 4;
-    msg.pBuffers = in_buf;
+void ServerSocket::run_task(std::function<void(ServerSocket*)>&& task)
+{
+    if (!m_stranded) {
+        if (m_state == State::Started) {
+            task(this);
+        }
+        return;
+    }
+    InterlockedIncrement(&m_tasks);
+    //The task event is dispatched to the strand at once, rather than posted again.
+    auto event = new TaskEvent([this, task]() {
+        if (m_state == State::Started) {
+            task(this);
+        }
+        InterlockedDecrement(&m_tasks);
+    }, &m_strand);
+    event->run();
+}
 
-    SECURITY_STATUS status = SEC_E_INCOMPLETE_MESSAGE;
+void ServerSocket::set_rate_limits(double send_rate, double receive_rate)
+{
+    auto now = GetTickCount64();
+    m_send_bucket.reset(send_rate, send_rate * rate_burst_ms / 1000, now);
+    m_receive_bucket.reset(receive_rate, receive_rate * rate_burst_ms / 1000, now);
+}
 
-    if (m_buf_used > 0) {
-        //There are already some (extra) content received in buffer in previous call of receive, or from negotiation.
-        in_buf[0].pvBuffer = m_buf.data();
-        in_buf[0].cbBuffer = (unsigned long)m_buf_used;
-        in_buf[0].BufferType = SECBUFFER_DATA;
-        in_buf[1].BufferType = SECBUFFER_EMPTY;
-        in_buf[2].BufferType = SECBUFFER_EMPTY;
-        in_buf[3].BufferType = SECBUFFER_EMPTY;
+ULONGLONG ServerSocket::on_pacing_timer(uint64_t key, ULONGLONG now)
+{
+    ConnectionHandle handle;
+    handle.value = key;
+    auto socket = connections.find(handle);
+    if (socket) {
+        //The I/O released may call the handler, so it's on the strand.
+        socket->run_task([now](ServerSocket* s) {
+            s->release_paced(now);
+        });
+    }
+    return 0;
+}
 
-        status = sspi->DecryptMessage(&m_ctx, &msg, 0, nullptr);
-        LOG_VERBOSE("DecryptMessage: ", status);
-    }
+bool ServerSocket::claim_release(volatile LONG64& release, ULONGLONG now)
+{
+    LONG64 time = release;
+    return time && (ULONGLONG)time <= now && InterlockedCompareExchange64(&release, 0, time) == time;
+}
 
-    if (status == SEC_E_INCOMPLETE_MESSAGE) {
-        LOG_INFO("SEC_E_INCOMPLETE_MESSAGE is received. Continue receiving...");
-        if (!tls_start_receive(user_buf, user_buf_size, true)) {
-            m_handler->on_error(this);
-        }
+void ServerSocket::release_paced(ULONGLONG now)
+{
+    //NOTE: The send and receive sides may hold I/O from different threads, each with a timer in its own wheel.
+    //A timer releases whatever is due, and the other one finds nothing then.
+    if (m_state != State::Started) {
         return;
     }
-
-    if (status == SEC_I_CONTEXT_EXPIRED) {
-        LOG_INFO("SEC_I_CONTEXT_EXPIRED is received!");
-        //TLS is shutting down.
-        tls_shutdown();
+    //They're started through the pacing again, since the buffer budget may still be exhausted.
+    if (claim_release(m_send_release, now) && !restart_send(m_paced_send_buf, m_paced_send_size)) {
+        m_handler->on_error(this);
         return;
     }
-
-    if (status == SEC_I_RENEGOTIATE) {
-        LOG_INFO("SEC_I_RENEGOTIATE is received!");
-        //NOTE: Renegotiation is not supported. We shutdown the session in this case.
-        tls_shutdown();
-        return;
+    if (claim_release(m_receive_release, now) && !restart_receive(m_paced_receive_buf, m_paced_receive_size)) {
+        m_handler->on_error(this);
     }
+}
 
-    if (status != SEC_E_OK) {
-        LOG_ERROR("DecryptMessage failed with error: ", status);
-        m_handler->on_error(this);
-        return;
+bool ServerSocket::queue_send(const char* buf, size_t size)
+{
+    if (m_state != State::Started) {
+        LOG_ERROR("Invalid state.");
+        return false;
     }
+    auto chunk = new_chunk(size);
+    memcpy(chunk->data(), buf, size);
+    auto queued = (size_t)InterlockedExchangeAdd64(&m_send_queued, size) + size;
+
+    SendChunk* head;
+    do {
+        head = m_send_incoming;
+        chunk->next = head;
+    } while (InterlockedCompareExchangePointer((PVOID volatile*)&m_send_incoming, chunk, head) != head);
+
+    //NOTE: A chunk is pushed before it's counted, the same as Strand::dispatch. So the thread that counts from 0
+    //finds one to send, and no other thread sends from the queue till the count drops to 0 again.
+    //The flight is started on a worker rather than here, since this may be any thread, where the pacing and the
+    //timers of the worker are not at hand. The event goes through the strand, if any.
+    if (InterlockedIncrement(&m_queue_chunks) == 1) {
+        m_queue_send_queued = true;
+        m_queue_send_event.reset();
+        if (!PostQueuedCompletionStatus(m_iocp, 0, (ULONG_PTR)this, &m_queue_send_event)) {
+            LOG_ERROR("PostQueuedCompletionStatus failed with error: ", GetLastError());
+            drop_queue();
+            m_queue_send_queued = false;
+            return false;
+        }
+    }
+    if (queued > m_send_high_watermark && InterlockedCompareExchange(&m_backpressure, Raising, Clear) == Clear) {
+        m_handler->on_backpressure(this, queued);
+        InterlockedExchange(&m_backpressure, Raised);
+        //The queue may have drained while on_backpressure was called, with no one to tell but this thread.
+        check_writable();
+    }
+    return true;
+}
 
-    PSecBuffer data_buf = nullptr;
-    for (int i = 1; i < 4; i++) //NOTE: Why from 1, not 0?
-    {
-        if (in_buf[i].BufferType == SECBUFFER_DATA)
-        {
-            data_buf = &in_buf[i];
-            break;
+ServerSocket::SendChunk* ServerSocket::new_chunk(size_t size)
+{
+    auto chunk = (SendChunk*)::operator new(sizeof(SendChunk) + size);
+    chunk->next = nullptr;
+    chunk->size = size;
+    add_buffer(m_queue_buffer_bytes, sizeof(SendChunk) + size);
+    return chunk;
+}
+
+void ServerSocket::free_chunk(SendChunk* chunk)
+{
+    add_buffer(m_queue_buffer_bytes, -(LONG64)(sizeof(SendChunk) + chunk->size));
+    ::operator delete(chunk);
+}
+
+void ServerSocket::take_flight()
+{
+    //Take all pushed so far, and reverse them into the order of queue_send.
+    auto p = (SendChunk*)InterlockedExchangePointer((PVOID volatile*)&m_send_incoming, nullptr);
+    SendChunk* first = nullptr;
+    size_t size = 0;
+    long count = 0;
+    while (p) {
+        auto next = p->next;
+        p->next = first;
+        first = p;
+        size += p->size;
+        count++;
+        p = next;
+    }
+    if (count > 1) {
+        //Coalesce them, so that small chunks go out in as few records and sends as possible.
+        auto flight = new_chunk(size);
+        size_t offset = 0;
+        while (first) {
+            auto next = first->next;
+            memcpy(flight->data() + offset, first->data(), first->size);
+            offset += first->size;
+            free_chunk(first);
+            first = next;
         }
+        first = flight;
     }
+    m_send_flight = first;
+    m_flight_chunks = count;
+    m_flight_offset = 0;
+    m_sending_queue = true;
+}
 
-    if (!data_buf)
-    {
-        m_handler->on_error(this);
-        return;
+void ServerSocket::check_writable()
+{
+    if ((size_t)m_send_queued <= m_send_low_watermark &&
+        InterlockedCompareExchange(&m_backpressure, Clear, Raised) == Raised) {
+        m_handler->on_writable(this);
     }
+}
 
-    if (data_buf->cbBuffer > user_buf_size) {
-        //NOTE: Is there a way to avoid/alleviate the short-buffer problem?
-        LOG_ERROR("Input buffer is not big enough. At least ", data_buf->cbBuffer, " bytes is required.");
-        m_handler->on_error(this);
+void ServerSocket::do_queue_send_event(QueueSendEvent* event)
+{
+    m_queue_send_queued = false;
+    if (m_state != State::Started) {
+        drop_queue();
         return;
     }
-
-    //NOTE: It seems the data_buf->pvBuffer points to an address in our m_buf.
-    //Also note that data_buf->cbBuffer can be 0, according to the document. HOWEVER, receiving zero-size buf
-    //is a sign of SHUTDOWN for plain socket recv call. And we'd better have the same semantics for higher level
-    //user no matter TLS is on or off.
-    if (data_buf->cbBuffer == 0) {
-        LOG_WARN("Received a message of empty payload.");
+    take_flight();
+    if (!start_queue_send()) {
+        drop_queue();
+        m_handler->on_error(this);
     }
-    memcpy(user_buf, data_buf->pvBuffer, data_buf->cbBuffer);
-    size_t result = data_buf->cbBuffer;
+}
 
-    //Save extra content read in buf
-    PSecBuffer extra_buf = nullptr;
-    for (int i = 1; i < 4; i++)
-    {
-        if (in_buf[i].BufferType == SECBUFFER_EXTRA)
-        {
-            extra_buf = &in_buf[i];
+void ServerSocket::drop_queue()
+{
+    //NOTE: A chunk is pushed before it's counted, so while the count is above 0 there are chunks to take.
+    while (true) {
+        long chunks = 0;
+        if (m_send_flight) {
+            chunks = m_flight_chunks;
+            InterlockedExchangeAdd64(&m_send_queued, -(LONG64)(m_send_flight->size - m_flight_offset));
+            free_chunk(m_send_flight);
+            m_send_flight = nullptr;
+            m_sending_queue = false;
+        }
+        if (InterlockedExchangeAdd(&m_queue_chunks, -chunks) - chunks <= 0) {
             break;
         }
+        take_flight();
     }
-    if (extra_buf)
-    {
-        LOG_INFO("Extra content of ", extra_buf->cbBuffer, " bytes is detected.");
-        //NOTE: Here memmove is used, rather than memcpy, because there may be overlap in src and dst.
-        assert(extra_buf->pvBuffer == m_buf.data() + m_buf_used - extra_buf->cbBuffer);
-        memmove(m_buf.data(), extra_buf->pvBuffer, extra_buf->cbBuffer);
-        //m_buf.resize(extra_buf->cbBuffer);
-        m_buf_used = extra_buf->cbBuffer;
-    }
-    else {
-        //m_buf.clear();
-        m_buf_used = 0;
-    }
+}
 
-    m_handler->on_received(this, user_buf, user_buf_size, result);
+bool ServerSocket::start_queue_send()
+{
+    auto buf = m_send_flight->data() + m_flight_offset;
+    auto size = m_send_flight->size - m_flight_offset;
+    return restart_send(buf, size);
 }
 
-bool ServerSocket::send(const char* buf, size_t size)
+void ServerSocket::do_queue_sent(size_t sent)
 {
-    if (m_state != State::Started) {
-        LOG_ERROR("Invalid state.");
-        return false;
+    m_flight_offset += sent;
+    InterlockedExchangeAdd64(&m_send_queued, -(LONG64)sent);
+    if (m_flight_offset < m_send_flight->size) {
+        if (!start_queue_send()) {
+            drop_queue();
+            m_handler->on_error(this);
+            return;
+        }
+    }
+    else {
+        auto chunks = m_flight_chunks;
+        free_chunk(m_send_flight);
+        m_send_flight = nullptr;
+        m_sending_queue = false;
+        //NOTE: Once the count drops to 0, another thread may take the next flight at once, so the flight is done
+        //with before.
+        if (InterlockedExchangeAdd(&m_queue_chunks, -chunks) - chunks > 0) {
+            take_flight();
+            if (!start_queue_send()) {
+                drop_queue();
+                m_handler->on_error(this);
+                return;
+            }
+        }
     }
-    return m_tls_enabled ? tls_start_send(buf, size) : start_send(buf, size);
+    check_writable();
 }
 
-bool ServerSocket::start_send(const char* buf, size_t size)
+bool ServerSocket::tls_start()
 {
-    assert(m_state == State::Started);
-    auto event = new SendEvent(this, buf, size);
-    WSABUF wsabuf;
-    wsabuf.buf = (char*)buf;
-    wsabuf.len = size;
-    auto result = WSASend(m_socket, &wsabuf, 1, nullptr, 0, event, nullptr);
-    if (result == SOCKET_ERROR && (ERROR_IO_PENDING != WSAGetLastError())) {
-        LOG_ERROR("WSASend failed with error: ", WSAGetLastError());
-        delete event;
+    assert(m_state == State::Init && tls_inited);
+    m_tls = tls_provider->create_server_session();
+    if (!m_tls) {
+        LOG_ERROR("Failed creating TLS session.");
         return false;
     }
+    m_buf_used = 0;
+    InterlockedExchange(&m_in_handshake, 1);
+    InterlockedIncrement(&handshakes);
+    set_deadline(m_receive_deadline, handshake_timeout);
+    if (!tls_start_handshake_receive()) {
+        end_handshake();
+        return false;
+    }
+    m_state = State::HandShake;
     return true;
 }
 
-bool ServerSocket::tls_start_send(const char* buf, size_t size)
+void ServerSocket::set_timeouts(DWORD handshake_ms, DWORD idle_ms, DWORD send_ms)
 {
-    assert(m_state == State::Started);
+    handshake_timeout = handshake_ms;
+    idle_timeout = idle_ms;
+    send_timeout = send_ms;
+    min_timeout = 0;
+    for (auto timeout : { handshake_ms, idle_ms, send_ms }) {
+        if (timeout && (!min_timeout || timeout < min_timeout)) {
+            min_timeout = timeout;
+        }
+    }
+}
 
-    size_t send_size = max_payload();
-    if (send_size > size) {
-        send_size = size;
+void ServerSocket::set_deadline(volatile ULONGLONG& deadline, DWORD timeout)
+{
+    if (!timeout) {
+        deadline = 0;
+        return;
     }
-    size_t ensure_size = send_size + m_size.cbHeader + m_size.cbTrailer;
-    if (ensure_size < init_buf_size) {
-        ensure_size = init_buf_size;
+    auto now = GetTickCount64();
+    deadline = now + timeout;
+    //The timer is added once, and finds the new deadline when it's due.
+    if (m_timer_queued || !TimerWheel::current || InterlockedExchange(&m_timer_queued, 1)) {
+        return;
     }
-    m_send_buf.resize(ensure_size);
-    memcpy(m_send_buf.data() + m_size.cbHeader, buf, send_size);
-
-    SecBuffer out_buf[4];
-    SecBufferDesc msg;
-
-    msg.ulVersion = SECBUFFER_VERSION;
-    msg.cBuffers = 4;
-    msg.pBuffers = out_buf;
-
-    out_buf[0].pvBuffer = m_send_buf.data();
-    out_buf[0].cbBuffer = m_size.cbHeader;
-    out_buf[0].BufferType = SECBUFFER_STREAM_HEADER;
-
-    out_buf[1].pvBuffer = m_send_buf.data() + m_size.cbHeader;
-    out_buf[1].cbBuffer = send_size;
-    out_buf[1].BufferType = SECBUFFER_DATA;
-
-    out_buf[2].pvBuffer = m_send_buf.data() + m_size.cbHeader + send_size;
-    out_buf[2].cbBuffer = m_size.cbTrailer;
-    out_buf[2].BufferType = SECBUFFER_STREAM_TRAILER;
+    TimerWheel::current->add(m_handle.value, now + min_timeout);
+}
 
-    out_buf[3].BufferType = SECBUFFER_EMPTY;
+ULONGLONG ServerSocket::on_timer(uint64_t key, ULONGLONG now)
+{
+    ConnectionHandle handle;
+    handle.value = key;
+    auto socket = connections.find(handle);
+    return socket ? socket->check_timeouts(now) : 0;
+}
 
-    auto status = sspi->EncryptMessage(&m_ctx, 0, &msg, 0);
-    if (FAILED(status)) {
-        LOG_ERROR("EncryptMessage failed with error: ", status);
-        //m_send_buf.clear();
-        return false;
+ULONGLONG ServerSocket::check_timeouts(ULONGLONG now)
+{
+    //NOTE: The flag is cleared before the deadlines are read, so that a deadline set in the meantime either is
+    //seen here or adds a timer itself.
+    InterlockedExchange(&m_timer_queued, 0);
+    if (m_state == State::Shutdown) {
+        return 0;
+    }
+    ULONGLONG receive_deadline = m_receive_deadline;
+    ULONGLONG send_deadline = m_send_deadline;
+    bool receive_expired = receive_deadline && receive_deadline <= now;
+    bool send_expired = send_deadline && send_deadline <= now;
+    if (!receive_deadline && !send_deadline) {
+        return 0;
+    }
+    if (InterlockedExchange(&m_timer_queued, 1)) {
+        return 0;
+    }
+    if (receive_expired || send_expired) {
+        LOG_INFO(send_expired ? "Send" : (m_state == State::HandShake ? "Handshake" : "Idle"), " timeout.");
+        //Pending I/O completes with ERROR_OPERATION_ABORTED, and the error goes to the handler, which shuts down
+        //the socket. If nothing is pending, like a handshake step queued on the lane, it's tried again later.
+        if (!CancelIoEx((HANDLE)m_socket, nullptr) && GetLastError() != ERROR_NOT_FOUND) {
+            LOG_WARN("CancelIoEx failed with error: ", GetLastError());
+        }
+        return now + min_timeout;
     }
-
-    if (InterlockedCompareExchange(&m_tls_sending, 1, 0)) {
-        LOG_ERROR("Concurrent sending is not supported.");
-        return false;
+    //A deadline set later than the timer was added may be earlier than any, but it's no earlier than min_timeout
+    //from now.
+    auto next = now + min_timeout;
+    if (receive_deadline && receive_deadline < next) {
+        next = receive_deadline;
+    }
+    if (send_deadline && send_deadline < next) {
+        next = send_deadline;
     }
+    return next;
+}
 
-    size_t total = out_buf[0].cbBuffer + out_buf[1].cbBuffer + out_buf[2].cbBuffer;
-    auto event = new TlsSendEvent(this, buf, size, send_size, total);
-    WSABUF wsabuf;
-    wsabuf.buf = m_send_buf.data();
-    wsabuf.len = total;
-    auto result = WSASend(m_socket, &wsabuf, 1, nullptr, 0, event, nullptr);
-    if (result == SOCKET_ERROR && (ERROR_IO_PENDING != WSAGetLastError())) {
-        LOG_ERROR("WSASend failed with error: ", WSAGetLastError());
-        InterlockedExchange(&m_tls_sending, 0);
-        delete event;
-        return false;
+void ServerSocket::count_buffer(volatile LONG64& counted, size_t bytes)
+{
+    auto delta = (LONG64)bytes - counted;
+    if (delta) {
+        counted = bytes;
+        InterlockedExchangeAdd64(&buffer_bytes, delta);
     }
-    return true;
 }
 
-void ServerSocket::do_send_event(SendEvent* event)
+void ServerSocket::add_buffer(volatile LONG64& counted, LONG64 bytes)
 {
-    DWORD io_size;
-    DWORD flags;
-    if (!WSAGetOverlappedResult(m_socket, event, &io_size, FALSE, &flags)) {
-        LOG_ERROR("WSAGetOverlappedResult failed with error: ", WSAGetLastError());
-        delete event;
+    InterlockedExchangeAdd64(&counted, bytes);
+    InterlockedExchangeAdd64(&buffer_bytes, bytes);
+}
+
+void ServerSocket::trim_idle(ULONGLONG now)
+{
+    if (!trim_idle_ms) {
         return;
     }
-    if (m_tls_enabled) {
-        tls_do_send((TlsSendEvent*)event, io_size);
+    //NOTE: A socket found in the registry is not freed till this thread is quiescent, even if it's retired
+    //meanwhile.
+    connections.for_each([idle_since = now - trim_idle_ms](ConnectionHandle, ServerSocket* socket) {
+        if (socket->m_state == State::Started && socket->m_last_send <= idle_since) {
+            socket->trim_buffers(idle_since);
+        }
+    });
+}
+
+void ServerSocket::trim_buffers(ULONGLONG idle_since)
+{
+    //NOTE: It runs apart from the I/O of the socket. The record buffer of the send side is taken by the same flag
+    //as a send, which is held till the send completes, so it's free when the flag is taken. A send done just before
+    //is seen by m_last_send once the flag is taken. The buffer of the handshake send event is taken by its flag the
+    //same way. m_handshake_out and the receive buffer are freed by the receive side itself, see tls_do_receive.
+    if (m_send_buffer_bytes && !InterlockedCompareExchange(&m_tls_sending, trimming, 0)) {
+        if (m_last_send <= idle_since) {
+            std::vector<char>().swap(m_send_buf);
+            count_buffer(m_send_buffer_bytes, 0);
+        }
+        InterlockedExchange(&m_tls_sending, 0);
     }
-    else {
-        m_handler->on_sent(this, event->m_buf, event->m_size, io_size);
+    if (m_handshake_send_counted && !InterlockedCompareExchange(&m_handshake_send_busy, 1, 0)) {
+        std::vector<char>().swap(m_handshake_send_event.m_data);
+        add_buffer(m_handshake_buffer_bytes, -(LONG64)m_handshake_send_counted);
+        m_handshake_send_counted = 0;
+        InterlockedExchange(&m_handshake_send_busy, 0);
     }
-    delete event;
 }
 
-void ServerSocket::tls_do_send(TlsSendEvent* event, size_t sent)
+void ServerSocket::count_handshake_out()
 {
-    InterlockedExchange(&m_tls_sending, 0);
-    if (sent == event->m_encrypted_send_size) {
-        m_handler->on_sent(this, event->m_buf, event->m_size, event->m_send_size);
+    auto capacity = m_handshake_out.capacity();
+    if (capacity != m_handshake_out_counted) {
+        add_buffer(m_handshake_buffer_bytes, (LONG64)capacity - (LONG64)m_handshake_out_counted);
+        m_handshake_out_counted = capacity;
     }
-    else {
-        m_handler->on_error(this);
+}
+
+void ServerSocket::free_handshake_out()
+{
+    if (m_handshake_out_counted) {
+        std::vector<char>().swap(m_handshake_out);
+        add_buffer(m_handshake_buffer_bytes, -(LONG64)m_handshake_out_counted);
+        m_handshake_out_counted = 0;
     }
 }
 
-bool ServerSocket::tls_start()
+void ServerSocket::end_handshake()
 {
-    assert(m_state == State::Init && tls_inited);
-    m_buf_used = 0;
-    if (!tls_start_handshake_receive()) {
-        return false;
+    //It may be called from the handshake and from a shutdown on an error at the same time, but counts once.
+    if (InterlockedExchange(&m_in_handshake, 0)) {
+        InterlockedDecrement(&handshakes);
     }
-    m_state = State::HandShake;
-    return true;
 }
 
 //Start a handshake receive with internal m_buf starting at (m_buf.data() + m_buf_used).
@@ -399,167 +643,180 @@ bool ServerSocket::tls_start_handshake_receive()
 {
     assert(m_buf_used <= m_buf.size());
     resize_buf_when_necessary();
-    auto event = new HandshakeReceiveEvent(this, m_buf.data() + m_buf_used, m_buf.size() - m_buf_used);
+    auto event = &m_handshake_receive_event;
+    event->reset();
+    event->m_buf = m_buf.data() + m_buf_used;
+    event->m_size = m_buf.size() - m_buf_used;
     DWORD flags = 0;
     WSABUF wsabuf;
     wsabuf.buf = m_buf.data() + m_buf_used;
     wsabuf.len = m_buf.size() - m_buf_used;
+    m_receive_pending = true;
     auto result = WSARecv(m_socket, &wsabuf, 1, nullptr, &flags, event, nullptr);
     if (result == SOCKET_ERROR && (ERROR_IO_PENDING != WSAGetLastError())) {
         LOG_ERROR("WSARecv failed with error: ", WSAGetLastError());
-        delete event;
+        m_receive_pending = false;
         return false;
     }
     return true;
 }
 
-bool ServerSocket::tls_start_handshake_send(const char* buf, size_t size)
+bool ServerSocket::tls_start_handshake_send(std::vector<char>& data)
 {
-    auto event = new HandshakeSendEvent(this, buf, size);
+    HandshakeSendEvent* event;
+    if (!InterlockedCompareExchange(&m_handshake_send_busy, 1, 0)) {
+        event = &m_handshake_send_event;
+        event->reset();
+    }
+    else {
+        LOG_VERBOSE("The last handshake send is still in flight.");
+        event = new HandshakeSendEvent(this);
+    }
+    count_handshake_out();
+    event->swap_data(data);
+    data.clear();
+    if (event == &m_handshake_send_event) {
+        std::swap(m_handshake_out_counted, m_handshake_send_counted);
+    }
+    else {
+        //The buffer goes with the event, which is freed on completion.
+        add_buffer(m_handshake_buffer_bytes, -(LONG64)m_handshake_out_counted);
+        m_handshake_out_counted = 0;
+    }
     WSABUF wsabuf;
-    wsabuf.buf = (char*)buf;
-    wsabuf.len = size;
+    wsabuf.buf = event->m_buf;
+    wsabuf.len = event->m_size;
+    InterlockedIncrement(&m_handshake_sends);
     auto result = WSASend(m_socket, &wsabuf, 1, nullptr, 0, event, nullptr);
     if (result == SOCKET_ERROR && (ERROR_IO_PENDING != WSAGetLastError())) {
         LOG_ERROR("WSASend failed with error: ", WSAGetLastError());
-        delete event;
+        InterlockedDecrement(&m_handshake_sends);
+        release_handshake_send_event(event);
         return false;
     }
     return true;
 }
 
+void ServerSocket::release_handshake_send_event(HandshakeSendEvent* event)
+{
+    if (event == &m_handshake_send_event) {
+        InterlockedExchange(&m_handshake_send_busy, 0);
+    }
+    else {
+        delete event;
+    }
+}
+
 void ServerSocket::do_handshake_receive_event(HandshakeReceiveEvent* event)
 {
+    m_receive_pending = false;
     DWORD io_size;
     DWORD flags;
     bool error = !WSAGetOverlappedResult(m_socket, event, &io_size, FALSE, &flags);
-    delete event;
     if (error) {
         LOG_ERROR("WSAGetOverlappedResult failed with error: ", WSAGetLastError());
         m_handler->on_error(this);
         return;
     }
+    if (!io_size) {
+        LOG_INFO("Client is shutting down.");
+        shutdown();
+        return;
+    }
 
     m_buf_used += io_size;
-
-    //AcceptSecurityContext
-    DWORD req_context_flags = ASC_REQ_ALLOCATE_MEMORY | ASC_REQ_CONFIDENTIALITY | ASC_REQ_EXTENDED_ERROR |
-        ASC_REQ_REPLAY_DETECT | ASC_REQ_SEQUENCE_DETECT | ASC_REQ_STREAM;
-    DWORD ret_context_flags = 0;
-    TimeStamp ts;
-
-    //NOTE: Shall we have a third in-buffer of type SECBUFFER_ALERT as said in
-    //https://docs.microsoft.com/en-us/windows/win32/secauthn/acceptsecuritycontext--schannel ?
-    SecBuffer in_buf[2];
-    SecBuffer out_buf[1];
-    SecBufferDesc in_buf_desc;
-    SecBufferDesc out_buf_desc;
-
-    in_buf[0].pvBuffer = m_buf.data();
-    in_buf[0].cbBuffer = m_buf_used;
-    in_buf[0].BufferType = SECBUFFER_TOKEN;
-
-    in_buf[1].pvBuffer = nullptr;
-    in_buf[1].cbBuffer = 0;
-    in_buf[1].BufferType = SECBUFFER_EMPTY;
-
-    out_buf[0] = {};
-
-    in_buf_desc.cBuffers = 2;
-    in_buf_desc.pBuffers = in_buf;
-    in_buf_desc.ulVersion = SECBUFFER_VERSION;
-
-    out_buf_desc.cBuffers = 1;
-    out_buf_desc.pBuffers = out_buf;
-    out_buf_desc.ulVersion = SECBUFFER_VERSION;
-
-    auto status = sspi->AcceptSecurityContext(
-        &tls_cred,
-        m_ctx.dwLower != 0 || m_ctx.dwUpper != 0 ? &m_ctx : nullptr,
-        &in_buf_desc,
-        req_context_flags,
-        0,
-        m_ctx.dwLower != 0 || m_ctx.dwUpper != 0 ? nullptr : &m_ctx,
-        &out_buf_desc,
-        &ret_context_flags,
-        &ts
-    );
-
-    //Send content in out_buf if any
-    if (out_buf[0].cbBuffer != 0 && out_buf[0].pvBuffer != nullptr)
-    {
-        if (!tls_start_handshake_send((char*)out_buf[0].pvBuffer, out_buf[0].cbBuffer)) {
-            LOG_ERROR("Failed sending out handshake message.");
-            sspi->FreeContextBuffer(out_buf[0].pvBuffer);
-            m_handler->on_error(this);
+    if (handshake_lane) {
+        m_handshake_queued = true;
+        m_handshake_work_event.reset();
+        if (PostQueuedCompletionStatus(handshake_lane, 0, (ULONG_PTR)this, &m_handshake_work_event)) {
             return;
         }
+        LOG_WARN("PostQueuedCompletionStatus failed with error: ", GetLastError());
+        m_handshake_queued = false;
     }
+    tls_do_handshake();
+}
 
-    if (status == SEC_E_INCOMPLETE_MESSAGE) {
-        LOG_INFO("SEC_E_INCOMPLETE_MESSAGE");
-        tls_start_handshake_receive();
+void ServerSocket::do_handshake_work_event(HandshakeWorkEvent* event)
+{
+    m_handshake_queued = false;
+    tls_do_handshake();
+}
+
+void ServerSocket::do_handshake_send_event(HandshakeSendEvent* event)
+{
+    DWORD io_size;
+    DWORD flags;
+    bool error = !WSAGetOverlappedResult(m_socket, event, &io_size, FALSE, &flags) || io_size != event->m_size;
+    //NOTE: The event is released before m_handshake_sends is decreased, since the socket may be freed once
+    //nothing is in flight.
+    release_handshake_send_event(event);
+    InterlockedDecrement(&m_handshake_sends);
+    if (error) {
+        LOG_ERROR("WSAGetOverlappedResult failed with error: ", WSAGetLastError());
+        m_handler->on_error(this);
         return;
     }
+}
 
-    if (status == SEC_I_CONTINUE_NEEDED) {
-        LOG_INFO("SEC_I_CONTINUE_NEEDED");
-        if (in_buf[1].BufferType == SECBUFFER_EXTRA) {
-            LOG_ERROR("Extra content of ", in_buf[1].cbBuffer, " bytes is detected.");
-            m_handler->on_error(this);
+//Feed the handshake with the content in m_buf.
+void ServerSocket::tls_do_handshake()
+{
+    auto& out = m_handshake_out;
+    out.clear();
+    auto status = My::TlsStatus::Continue;
+    //Several handshake messages may arrive at once. Go on while some input is left and the last step used some.
+    while (true) {
+        size_t consumed = 0;
+        status = m_tls->handshake(m_buf.data(), m_buf_used, consumed, out);
+        if (consumed) {
+            //NOTE: Here memmove is used, rather than memcpy, because there may be overlap in src and dst.
+            memmove(m_buf.data(), m_buf.data() + consumed, m_buf_used - consumed);
+            m_buf_used -= consumed;
         }
-        else {
-            m_buf_used = 0;
-            tls_start_handshake_receive();
+        if (status != My::TlsStatus::Continue || !m_buf_used || !consumed) {
+            break;
         }
-        return;
     }
 
-    if (status != SEC_E_OK)
-    {
-        LOG_ERROR("AcceptSecurityContext failed with: ", status);
+    //Send content in out if any, which may be an alert on failure.
+    //NOTE: The send and the next receive are posted back to back from this completion, so the flight goes out
+    //while the next one from the client is being waited for.
+    if (!out.empty() && !tls_start_handshake_send(out)) {
+        LOG_ERROR("Failed sending out handshake message.");
         m_handler->on_error(this);
         return;
     }
 
-    LOG_INFO("SEC_E_OK");
-
-    if (in_buf[1].BufferType == SECBUFFER_EXTRA) {
-        LOG_INFO("Extra content of ", in_buf[1].cbBuffer, " bytes is detected.");
-        //Save any extra content read in
-        //NOTE: Here memmove is used, rather than memcpy, because there may be overlap in src and dst.
-        memmove(m_buf.data(), m_buf.data() + m_buf_used - in_buf[1].cbBuffer, in_buf[1].cbBuffer);
-        //m_buf.resize(in_buf[1].cbBuffer);
-        m_buf_used = in_buf[1].cbBuffer;
-    }
-    else {
-        //m_buf.clear();
-        m_buf_used = 0;
+    if (status == My::TlsStatus::Continue || status == My::TlsStatus::Incomplete) {
+        if (!tls_start_handshake_receive()) {
+            m_handler->on_error(this);
+        }
+        return;
     }
 
-    status = sspi->QueryContextAttributes(&m_ctx, SECPKG_ATTR_STREAM_SIZES, &m_size);
-    if (status != SEC_E_OK) {
-        LOG_ERROR("QueryContextAttributes failed with: ", status);
+    if (status != My::TlsStatus::Ok) {
+        LOG_ERROR("Handshake failed.");
         m_handler->on_error(this);
         return;
     }
 
-    m_state = State::Started;
-    m_handler->on_started(this);
-}
-
-void ServerSocket::do_handshake_send_event(HandshakeSendEvent* event)
-{
-    DWORD io_size;
-    DWORD flags;
-    bool error = !WSAGetOverlappedResult(m_socket, event, &io_size, FALSE, &flags) || io_size != event->m_size;
-    sspi->FreeContextBuffer(event->m_buf);  //TODO: Some way to ensure the buf gets freed?
-    delete event;
-    if (error) {
-        LOG_ERROR("WSAGetOverlappedResult failed with error: ", WSAGetLastError());
-        m_handler->on_error(this);
-        return;
+    LOG_INFO("Handshake is done.");
+    end_handshake();
+    free_handshake_out();
+    if (m_buf_used) {
+        LOG_INFO("Extra content of ", m_buf_used, " bytes is detected.");
+    }
+    m_sizes = m_tls->get_sizes();
+    HandshakeStats::record(m_tls);
+    if (m_tls->is_resumed()) {
+        LOG_VERBOSE("Session resumed.");
     }
+
+    m_last_send = GetTickCount64();
+    m_state = State::Started;
+    set_deadline(m_receive_deadline, idle_timeout);
+    do_started();
 }
 
 void ServerSocket::tls_shutdown()
@@ -570,61 +827,34 @@ void ServerSocket::tls_shutdown()
 
 bool ServerSocket::tls_init(const wchar_t * server_name)
 {
-    if (!sspi) {
-        sspi = InitSecurityInterface();
-        if (!sspi) {
-            LOG_ERROR("InitSecurityInterface failed.");
-            return false;
-        }
-    }
-    tls_inited = create_server_cred(server_name);
-    return tls_inited;
+    std::vector<std::wstring> server_names;
+    server_names.push_back(server_name);
+    return tls_init(server_names);
 }
 
-bool ServerSocket::create_server_cred(const wchar_t* server_name)
+bool ServerSocket::tls_init(const std::vector<std::wstring>& server_names)
 {
-    auto tls_cert = Certificate::get(server_name);
-    if (!tls_cert) {
-        //TODO: Log can output wstring.
-        LOG_ERROR("Server certificate is not found!");
-        return false;
+    if (server_names.empty()) {
+        tls_creds.add_all();
     }
-    SCHANNEL_CRED schannel_cred{};
-    TimeStamp ts;
-    schannel_cred.dwVersion = SCHANNEL_CRED_VERSION;
-    schannel_cred.cCreds = 1;
-    schannel_cred.paCred = &tls_cert;
-    //NOTE: by https://docs.microsoft.com/en-us/windows/win32/api/schannel/ns-schannel-schannel_cred
-    //"
-    //If this member is zero, Schannel selects the protocol. For new development, applications should
-    //set grbitEnabledProtocols to zero and use the protocol versions enabled on the system by default.
-    //This member is used only by the Microsoft Unified Security Protocol Provider security package.
-    //The global system registry settings take precedence over this value. For example, if SSL3 is
-    //disabled in the registry, it cannot be enabled using this member.
-    //"
-    schannel_cred.grbitEnabledProtocols = SP_PROT_TLS1_2_SERVER;
-    //NOTE: Do we need to set this and what will happen when the session expires?
-    //schannel_cred.dwSessionLifespan = ?
-    schannel_cred.dwFlags = SCH_USE_STRONG_CRYPTO;
-    auto status = sspi->AcquireCredentialsHandle(
-        nullptr,
-        const_cast<_TCHAR*>(UNISP_NAME),    //NOTE: What about SCHANNEL_NAME?
-        SECPKG_CRED_INBOUND,
-        nullptr,
-        &schannel_cred,
-        nullptr,
-        nullptr,
-        &tls_cred,
-        &ts
-    );
-    Certificate::free(tls_cert);
-    if (status != SEC_E_OK) {
-        if (status == SEC_E_UNKNOWN_CREDENTIALS) {
-            LOG_ERROR("AcquireCredentialsHandle failed with SEC_E_UNKNOWN_CREDENTIALS. The server certificate is probabaly invalid!");
-        }
-        else {
-            LOG_ERROR("AcquireCredentialsHandle failed with: ", status);
+    else {
+        for (auto& name : server_names) {
+            if (!tls_creds.add(name.c_str())) {
+                //TODO: Log can output wstring.
+                LOG_ERROR("No credential for a server name!");
+            }
         }
     }
-    return (status == SEC_E_OK);
+    if (!tls_creds.get_default()) {
+        return false;
+    }
+    static My::SspiTlsProvider sspi_provider(&tls_creds);
+    return tls_init(&sspi_provider);
+}
+
+bool ServerSocket::tls_init(My::ITlsProvider* provider)
+{
+    tls_provider = provider;
+    tls_inited = (provider != nullptr);
+    return tls_inited;
 }
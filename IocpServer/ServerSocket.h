@@ -1,17 +1,35 @@
 #pragma once
 
 #include "Common.h"
-
-//SECURITY_WIN32 is required by sspi.h
-#define SECURITY_WIN32
-#include <sspi.h>
-#include <Wincrypt.h>
+#include "ConnectionRegistry.h"
+#include "Event.h"
+#include "TokenBucket.h"
+#include "Strand.h"
+#include "ComputePool.h"
+#include <functional>
 #include <vector>
+#include <string>
+#include <new>
+#include <cassert>
+#include "..\SecureSocket\ITlsSession.h"
+#include "..\SecureSocket\CredentialTable.h"
 
 class ServerSocket;
+class TimerWheel;
+template <typename Base, typename Socket>
+class BasicDataEvent;
+
+//The transport of ServerSocket, which is TLS or not by enable_tls of ServerSocket::create, at runtime. See
+//BasicServerSocket for the ones fixed at compile time.
+struct RuntimeTransport
+{
+    static constexpr bool fixed = false;
+    static constexpr bool tls = false;
+};
 
-//NOTE: For a callback on_xxx, the ServerSocket may be deleted from inside it. ServerSocket
-//should hanlde such case properly.
+//NOTE: For a callback on_xxx, the ServerSocket may be retired from inside it. A retired ServerSocket
+//is not deleted at once but after all threads have passed a quiescent point (see Reclaimer), so it's
+//still safe to touch the socket in the rest of the callback.
 class IServerSocketHandler
 {
 public:
@@ -25,22 +43,37 @@ public:
 
     virtual void on_error(ServerSocket* socket) = 0;
 
+    //The bytes queued by queue_send have risen above the high watermark. It's called once until on_writable.
+    virtual void on_backpressure(ServerSocket* socket, size_t queued) {}
+
+    //The bytes queued have fallen to the low watermark after on_backpressure.
+    virtual void on_writable(ServerSocket* socket) {}
+
     virtual ~IServerSocketHandler() {}
 };
 
-class ReceiveEvent;
-class SendEvent;
-class HandshakeReceiveEvent;
-class HandshakeSendEvent;
-class TlsSendEvent;
-
+//The alignment of a region of the fields of ServerSocket. Build with SOCKET_SHARED_LINES to pack the regions
+//together, so that the benchmark of -F of Main measures what the split saves.
+#ifdef SOCKET_SHARED_LINES
+#define SOCKET_REGION
+#else
+#define SOCKET_REGION alignas(CACHE_LINE_SIZE)
+#endif
+
+//NOTE: The path of data I/O, from a completion to the handler and on to the next receive or send, is written once as
+//member templates of the socket type, see BasicServerSocket.h. ServerSocket is the type erased instance, with the
+//transport chosen at runtime and the handler called through IServerSocketHandler. A BasicServerSocket is the same
+//socket with both fixed at compile time, which shares everything else, like the registry, timeouts, rate limits,
+//buffer budgets, the send queue and strands.
 class ServerSocket
 {
-    friend class ReceiveEvent;
-    friend class SendEvent;
     friend class HandshakeReceiveEvent;
     friend class HandshakeSendEvent;
-    friend class TlsSendEvent;
+    friend class HandshakeWorkEvent;
+    friend class YieldEvent;
+    friend class QueueSendEvent;
+    template <typename Base, typename Socket>
+    friend class BasicDataEvent;
 
 public:
     enum class State {
@@ -50,63 +83,373 @@ public:
         Shutdown
     };
 
+    //Of the instance of the data path, see BasicServerSocket.
+    typedef RuntimeTransport TransportType;
+    typedef IServerSocketHandler HandlerType;
+
     static ServerSocket* create(HANDLE iocp, SOCKET socket, IServerSocketHandler * handler, bool enable_tls);
 
-    ~ServerSocket();
+    virtual ~ServerSocket();
 
     bool start();
 
     void shutdown();
 
+    //Remove the socket from the connection registry and delete it when no one references it any longer.
+    //It should be called once in on_shutdown, instead of deleting the socket directly.
+    void retire();
+
     bool receive(char* buf, size_t size);
 
     bool send(const char* buf, size_t size);
 
+    //Whether a receive or send is pending in kernel, which may still use the buffer of the handler. A socket shut
+    //down has its I/O canceled, and the buffer is free to go once it's false.
+    bool is_io_pending() const {
+        return m_receive_pending || m_send_pending;
+    }
+
+    //Copy the data into the send queue of the socket, which is sent in order behind the scenes, with no on_sent
+    //for it. The queue is not bounded, but the handler is told by on_backpressure and on_writable when it crosses
+    //the watermarks. A handler uses either send or queue_send, but not both at a time.
+    //
+    //Unlike send, it may be called from any number of threads at the same time, with no lock. Data queued by a
+    //thread is sent in the order it's queued, while data of different threads is interleaved as they race.
+    bool queue_send(const char* buf, size_t size);
+
+    //Bytes queued by queue_send and not sent yet
+    size_t get_send_queued() const {
+        return (size_t)m_send_queued;
+    }
+
+    //It applies to the bytes queued afterwards. low must not be greater than high.
+    void set_send_watermarks(size_t low, size_t high) {
+        assert(low <= high);
+        m_send_low_watermark = low;
+        m_send_high_watermark = high;
+    }
+
+    //Run the callbacks of the handler and the tasks posted to the socket on a strand, one at a time, so that the
+    //handler needs no lock for the state of the connection. It should be called in on_started, before any I/O.
+    //It costs a couple of Interlocked* calls per completion.
+    void enable_strand() {
+        m_stranded = true;
+    }
+
+    //Run task with the socket of handle on a worker, on its strand if it has one. It may be called from any thread,
+    //like after a call to a backend. The task is dropped if the connection is gone or shut down by then.
+    static bool post(ConnectionHandle handle, std::function<void(ServerSocket*)> task);
+
+    //Run work on the compute pool, off the workers, and then done with the result of it on the socket through post,
+    //as done(ServerSocket*, result). Both run inline if the pool has no threads. work must not touch the socket or
+    //the handler, which may be freed meanwhile, so it should own a copy of the data it needs. done is dropped if the
+    //connection is gone by then.
+    template <typename Work, typename Done>
+    bool offload(Work work, Done done) {
+        if (!ComputePool::get_threads()) {
+            done(this, work());
+            return true;
+        }
+        auto handle = m_handle;
+        return ComputePool::submit([handle, work = std::move(work), done = std::move(done)]() mutable {
+            auto result = work();
+            post(handle, [result = std::move(result), done = std::move(done)](ServerSocket* socket) mutable {
+                done(socket, std::move(result));
+            });
+        });
+    }
+
+    //Bytes of the I/O buffers owned by the socket, for TLS records, handshake messages and queued sends
+    size_t get_buffer_bytes() const {
+        return (size_t)(m_receive_buffer_bytes + m_send_buffer_bytes + m_handshake_buffer_bytes + m_queue_buffer_bytes);
+    }
+
+    //Limit the bytes per second sent and received by the socket, where 0 means no limit. A send or receive over the
+    //rate is held and started later from the pacing wheel of the thread, rather than blocking it. It should be set
+    //before any I/O, like in on_started.
+    void set_rate_limits(double send_rate, double receive_rate);
+
+    //Hold the next receive, until resume_receive, so that no more data is read from the peer. A receive already
+    //pending in kernel still completes. Both may be called from any thread.
+    void pause_receive();
+
+    void resume_receive();
+
     State get_state() const {
         return m_state;
     }
 
+    ConnectionHandle get_handle() const {
+        return m_handle;
+    }
+
+    //Return nullptr if the handle is stale, i.e. the connection it refers to is gone.
+    static ServerSocket* find(ConnectionHandle handle) {
+        return connections.find(handle);
+    }
+
+    static const ConnectionRegistry& get_connections() {
+        return connections;
+    }
+
+    //Number of TLS handshakes in progress
+    static long get_handshakes() {
+        return handshakes;
+    }
+
     static bool tls_init(const wchar_t * server_name = L"localhost");
 
-private:
+    //Serve multiple names, selected by the Server Name Indication(SNI) of clients. The first name is the default
+    //one. When server_names is empty, all names of the certificates in the store are served.
+    static bool tls_init(const std::vector<std::wstring>& server_names);
+
+    //Use another TLS provider than Schannel. provider must outlive all sockets.
+    static bool tls_init(My::ITlsProvider* provider);
+
+    //Run handshakes on the workers of another completion port, rather than the one of data I/O, so that a storm of
+    //handshakes doesn't hold up established connections. The workers of lane bound how much CPU handshakes take.
+    //It applies to sockets created afterwards.
+    static void set_handshake_lane(HANDLE lane) {
+        handshake_lane = lane;
+    }
+
+    //Timeouts in milliseconds of a TLS handshake, of no data received, and of a send not completed, where 0 means
+    //no timeout. On a timeout the pending I/O is canceled and the handler gets an error.
+    static void set_timeouts(DWORD handshake_ms, DWORD idle_ms, DWORD send_ms);
+
+    //Check the timeouts of the connection of the timer, see TimerWheel::ExpireFunc.
+    static ULONGLONG on_timer(uint64_t key, ULONGLONG now);
+
+    //Bytes of the I/O buffers of all sockets
+    static LONG64 get_total_buffer_bytes() {
+        return buffer_bytes;
+    }
+
+    //Limit the I/O buffers of all sockets to about budget bytes, where 0 means no limit. Over the budget, receives
+    //are held until it's back under, so that no more data comes in to be buffered. Buffers in use are not taken
+    //away, so the budget is soft.
+    static void set_buffer_budget(LONG64 budget) {
+        buffer_budget = budget;
+    }
+
+    //Number of times a receive has been held by the buffer budget
+    static LONG64 get_budget_delays() {
+        return budget_delays;
+    }
+
+    //Free the record buffer for sending and the handshake buffers of a connection that has sent nothing for ms,
+    //where 0 disables it. See trim_idle.
+    static void set_trim_idle(DWORD ms) {
+        trim_idle_ms = ms;
+    }
+
+    //Free the buffers of the connections idle for the time set by set_trim_idle. It should be called at an interval
+    //shorter than the time, from a thread that takes part in reclamation, like the main thread.
+    static void trim_idle(ULONGLONG now);
+
+    //Budget of a turn of each connection, in bytes received and receives, where 0 means no limit. A connection
+    //that has used up its turn yields: its next receive is queued on the completion port behind the completions
+    //that are ready, so that a connection that always has data doesn't hold up the others on a worker. A turn ends
+    //when a receive has to wait for data, so it only counts receives that complete back to back.
+    static void set_turn_budget(size_t bytes, size_t receives) {
+        turn_bytes = bytes;
+        turn_receives = receives;
+    }
+
+    //Number of times a connection has yielded
+    static LONG64 get_yields() {
+        return yields;
+    }
+
+    //Rate limits of each socket created afterwards, see set_rate_limits.
+    static void set_default_rate_limits(double send_rate, double receive_rate) {
+        default_send_rate = send_rate;
+        default_receive_rate = receive_rate;
+    }
+
+    //Start the sends and receives held for rate limits, see TimerWheel::ExpireFunc.
+    static ULONGLONG on_pacing_timer(uint64_t key, ULONGLONG now);
+
+    //The wheel of the current thread for I/O held by rate limits. Its tick is finer than TimerWheel::current, for
+    //timeouts, to keep the rates smooth. With no wheel, I/O is never held.
+    static thread_local TimerWheel* pacing_wheel;
+
+    //Send from the buffers in place, rather than copying them into the socket send buffer of the kernel. It applies
+    //to sockets created afterwards.
+    static void set_zero_copy_send(bool enabled) {
+        zero_copy_send = enabled;
+    }
+
+protected:
     ServerSocket(HANDLE iocp, SOCKET socket, IServerSocketHandler* handler, bool enable_tls) : 
-        m_iocp(iocp), m_socket(socket), m_handler(handler), m_tls_enabled(enable_tls) {}
+        m_iocp(iocp), m_socket(socket), m_handler(handler), m_tls_enabled(enable_tls),
+        m_handshake_receive_event(this), m_handshake_send_event(this), m_handshake_work_event(this),
+        m_yield_event(this), m_queue_send_event(this) {}
+
+    //Register a socket just created and bind it to the completion port. On failure it's deleted and nullptr is
+    //returned, with the handler and the socket left to the caller.
+    static ServerSocket* init(ServerSocket* obj);
+
+    //The data path for Socket, which is ServerSocket or a BasicServerSocket, see BasicServerSocket.h.
+    template <typename Socket>
+    bool receive(char* buf, size_t size);
+
+    template <typename Socket>
+    bool send(const char* buf, size_t size);
+
+    //Start a send or receive of data, or hold it when it's over the rate limit.
+    template <typename Socket>
+    bool start_paced_send(const char* buf, size_t size);
+
+    template <typename Socket>
+    bool start_paced_receive(char* buf, size_t size);
+
+    template <typename Socket>
+    bool is_tls() const {
+        return Socket::TransportType::fixed ? Socket::TransportType::tls : m_tls_enabled;
+    }
+
+    template <typename Socket>
+    Socket* self() {
+        return static_cast<Socket*>(this);
+    }
+
+    //The handler as its own type, whose callbacks are direct calls when it's final.
+    template <typename Socket>
+    typename Socket::HandlerType* handler_of() const {
+        return static_cast<typename Socket::HandlerType*>(m_handler);
+    }
+
+private:
+    //Where a connection goes on from outside the completions of its data path: when it's started, and when a
+    //receive or send put off by a yield, a pause, the rate limits or the send queue is started. A BasicServerSocket
+    //overrides them to go on with its own types from there.
+    virtual void do_started();
+
+    virtual bool restart_receive(char* buf, size_t size);
+
+    virtual bool restart_send(const char* buf, size_t size);
 
     bool start_at_once();
 
     void shutdown_at_once();
 
+    template <typename Socket>
     bool start_receive(char* buf, size_t size);
 
+    template <typename Socket>
     bool tls_start_receive(char* buf, size_t size, bool force_start);
 
+    //Complete a data event of the socket, on its strand if it has one. The event is of type E exactly, so that
+    //complete is a direct call.
+    template <typename E>
+    void dispatch(E* event) {
+        if (m_stranded) {
+            m_strand.dispatch(event);
+        }
+        else {
+            event->E::complete();
+        }
+    }
+
+    //Run task now, or on the strand after what's running. It's called on a worker.
+    void run_task(std::function<void(ServerSocket*)>&& task);
+
+    template <typename Socket>
     void do_receive_event(ReceiveEvent* event);
 
+    //Queue the receive behind the other completions if the turn is used up, and return true then.
+    bool yield_receive(char* buf, size_t size);
+
+    void do_yield_event(YieldEvent* event);
+
+    void do_queue_send_event(QueueSendEvent* event);
+
+    template <typename Socket>
     void tls_do_receive(char* buf, size_t size, size_t received);
 
+    template <typename Socket>
     bool start_send(const char* buf, size_t size);
 
+    //Hold the I/O till release, which is claimed by one thread only.
+    static bool claim_release(volatile LONG64& release, ULONGLONG now);
+
+    void release_paced(ULONGLONG now);
+
+    //Data copied by queue_send, with the bytes following it
+    struct SendChunk {
+        SendChunk* next;
+        size_t size;
+
+        char* data() {
+            return (char*)(this + 1);
+        }
+    };
+
+    //They count the chunk in the buffers of the socket.
+    SendChunk* new_chunk(size_t size);
+
+    void free_chunk(SendChunk* chunk);
+
+    //Take the chunks queued so far as the next flight, by the thread that sends from the queue.
+    void take_flight();
+
+    //Send what's left in m_send_flight.
+    bool start_queue_send();
+
+    //Drop the flight and the chunks queued behind it, on an error of the thread that sends from the queue, so that
+    //the count drops to 0 and the queue isn't left with no thread to send from it.
+    void drop_queue();
+
+    //Tell the handler the queue has drained to the low watermark, if it was told of backpressure.
+    void check_writable();
+
+    //Route a completed data send to the send queue or the handler.
+    template <typename Socket>
+    void do_sent(const char* buf, size_t size, size_t sent);
+
+    void do_queue_sent(size_t sent);
+
+    template <typename Socket>
     bool tls_start_send(const char* buf, size_t size);
 
+    template <typename Socket>
     void do_send_event(SendEvent* event);
 
+    template <typename Socket>
     void tls_do_send(TlsSendEvent* event, size_t sent);
 
     bool tls_start();
 
     bool tls_start_handshake_receive();
 
-    bool tls_start_handshake_send(const char * buf, size_t size);
+    //Send the content of data, which is left empty for reuse. data is m_handshake_out.
+    bool tls_start_handshake_send(std::vector<char>& data);
+
+    //Count the growth of m_handshake_out by the TLS session, on the receive side.
+    void count_handshake_out();
+
+    //Free m_handshake_out, which is only needed again for the rare post-handshake messages.
+    void free_handshake_out();
 
     void do_handshake_receive_event(HandshakeReceiveEvent* event);
 
     void do_handshake_send_event(HandshakeSendEvent* event);
 
+    void release_handshake_send_event(HandshakeSendEvent* event);
+
+    void do_handshake_work_event(HandshakeWorkEvent* event);
+
+    void tls_do_handshake();
+
     void tls_shutdown();
 
-    inline size_t max_payload() {
-        return m_size.cbMaximumMessage - m_size.cbHeader - m_size.cbTrailer;
-    }
+    void end_handshake();
+
+    //Set the deadline by the timeout from now, and make sure a timer of the connection is in the wheel.
+    void set_deadline(volatile ULONGLONG& deadline, DWORD timeout);
+
+    ULONGLONG check_timeouts(ULONGLONG now);
 
     inline void resize_buf_when_necessary() {
         if (m_buf_used == m_buf.size()) {
@@ -115,33 +458,193 @@ private:
                 to_size = init_buf_size;
             }
             m_buf.resize(to_size);
+            count_buffer(m_receive_buffer_bytes, m_buf.capacity());
         }
     }
 
-    static bool create_server_cred(const wchar_t* server_name);
+    //Count the current bytes of a buffer, by the side that owns it, in the total.
+    static void count_buffer(volatile LONG64& counted, size_t bytes);
+
+    //Add bytes to the count of buffers that may be allocated by more than one thread, and to the total.
+    static void add_buffer(volatile LONG64& counted, LONG64 bytes);
+
+    //Free the buffers of the socket that are not in use, if it has sent nothing since idle_since.
+    void trim_buffers(ULONGLONG idle_since);
+
+    enum ReceiveFlow {
+        Flowing = 0,
+        Paused,
+        //Paused with a receive held
+        Held
+    };
+
+    enum Backpressure {
+        Clear = 0,
+        //on_backpressure is being called.
+        Raising,
+        Raised
+    };
+
+    static bool is_busy(void* obj);
+
+    static void destroy(void* obj);
+
+    //NOTE: The fields are laid out in regions on separate cache lines:
+    //1) Cold fields that are set up at start/handshake and only read afterwards.
+    //2) Handshake state, written by Interlocked* calls during the handshake and by post-handshake messages only.
+    //3) Receive-side state, written on every receive completion.
+    //4) Send-side state, written on every send completion.
+    //Receive and send completions of a connection may run on different workers at the same time. Keeping
+    //their state apart avoids the cache line bouncing between the two cores, especially by Interlocked* calls.
+    //The new of C++17 aligns the socket to the cache line, see SOCKET_REGION for what it saves.
 
     HANDLE m_iocp;
     SOCKET m_socket;
     IServerSocketHandler* m_handler;
     State m_state = State::Init;
+    ConnectionHandle m_handle;
 
     //The following fields are for TLS
     bool m_tls_enabled;
-    CtxtHandle m_ctx{};
-    SecPkgContext_StreamSizes m_size{};
-
-    std::vector<char> m_buf;
+    My::ITlsSession* m_tls = nullptr;
+    My::TlsSizes m_sizes{};
+    //shutdown has been taken by some thread.
+    volatile long m_shutdown = 0;
+    size_t m_send_low_watermark = default_low_watermark;
+    size_t m_send_high_watermark = default_high_watermark;
+    bool m_stranded = false;
+
+    //Handshake
+    //Handshake sends may overlap, so they're counted by Interlocked*. It's only touched during handshake and by
+    //the rare post-handshake messages of TLS 1.3.
+    SOCKET_REGION volatile long m_handshake_sends = 0;
+    //NOTE: The handshake events and buffers are owned by the connection and reused for every flight, so that a
+    //handshake allocates nothing after the first flight. The receive event is safe to reuse since there's one
+    //receive at a time. The send event is in use until its completion, which may come after the next flight is
+    //ready, when a new event is allocated instead.
+    HandshakeReceiveEvent m_handshake_receive_event;
+    HandshakeSendEvent m_handshake_send_event;
+    volatile long m_handshake_send_busy = 0;
+    HandshakeWorkEvent m_handshake_work_event;
+    //A handshake step is queued on the handshake lane, which keeps a retired socket from being freed.
+    volatile bool m_handshake_queued = false;
+    //The socket is counted in handshakes.
+    volatile long m_in_handshake = 0;
+    //Output of the handshake and of post-handshake messages. It's only used on the receive side.
+    std::vector<char> m_handshake_out;
+    //Bytes of m_handshake_out counted, on the receive side, and of the buffer of m_handshake_send_event, by the
+    //thread that holds m_handshake_send_busy. The buffers are swapped by each flight.
+    size_t m_handshake_out_counted = 0;
+    size_t m_handshake_send_counted = 0;
+    volatile LONG64 m_handshake_buffer_bytes = 0;
+
+    //Receive side
+    SOCKET_REGION std::vector<char> m_buf;
     size_t m_buf_used = 0;
     long m_tls_receiving = 0;
-
-    std::vector<char> m_send_buf;
+    TokenBucket m_receive_bucket;
+    //Time to start the receive held by the rate limit, or 0 if none is held.
+    volatile LONG64 m_receive_release = 0;
+    char* m_paced_receive_buf = nullptr;
+    size_t m_paced_receive_size = 0;
+    //I/O pending in kernel, which keeps a retired socket from being freed. There's at most one receive and one
+    //data send at a time and each flag is only updated by the thread that owns the side, so no atomic is needed.
+    volatile bool m_receive_pending = false;
+    //Deadline of the handshake, or of the next data received, in milliseconds of GetTickCount64.
+    volatile ULONGLONG m_receive_deadline = 0;
+    //A timer of the connection is in the wheel of some thread. It guards both deadlines, and is only written when
+    //a timer is added or expires with no deadline left, which the receive side does far more than the send side.
+    volatile long m_timer_queued = 0;
+    //One of ReceiveFlow, which may be changed from the send side by resume_receive.
+    volatile long m_receive_flow = 0;
+    //The receive held by pause_receive
+    char* m_held_buf = nullptr;
+    size_t m_held_size = 0;
+    volatile LONG64 m_receive_buffer_bytes = 0;
+    //Used in the current turn
+    size_t m_turn_bytes = 0;
+    size_t m_turn_receives = 0;
+    //Receives that have gone pending, and the count when the current turn started
+    volatile long m_receive_waits = 0;
+    long m_turn_waits = 0;
+    //The receive put off by a yield
+    YieldEvent m_yield_event;
+    volatile bool m_yield_queued = false;
+    char* m_yield_buf = nullptr;
+    size_t m_yield_size = 0;
+
+    //Send side
+    SOCKET_REGION std::vector<char> m_send_buf;
     long m_tls_sending = 0;
+    //In milliseconds of GetTickCount64, when a record was last sent or the handshake was done
+    volatile ULONGLONG m_last_send = 0;
+    TokenBucket m_send_bucket;
+    volatile LONG64 m_send_release = 0;
+    const char* m_paced_send_buf = nullptr;
+    size_t m_paced_send_size = 0;
+    volatile bool m_send_pending = false;
+    volatile ULONGLONG m_send_deadline = 0;
+    //Chunks taken from the queue and coalesced into one, and how many were taken. They're only touched by the
+    //thread that sends from the queue.
+    SendChunk* m_send_flight = nullptr;
+    long m_flight_chunks = 0;
+    size_t m_flight_offset = 0;
+    bool m_sending_queue = false;
+    volatile LONG64 m_send_buffer_bytes = 0;
+
+    //NOTE: The send queue is written by queue_send from any thread, so it's on a cache line of its own. Chunks are
+    //pushed to m_send_incoming with no lock and counted by m_queue_chunks. The thread that counts from 0 takes
+    //them as a flight and sends it, and the completion of each flight takes the next, until the count drops to 0
+    //again, the same as Strand. So one thread at a time sends from the queue.
+    SOCKET_REGION SendChunk* volatile m_send_incoming = nullptr;
+    volatile long m_queue_chunks = 0;
+    //The first flight is started on a worker by the event, which keeps a retired socket from being freed.
+    QueueSendEvent m_queue_send_event;
+    volatile bool m_queue_send_queued = false;
+    volatile LONG64 m_send_queued = 0;
+    volatile long m_backpressure = Clear;
+    //Of the chunks
+    volatile LONG64 m_queue_buffer_bytes = 0;
+
+    //Shared by both sides, when the socket has a strand
+    SOCKET_REGION Strand m_strand;
+    //Tasks on the strand, which keeps a retired socket from being freed.
+    volatile long m_tasks = 0;
+
+    static ConnectionRegistry connections;
+
+    static bool zero_copy_send;
+    static HANDLE handshake_lane;
+    static volatile long handshakes;
+    static DWORD handshake_timeout;
+    static DWORD idle_timeout;
+    static DWORD send_timeout;
+    //The shortest timeout set. A timer is never added further than that, so that a deadline set later is not
+    //missed.
+    static DWORD min_timeout;
+    static volatile LONG64 buffer_bytes;
+    static LONG64 buffer_budget;
+    static volatile LONG64 budget_delays;
+    static DWORD trim_idle_ms;
+    static size_t turn_bytes;
+    static size_t turn_receives;
+    static volatile LONG64 yields;
+    static double default_send_rate;
+    static double default_receive_rate;
 
     static bool tls_inited;
-    static PSecurityFunctionTable sspi;
-    static CredHandle tls_cred;
+    static My::ITlsProvider* tls_provider;
+    static My::CredentialTable tls_creds;
     //NOTE: 16KiB is the max size of a TLS message, bigger buf may incur some performance loss 
     //due to moving extra content in m_buf after one message is processed.
     static const int init_buf_size = 1024 * 16;
+    static const size_t default_low_watermark = 1024 * 64;
+    static const size_t default_high_watermark = 1024 * 256;
+    //The burst of a rate limit in milliseconds of its rate
+    static const int rate_burst_ms = 50;
+    //Milliseconds a receive is held when the buffer budget is exhausted, before it's tried again
+    static const int budget_retry_ms = 10;
+    //m_tls_sending while trim_buffers frees m_send_buf
+    static const long trimming = 2;
 };
 
@@ -0,0 +1,33 @@
+#include "Strand.h"
+#include "Event.h"
+
+void Strand::dispatch(Event* event)
+{
+    Event* head;
+    do {
+        head = m_incoming;
+        event->m_next = head;
+    } while (InterlockedCompareExchangePointer((PVOID volatile*)&m_incoming, event, head) != head);
+
+    //NOTE: An event is pushed before it's counted. So whoever runs the strand finds an event in m_ready or
+    //m_incoming for every count, and the one that counts from 0 is the one to run it.
+    if (InterlockedIncrement(&m_pending) != 1) {
+        return;
+    }
+    do {
+        if (!m_ready) {
+            //Take all pushed so far, and reverse them into the order of dispatch.
+            auto p = (Event*)InterlockedExchangePointer((PVOID volatile*)&m_incoming, nullptr);
+            while (p) {
+                auto next = p->m_next;
+                p->m_next = m_ready;
+                m_ready = p;
+                p = next;
+            }
+        }
+        auto current = m_ready;
+        m_ready = current->m_next;
+        current->m_next = nullptr;
+        current->complete();
+    } while (InterlockedDecrement(&m_pending));
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Common.h"
+
+class Event;
+
+//Run events one at a time, in the order they're dispatched, with no lock. An event dispatched to an idle strand
+//runs at once on the thread that dispatches it, which then runs the strand until it's idle again. Events
+//dispatched meanwhile from other threads are queued for it, so those threads never wait.
+//
+//Events are linked by Event::m_next while they're queued, and run by Event::complete.
+class Strand
+{
+public:
+    Strand() {}
+
+    Strand(const Strand&) = delete;
+
+    Strand& operator = (const Strand&) = delete;
+
+    void dispatch(Event* event);
+
+    //There are events dispatched and not done.
+    bool is_busy() const {
+        return m_pending != 0;
+    }
+
+private:
+    //Events dispatched and not done, including the one running
+    volatile long m_pending = 0;
+    //Events pushed by dispatch, in the reverse order
+    Event* volatile m_incoming = nullptr;
+    //Events taken from m_incoming in order, which only the thread running the strand touches
+    Event* m_ready = nullptr;
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "FramePool.h"
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+template <typename T = void>
+class Task;
+
+//The part of the promise of Task that doesn't depend on the result type
+class TaskPromiseBase
+{
+public:
+    //Frames of all tasks are taken from the pool.
+    static void* operator new(size_t size) {
+        return FramePool::allocate(size);
+    }
+
+    static void operator delete(void* p) {
+        FramePool::free(p);
+    }
+
+    //A task doesn't run until it's awaited or started.
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+
+    //Go on with the awaiting coroutine, if any, without growing the stack.
+    struct FinalAwaiter {
+        bool await_ready() noexcept {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            auto continuation = handle.promise().m_continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept {
+        return {};
+    }
+
+    //Exceptions are not used on the I/O path, so an escaped one is a bug.
+    void unhandled_exception() {
+        std::terminate();
+    }
+
+    std::coroutine_handle<> m_continuation;
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+    Task<T> get_return_object();
+
+    void return_value(T value) {
+        m_value = std::move(value);
+    }
+
+    T m_value{};
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+    Task<void> get_return_object();
+
+    void return_void() {}
+};
+
+//A lazy coroutine, which runs when it's awaited by another coroutine, or started. It owns the coroutine frame.
+template <typename T>
+class Task
+{
+public:
+    typedef TaskPromise<T> promise_type;
+
+    Task() {}
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+    Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+
+    Task& operator = (Task&& other) noexcept {
+        if (this != &other) {
+            if (m_handle) {
+                m_handle.destroy();
+            }
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+
+    Task& operator = (const Task&) = delete;
+
+    ~Task() {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    //Run a task that no one awaits, until it's suspended.
+    void start() {
+        m_handle.resume();
+    }
+
+    bool done() const {
+        return !m_handle || m_handle.done();
+    }
+
+    struct Awaiter {
+        bool await_ready() noexcept {
+            return !handle || handle.done();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            handle.promise().m_continuation = awaiting;
+            return handle;
+        }
+
+        T await_resume() {
+            if constexpr (!std::is_void_v<T>) {
+                return std::move(handle.promise().m_value);
+            }
+        }
+
+        std::coroutine_handle<promise_type> handle;
+    };
+
+    Awaiter operator co_await() noexcept {
+        return Awaiter{ m_handle };
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
@@ -0,0 +1,93 @@
+#include "TimerWheel.h"
+
+namespace {
+    const ULONGLONG level0_size = 1ull << TimerWheel::level0_bits;
+    const ULONGLONG level_size = 1ull << TimerWheel::level_bits;
+    const ULONGLONG level0_mask = level0_size - 1;
+    const ULONGLONG level_mask = level_size - 1;
+    //Ticks covered by levels 0 and 1
+    const ULONGLONG level1_span = level0_size * level_size;
+    const ULONGLONG level2_span = level1_span * level_size;
+    const size_t level1_shift = TimerWheel::level0_bits;
+    const size_t level2_shift = TimerWheel::level0_bits + TimerWheel::level_bits;
+}
+
+thread_local TimerWheel* TimerWheel::current = nullptr;
+
+TimerWheel::TimerWheel(ULONGLONG now, ULONGLONG tick_ms) : m_tick_ms(tick_ms), m_tick(now / tick_ms)
+{
+    m_levels[0].resize(level0_size);
+    m_levels[1].resize(level_size);
+    m_levels[2].resize(level_size);
+}
+
+void TimerWheel::add(uint64_t key, ULONGLONG deadline)
+{
+    auto tick = (deadline + m_tick_ms - 1) / m_tick_ms;
+    //The slot of the current tick has been expired.
+    if (tick <= m_tick) {
+        tick = m_tick + 1;
+    }
+    add_at(key, tick);
+    m_size++;
+}
+
+void TimerWheel::add_at(uint64_t key, ULONGLONG tick)
+{
+    //NOTE: A timer cascaded may be due at the current tick, whose slot is expired right after cascading.
+    auto delta = tick - m_tick;
+    if (delta < level0_size) {
+        m_levels[0][tick & level0_mask].push_back({ key, tick });
+    }
+    else if (delta < level1_span) {
+        m_levels[1][(tick >> level1_shift) & level_mask].push_back({ key, tick });
+    }
+    else {
+        //NOTE: A timer beyond the span of the wheel is put in the farthest slot, and added again from there.
+        if (delta >= level2_span) {
+            tick = m_tick + level2_span - 1;
+        }
+        m_levels[2][(tick >> level2_shift) & level_mask].push_back({ key, tick });
+    }
+}
+
+void TimerWheel::cascade(std::vector<Slot>& level, size_t index)
+{
+    m_expiring.clear();
+    m_expiring.swap(level[index]);
+    for (auto& timer : m_expiring) {
+        add_at(timer.key, timer.tick);
+    }
+}
+
+size_t TimerWheel::advance(ULONGLONG now, ExpireFunc expire)
+{
+    size_t expired = 0;
+    auto target = now / m_tick_ms;
+    while (m_tick < target) {
+        m_tick++;
+        //When a round of a level is done, the timers in the next slot of the level above come down.
+        if (!(m_tick & level0_mask)) {
+            if (!((m_tick >> level1_shift) & level_mask)) {
+                cascade(m_levels[2], (m_tick >> level2_shift) & level_mask);
+            }
+            cascade(m_levels[1], (m_tick >> level1_shift) & level_mask);
+        }
+
+        auto& slot = m_levels[0][m_tick & level0_mask];
+        if (slot.empty()) {
+            continue;
+        }
+        m_expiring.clear();
+        m_expiring.swap(slot);
+        for (auto& timer : m_expiring) {
+            m_size--;
+            expired++;
+            auto deadline = expire(timer.key, now);
+            if (deadline > now) {
+                add(timer.key, deadline);
+            }
+        }
+    }
+    return expired;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Common.h"
+#include <cstdint>
+#include <vector>
+
+//A hierarchical timing wheel of three levels, in ticks of tick_ms. Level 0 has a slot per tick for the next 256
+//ticks, and each slot of level 1 and 2 covers a whole round of the level below, where timers are moved down
+//(cascaded) when their slot comes. A timer is just a key and a tick in the slot, so adding one is O(1) and takes
+//16 bytes. Due timers are expired a slot at a time.
+//
+//There's no cancel. Instead, the owner of a key keeps its own deadline, and expire tells what it is when a timer
+//of the key is due. It's 0 if the timer has been cancelled, or a later time if it has been pushed back, when the
+//timer is added again. So arming and cancelling by the owner are plain stores, which is what a timer touched on
+//every I/O needs, at the cost of some timers visiting the wheel more than once.
+//
+//A wheel is used by one thread only, and each IOCP worker has its own, see current.
+class TimerWheel
+{
+public:
+    //Return the deadline of key in milliseconds, or 0 to drop the timer. A deadline after now adds it again.
+    typedef ULONGLONG (*ExpireFunc)(uint64_t key, ULONGLONG now);
+
+    static const size_t level0_bits = 8;
+    static const size_t level_bits = 6;
+
+    TimerWheel(ULONGLONG now, ULONGLONG tick_ms);
+
+    TimerWheel(const TimerWheel&) = delete;
+
+    TimerWheel& operator = (const TimerWheel&) = delete;
+
+    //deadline is in milliseconds. It's rounded up to a tick, and a deadline already passed is due at next tick.
+    void add(uint64_t key, ULONGLONG deadline);
+
+    //Expire the timers due by now. It's cheap to call often, since nothing is done until the next tick.
+    //Return the number of timers expired.
+    size_t advance(ULONGLONG now, ExpireFunc expire);
+
+    size_t size() const {
+        return m_size;
+    }
+
+    //The wheel of the current thread, or nullptr if it has none.
+    static thread_local TimerWheel* current;
+
+private:
+    struct Timer {
+        uint64_t key;
+        ULONGLONG tick;
+    };
+
+    typedef std::vector<Timer> Slot;
+
+    void add_at(uint64_t key, ULONGLONG tick);
+
+    void cascade(std::vector<Slot>& level, size_t index);
+
+    ULONGLONG m_tick_ms;
+    //The last tick that has been expired
+    ULONGLONG m_tick;
+    size_t m_size = 0;
+    std::vector<Slot> m_levels[3];
+    //Timers being expired or cascaded are moved here, so that the slot may take new ones in the meantime.
+    Slot m_expiring;
+};
@@ -0,0 +1,28 @@
+#include "TokenBucket.h"
+#include <cmath>
+
+void TokenBucket::reset(double rate, double burst, ULONGLONG now)
+{
+    m_rate = rate / 1000;
+    m_burst = burst < 1 ? 1 : burst;
+    m_tokens = m_burst;
+    m_last_refill = now;
+}
+
+double TokenBucket::get_tokens(ULONGLONG now)
+{
+    if (now > m_last_refill) {
+        m_tokens += (now - m_last_refill) * m_rate;
+        if (m_tokens > m_burst) {
+            m_tokens = m_burst;
+        }
+        m_last_refill = now;
+    }
+    return m_tokens;
+}
+
+ULONGLONG TokenBucket::get_wait(ULONGLONG now)
+{
+    auto tokens = get_tokens(now);
+    return tokens >= 0 ? 0 : (ULONGLONG)ceil(-tokens / m_rate);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Common.h"
+
+//A token bucket, which fills at rate up to burst tokens. Tokens may be taken beyond what's in it, which leaves
+//the bucket in debt until it's filled again, so that a request of any size goes at once and the rate still holds
+//over time.
+//
+//It's not thread safe. It's used by one thread at a time.
+class TokenBucket
+{
+public:
+    TokenBucket() {}
+
+    //rate is in tokens per second, where 0 means no limit. burst is at least 1 when rate is limited.
+    TokenBucket(double rate, double burst, ULONGLONG now) {
+        reset(rate, burst, now);
+    }
+
+    void reset(double rate, double burst, ULONGLONG now);
+
+    bool is_limited() const {
+        return m_rate > 0;
+    }
+
+    //Tokens in the bucket at now, which may be negative.
+    double get_tokens(ULONGLONG now);
+
+    //Milliseconds from now until the bucket is out of debt, or 0 if it's not in debt.
+    ULONGLONG get_wait(ULONGLONG now);
+
+    void take(double tokens) {
+        m_tokens -= tokens;
+    }
+
+private:
+    //Tokens per millisecond
+    double m_rate = 0;
+    double m_burst = 0;
+    double m_tokens = 0;
+    ULONGLONG m_last_refill = 0;
+};
@@ -0,0 +1,416 @@
+//Tests of NameIndex, CertificateIndex and ClientHello, which have no dependency on Windows. On other platforms, build and run it by
+//  g++ -std=c++17 NameIndexTest/Main.cpp SecureSocket/ClientHello.cpp && ./a.out
+//from the root of the repository. It prints the failed checks and exits with 1 if any.
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../SecureSocket/NameIndex.h"
+#include "../SecureSocket/CertificateIndex.h"
+#include "../SecureSocket/ClientHello.h"
+
+using My::NameIndex;
+using My::CertificateIndex;
+using My::ClientHello;
+
+int g_failures = 0;
+
+#define CHECK(expr) check(expr, #expr, __LINE__)
+
+void check(bool ok, const char* expr, int line) {
+    if (!ok) {
+        printf("FAILED at line %d: %s\n", line, expr);
+        g_failures++;
+    }
+}
+
+//Like CredentialTable, where the first credential added for a name wins.
+struct KeepFirst {
+    bool operator () (int, int) const {
+        return false;
+    }
+};
+
+//Certificates are numbered in tests.
+typedef CertificateIndex<int> CertIndex;
+
+//Return the value found for name, or -1.
+int find(const NameIndex<int, KeepFirst>& index, const wchar_t* name) {
+    auto value = index.find(name);
+    return value ? *value : -1;
+}
+
+void test_exact() {
+    NameIndex<int, KeepFirst> index;
+    CHECK(find(index, L"example.com") == -1);
+    index.add(L"example.com", 1);
+    index.add(L"WWW.Example.COM", 2);
+    index.add(L"fqdn.example.com.", 3);
+    index.add(L"", 4);
+    CHECK(index.size() == 3);
+    CHECK(find(index, L"example.com") == 1);
+    CHECK(find(index, L"EXAMPLE.com") == 1);
+    CHECK(find(index, L"example.com.") == 1);
+    CHECK(find(index, L"www.example.com") == 2);
+    CHECK(find(index, L"Www.Example.Com.") == 2);
+    CHECK(find(index, L"fqdn.example.com") == 3);
+    CHECK(find(index, L"fqdn.example.com.") == 3);
+    CHECK(find(index, L"") == -1);
+    CHECK(find(index, L"example.org") == -1);
+    CHECK(find(index, L"ww.example.com") == -1);
+    CHECK(find(index, L"example.com..") == -1);
+}
+
+void test_wildcard() {
+    NameIndex<int, KeepFirst> index;
+    index.add(L"*.Example.com", 1);
+    index.add(L"www.example.com", 2);
+    index.add(L"*.sub.example.com.", 3);
+    //An exact name is preferred to a wildcard one.
+    CHECK(find(index, L"www.example.com") == 2);
+    CHECK(find(index, L"mail.example.com") == 1);
+    CHECK(find(index, L"MAIL.EXAMPLE.COM.") == 1);
+    //Exactly one label in the leftmost position
+    CHECK(find(index, L"example.com") == -1);
+    CHECK(find(index, L"a.b.example.com") == -1);
+    CHECK(find(index, L"a.sub.example.com") == 3);
+    CHECK(find(index, L"sub.example.com") == 1);
+    //No empty label
+    CHECK(find(index, L".example.com") == -1);
+    CHECK(find(index, L"com") == -1);
+    CHECK(find(index, L"com.") == -1);
+    //A wildcard name looked up is just a name, which matches itself.
+    CHECK(find(index, L"*.example.com") == 1);
+    CHECK(find(index, L"*.example.org") == -1);
+}
+
+void test_keep_first() {
+    NameIndex<int, KeepFirst> index;
+    index.add(L"example.com", 1);
+    index.add(L"EXAMPLE.COM", 2);
+    index.add(L"example.com.", 3);
+    index.add(L"*.example.com", 4);
+    index.add(L"*.EXAMPLE.com", 5);
+    CHECK(index.size() == 2);
+    CHECK(find(index, L"example.com") == 1);
+    CHECK(find(index, L"www.example.com") == 4);
+    index.clear();
+    CHECK(index.size() == 0);
+    CHECK(find(index, L"example.com") == -1);
+}
+
+void test_better() {
+    //The result doesn't depend on the order of adds.
+    for (auto reverse : { false, true }) {
+        //Certificate 1 has expired at 250, and 4 expires first.
+        std::vector<CertIndex::Entry> certs = { { 1, 200, true }, { 2, 400, false }, { 3, 500, false }, { 4, 300, false } };
+        if (reverse) {
+            certs.assign(certs.rbegin(), certs.rend());
+        }
+        NameIndex<CertIndex::Entry, CertIndex::Better> index;
+        for (auto& cert : certs) {
+            index.add(L"example.com", cert);
+        }
+        auto cert = index.find(L"Example.Com");
+        CHECK(cert && cert->cert == 3);
+    }
+    //An expired certificate is still taken when there's no other.
+    NameIndex<CertIndex::Entry, CertIndex::Better> index;
+    index.add(L"*.example.com", { 1, 100, true });
+    index.add(L"*.example.com", { 2, 50, true });
+    auto cert = index.find(L"www.example.com");
+    CHECK(cert && cert->cert == 1 && cert->expired);
+}
+
+void test_validity() {
+    CHECK(CertIndex::validity(99, 100, 200) == -1);
+    CHECK(CertIndex::validity(100, 100, 200) == 0);
+    CHECK(CertIndex::validity(200, 100, 200) == 0);
+    CHECK(CertIndex::validity(201, 100, 200) == 1);
+}
+
+//A stand-in for a certificate store in a file, like Certificate::use_store_file, with a line for each certificate:
+//  <number> <not before> <not after> <name>...
+//It's read again whenever the index is stale, like Certificate reads its store.
+class StoreFile
+{
+public:
+    explicit StoreFile(const std::string& path) : m_path(path) {}
+
+    //Return the number of the certificate for name at now, or -1.
+    int get(const wchar_t* name, uint64_t now) {
+        if (m_index.is_stale(now)) {
+            build(now);
+        }
+        auto entry = m_index.find(name);
+        return entry ? entry->cert : -1;
+    }
+
+    void invalidate() {
+        m_index.invalidate();
+    }
+
+    int builds() const {
+        return m_builds;
+    }
+
+    const CertIndex& index() const {
+        return m_index;
+    }
+
+private:
+    void build(uint64_t now) {
+        m_index.begin(now);
+        std::ifstream file(m_path);
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream fields(line);
+            int number;
+            uint64_t not_before, not_after;
+            if (!(fields >> number >> not_before >> not_after)) {
+                continue;
+            }
+            auto entry = m_index.add_cert(number, not_before, not_after);
+            std::string name;
+            while (fields >> name) {
+                m_index.add_name(std::wstring(name.begin(), name.end()), entry);
+            }
+        }
+        m_index.end();
+        m_builds++;
+    }
+
+    std::string m_path;
+    CertIndex m_index;
+    int m_builds = 0;
+};
+
+void write_store(const std::string& path, const char* content) {
+    std::ofstream file(path, std::ios::trunc);
+    file << content;
+}
+
+void test_store_file() {
+    std::string path = "NameIndexTest.store";
+    //1 is the current certificate of example.com, renewed by 2 from 150. 3 is a wildcard one which expires at 120,
+    //and 4 is a wildcard one not valid before 300.
+    write_store(path,
+        "1 0 200 example.com www.example.com\n"
+        "2 150 400 example.com www.example.com\n"
+        "3 0 120 *.example.com\n"
+        "4 300 600 *.example.com\n");
+    StoreFile store(path);
+    CHECK(store.get(L"www.example.com", 100) == 1);
+    CHECK(store.get(L"api.example.com", 100) == 3);
+    CHECK(store.builds() == 1);
+    //Until 3 expires, nothing changes.
+    CHECK(store.index().next_refresh() == 120);
+    CHECK(store.get(L"example.com", 119) == 1);
+    CHECK(store.builds() == 1);
+    //3 has expired and 4 is not valid yet. Neither is valid, so the one which expires later wins.
+    CHECK(store.get(L"api.example.com", 121) == 4);
+    CHECK(store.builds() == 2);
+    CHECK(store.index().next_refresh() == 150);
+    //2 becomes valid, and wins for its later expiry.
+    CHECK(store.get(L"example.com", 150) == 2);
+    CHECK(store.builds() == 3);
+    CHECK(store.index().next_refresh() == 200);
+    //1 expires, then 4 becomes valid.
+    CHECK(store.get(L"www.example.com", 250) == 2);
+    CHECK(store.index().next_refresh() == 300);
+    CHECK(store.get(L"api.example.com", 300) == 4);
+    CHECK(store.index().next_refresh() == 400);
+    CHECK(store.builds() == 5);
+    //All have expired, so there's nothing to wait for, and the one which expired last wins.
+    CHECK(store.get(L"example.com", 700) == 2);
+    CHECK(store.get(L"api.example.com", 700) == 4);
+    CHECK(store.index().next_refresh() == UINT64_MAX);
+    CHECK(store.builds() == 6);
+
+    //Changes to the file are seen after invalidate.
+    write_store(path, "5 0 1000 example.com\n");
+    CHECK(store.get(L"example.com", 700) == 2);
+    store.invalidate();
+    CHECK(store.get(L"example.com", 700) == 5);
+    CHECK(store.get(L"www.example.com", 700) == -1);
+    CHECK(store.index().size() == 1);
+    std::remove(path.c_str());
+}
+
+typedef std::vector<unsigned char> Bytes;
+
+void put16(Bytes& b, size_t v) {
+    b.push_back((unsigned char)(v >> 8));
+    b.push_back((unsigned char)v);
+}
+
+void put24(Bytes& b, size_t v) {
+    b.push_back((unsigned char)(v >> 16));
+    put16(b, v);
+}
+
+Bytes server_name_extension(const std::string& host, unsigned char name_type = 0) {
+    Bytes list;
+    list.push_back(name_type);
+    put16(list, host.size());
+    list.insert(list.end(), host.begin(), host.end());
+    Bytes ext;
+    put16(ext, 0);
+    put16(ext, list.size() + 2);
+    put16(ext, list.size());
+    ext.insert(ext.end(), list.begin(), list.end());
+    return ext;
+}
+
+//A ClientHello in one record, with extensions as they are, or none if extensions is nullptr.
+Bytes client_hello(const Bytes* extensions) {
+    Bytes body;
+    put16(body, 0x0303);
+    body.insert(body.end(), 32, 0xAB);
+    //session_id
+    body.push_back(32);
+    body.insert(body.end(), 32, 0xCD);
+    //cipher_suites
+    put16(body, 4);
+    put16(body, 0x1301);
+    put16(body, 0xC02F);
+    //compression_methods
+    body.push_back(1);
+    body.push_back(0);
+    if (extensions) {
+        put16(body, extensions->size());
+        body.insert(body.end(), extensions->begin(), extensions->end());
+    }
+    Bytes handshake;
+    handshake.push_back(1);
+    put24(handshake, body.size());
+    handshake.insert(handshake.end(), body.begin(), body.end());
+    Bytes record = { 22, 3, 1 };
+    put16(record, handshake.size());
+    record.insert(record.end(), handshake.begin(), handshake.end());
+    return record;
+}
+
+Bytes client_hello(const std::string& host) {
+    Bytes extensions;
+    //Another extension before SNI, supported_versions
+    put16(extensions, 43);
+    put16(extensions, 3);
+    extensions.push_back(2);
+    put16(extensions, 0x0304);
+    auto sni = server_name_extension(host);
+    extensions.insert(extensions.end(), sni.begin(), sni.end());
+    return client_hello(&extensions);
+}
+
+ClientHello::Result peek(const Bytes& b, std::wstring& name, size_t size) {
+    return ClientHello::peek_server_name((const char*)b.data(), size, name);
+}
+
+ClientHello::Result peek(const Bytes& b, std::wstring& name) {
+    return peek(b, name, b.size());
+}
+
+void test_client_hello() {
+    std::wstring name;
+    auto hello = client_hello("www.example.com");
+    CHECK(peek(hello, name) == ClientHello::Result::Found && name == L"www.example.com");
+    //Any bytes after the record, like the next record, don't matter.
+    auto more = hello;
+    more.insert(more.end(), 10, 0);
+    CHECK(peek(more, name) == ClientHello::Result::Found && name == L"www.example.com");
+    for (size_t size = 0; size < hello.size(); size++) {
+        CHECK(peek(hello, name, size) == ClientHello::Result::Incomplete && name.empty());
+    }
+
+    CHECK(peek(client_hello(nullptr), name) == ClientHello::Result::NotFound);
+    Bytes no_sni;
+    put16(no_sni, 43);
+    put16(no_sni, 0);
+    CHECK(peek(client_hello(&no_sni), name) == ClientHello::Result::NotFound);
+    //A name type other than host_name is skipped.
+    auto other_type = server_name_extension("x", 1);
+    CHECK(peek(client_hello(&other_type), name) == ClientHello::Result::NotFound);
+
+    //A host name of 255 bytes at most, in printable ASCII
+    CHECK(peek(client_hello(std::string(255, 'a')), name) == ClientHello::Result::Found && name.size() == 255);
+    CHECK(peek(client_hello(std::string(256, 'a')), name) == ClientHello::Result::Invalid);
+    CHECK(peek(client_hello(""), name) == ClientHello::Result::Invalid);
+    CHECK(peek(client_hello("www example.com"), name) == ClientHello::Result::Invalid && name.empty());
+    CHECK(peek(client_hello("www.\x80xample.com"), name) == ClientHello::Result::Invalid && name.empty());
+}
+
+void test_malformed_client_hello() {
+    std::wstring name;
+    auto hello = client_hello("www.example.com");
+    const size_t record_header_size = 5;
+    const size_t handshake_header_size = 4;
+
+    auto b = hello;
+    //Not a handshake record, like application_data
+    b[0] = 23;
+    CHECK(peek(b, name) == ClientHello::Result::Invalid);
+    b = hello;
+    b[1] = 2;
+    CHECK(peek(b, name) == ClientHello::Result::Invalid);
+    //Not a ClientHello, like a ServerHello
+    b = hello;
+    b[record_header_size] = 2;
+    CHECK(peek(b, name) == ClientHello::Result::Invalid);
+    //A ClientHello longer than the record is fragmented, and taken as one without SNI.
+    b = hello;
+    b[record_header_size + 1] = 1;
+    CHECK(peek(b, name) == ClientHello::Result::NotFound);
+    //Too short for the version and random
+    b = hello;
+    b[record_header_size + 3] = 10;
+    CHECK(peek(b, name) == ClientHello::Result::Invalid);
+    //A session_id longer than the rest
+    b = hello;
+    b[record_header_size + handshake_header_size + 34] = 0xFF;
+    CHECK(peek(b, name) == ClientHello::Result::Invalid);
+
+    //The length of the extensions, or of one, past the end
+    Bytes ext;
+    put16(ext, 0);
+    put16(ext, 100);
+    put16(ext, 0);
+    CHECK(peek(client_hello(&ext), name) == ClientHello::Result::Invalid);
+    auto sni = server_name_extension("www.example.com");
+    //The length of the server name list
+    sni[5] += 1;
+    CHECK(peek(client_hello(&sni), name) == ClientHello::Result::Invalid);
+    sni = server_name_extension("www.example.com");
+    //The length of the host name
+    sni[8] += 1;
+    CHECK(peek(client_hello(&sni), name) == ClientHello::Result::Invalid);
+    //A truncated extension header
+    Bytes half = { 0 };
+    CHECK(peek(client_hello(&half), name) == ClientHello::Result::Invalid);
+    //The length of the extensions past the end
+    b = client_hello(nullptr);
+    b.push_back(0);
+    b.push_back(5);
+    b[3] = (unsigned char)((b.size() - record_header_size) >> 8);
+    b[4] = (unsigned char)(b.size() - record_header_size);
+    b[record_header_size + 3] += 2;
+    CHECK(peek(b, name) == ClientHello::Result::Invalid);
+}
+
+int main() {
+    test_exact();
+    test_wildcard();
+    test_keep_first();
+    test_better();
+    test_validity();
+    test_store_file();
+    test_client_hello();
+    test_malformed_client_hello();
+    if (g_failures) {
+        printf("%d check(s) failed.\n", g_failures);
+        return 1;
+    }
+    printf("All checks passed.\n");
+    return 0;
+}
@@ -0,0 +1,252 @@
+//Tests of OpenSslTlsSession, with a server and a client session talking to each other over memory buffers. It has
+//no dependency on Windows. On other platforms, build and run it by
+//  g++ -std=c++17 -DMY_TLS_OPENSSL OpenSslTlsTest/Main.cpp SecureSocket/OpenSslTls.cpp SecureSocket/SessionCache.cpp SecureSocket/Log.cpp -lssl -lcrypto && ./a.out
+//from the root of the repository. It prints the failed checks and exits with 1 if any.
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include "../SecureSocket/OpenSslTls.h"
+
+using My::ITlsSession;
+using My::TlsStatus;
+using My::OpenSslTlsProvider;
+
+int g_failures = 0;
+
+#define CHECK(expr) check(expr, #expr, __LINE__)
+
+void check(bool ok, const char* expr, int line) {
+    if (!ok) {
+        printf("FAILED at line %d: %s\n", line, expr);
+        g_failures++;
+    }
+}
+
+const char* cert_file = "OpenSslTlsTest.cert.pem";
+const char* key_file = "OpenSslTlsTest.key.pem";
+
+//Write a self-signed certificate of a P-256 key for localhost, valid for a day.
+bool write_certificate() {
+    EVP_PKEY* key = nullptr;
+    auto ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    bool ok = ctx && EVP_PKEY_keygen_init(ctx) == 1 &&
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1) == 1 &&
+        EVP_PKEY_keygen(ctx, &key) == 1;
+    EVP_PKEY_CTX_free(ctx);
+    auto cert = ok ? X509_new() : nullptr;
+    if (cert) {
+        X509_set_version(cert, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 60 * 60);
+        auto name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        X509_set_pubkey(cert, key);
+        ok = X509_sign(cert, key, EVP_sha256()) > 0;
+    }
+    if (ok) {
+        auto out = BIO_new_file(cert_file, "w");
+        ok = out && PEM_write_bio_X509(out, cert) == 1;
+        BIO_free(out);
+    }
+    if (ok) {
+        auto out = BIO_new_file(key_file, "w");
+        ok = out && PEM_write_bio_PrivateKey(out, key, nullptr, nullptr, 0, nullptr, nullptr) == 1;
+        BIO_free(out);
+    }
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return ok;
+}
+
+typedef std::vector<char> Bytes;
+
+//Bytes in flight to one side, which it consumes from the front.
+void consume(Bytes& in, size_t consumed) {
+    in.erase(in.begin(), in.begin() + consumed);
+}
+
+void append(Bytes& to, const Bytes& from) {
+    to.insert(to.end(), from.begin(), from.end());
+}
+
+//Run the handshake until both are done, with what one sends to the other as is. Return false on error.
+bool handshake(ITlsSession& client, ITlsSession& server, Bytes& to_client, Bytes& to_server) {
+    size_t consumed;
+    if (client.handshake(nullptr, 0, consumed, to_server) != TlsStatus::Continue) {
+        return false;
+    }
+    bool client_done = false;
+    bool server_done = false;
+    //A full handshake takes two round trips at most.
+    for (int i = 0; i < 4 && !(client_done && server_done); i++) {
+        if (!server_done && !to_server.empty()) {
+            Bytes out;
+            auto status = server.handshake(to_server.data(), to_server.size(), consumed, out);
+            consume(to_server, consumed);
+            append(to_client, out);
+            if (status == TlsStatus::Error) {
+                return false;
+            }
+            server_done = (status == TlsStatus::Ok);
+        }
+        if (!client_done && !to_client.empty()) {
+            Bytes out;
+            auto status = client.handshake(to_client.data(), to_client.size(), consumed, out);
+            consume(to_client, consumed);
+            append(to_server, out);
+            if (status == TlsStatus::Error) {
+                return false;
+            }
+            client_done = (status == TlsStatus::Ok);
+        }
+    }
+    return client_done && server_done;
+}
+
+//Decrypt all that's in flight to a session, like tickets after the handshake and then data, until it needs more.
+//Return the plain text, and the last status.
+TlsStatus receive(ITlsSession& session, Bytes& in, Bytes& to_peer, std::string& plain) {
+    TlsStatus status;
+    do {
+        char buf[16 * 1024];
+        size_t consumed, written;
+        status = session.decrypt(in.data(), in.size(), consumed, buf, sizeof(buf), written, to_peer);
+        consume(in, consumed);
+        plain.append(buf, written);
+    } while (status == TlsStatus::Ok || status == TlsStatus::Continue);
+    return status;
+}
+
+bool send(ITlsSession& session, const std::string& plain, Bytes& to_peer) {
+    auto& sizes = session.get_sizes();
+    for (size_t offset = 0; offset < plain.size(); offset += sizes.max_payload()) {
+        auto size = std::min(plain.size() - offset, sizes.max_payload());
+        Bytes record(sizes.header + size + sizes.trailer);
+        size_t written;
+        if (!session.encrypt(plain.data() + offset, size, record.data(), record.size(), written)) {
+            return false;
+        }
+        record.resize(written);
+        append(to_peer, record);
+    }
+    return true;
+}
+
+//Connect a client of server_name, echo a message of size bytes, and shut down from the client. Return whether the
+//session is resumed, or -1 on failure.
+int connect_and_echo(OpenSslTlsProvider& provider, const wchar_t* server_name, size_t size) {
+    std::unique_ptr<ITlsSession> client(provider.create_client_session(server_name));
+    std::unique_ptr<ITlsSession> server(provider.create_server_session());
+    CHECK(client && server);
+    if (!client || !server) {
+        return -1;
+    }
+    Bytes to_client, to_server;
+    bool ok = handshake(*client, *server, to_client, to_server);
+    CHECK(ok);
+    if (!ok) {
+        return -1;
+    }
+    CHECK(client->is_tls13() && server->is_tls13());
+    CHECK(client->is_resumed() == server->is_resumed());
+
+    //The server echoes what it receives. A message longer than a record takes more than one.
+    std::string message;
+    for (size_t i = 0; i < size; i++) {
+        message.push_back((char)('a' + i % 26));
+    }
+    CHECK(send(*client, message, to_server));
+    std::string received;
+    CHECK(receive(*server, to_server, to_client, received) == TlsStatus::Incomplete);
+    CHECK(received == message);
+    CHECK(send(*server, received, to_client));
+    std::string echoed;
+    //The client takes in the tickets before the echo, if any.
+    CHECK(receive(*client, to_client, to_server, echoed) == TlsStatus::Incomplete);
+    CHECK(echoed == message);
+
+    //close_notify from the client, and the one in response from the server
+    CHECK(client->shutdown(to_server));
+    std::string none;
+    CHECK(receive(*server, to_server, to_client, none) == TlsStatus::Closed);
+    CHECK(server->shutdown(to_client));
+    CHECK(receive(*client, to_client, to_server, none) == TlsStatus::Closed);
+    CHECK(none.empty());
+    return server->is_resumed() ? 1 : 0;
+}
+
+void test_tickets() {
+    OpenSslTlsProvider provider;
+    CHECK(provider.init_server(cert_file, key_file));
+    CHECK(provider.init_client());
+    auto& cache = OpenSslTlsProvider::get_server_sessions();
+    auto hits = cache.get_hits();
+    CHECK(connect_and_echo(provider, L"tickets.localhost", 100) == 0);
+    CHECK(connect_and_echo(provider, L"tickets.localhost", 100 * 1024) == 1);
+    //It's resumed by the ticket itself, without the cache.
+    CHECK(cache.get_hits() == hits);
+    //No session is kept for a client without a server name.
+    CHECK(connect_and_echo(provider, nullptr, 1) == 0);
+    CHECK(connect_and_echo(provider, nullptr, 1) == 0);
+}
+
+void test_ticket_keys() {
+    OpenSslTlsProvider provider;
+    CHECK(provider.init_server(cert_file, key_file));
+    CHECK(provider.init_client());
+    CHECK(connect_and_echo(provider, L"keys.localhost", 100) == 0);
+    //A ticket of the previous key is still taken, and the client gets one of the current key.
+    CHECK(provider.rotate_ticket_keys());
+    CHECK(connect_and_echo(provider, L"keys.localhost", 100) == 1);
+    CHECK(provider.rotate_ticket_keys());
+    CHECK(connect_and_echo(provider, L"keys.localhost", 100) == 1);
+    //A ticket of a key rotated out is not, so it's a full handshake.
+    CHECK(provider.rotate_ticket_keys());
+    CHECK(provider.rotate_ticket_keys());
+    CHECK(connect_and_echo(provider, L"keys.localhost", 100) == 0);
+    CHECK(connect_and_echo(provider, L"keys.localhost", 100) == 1);
+
+    //Nor is a ticket of another server.
+    OpenSslTlsProvider other;
+    CHECK(other.init_server(cert_file, key_file));
+    CHECK(other.init_client());
+    CHECK(connect_and_echo(other, L"keys.localhost", 100) == 0);
+}
+
+void test_session_ids() {
+    OpenSslTlsProvider provider;
+    CHECK(provider.init_server(cert_file, key_file, false));
+    CHECK(provider.init_client());
+    auto& cache = OpenSslTlsProvider::get_server_sessions();
+    auto hits = cache.get_hits();
+    CHECK(connect_and_echo(provider, L"ids.localhost", 100) == 0);
+    CHECK(cache.size() > 0);
+    CHECK(connect_and_echo(provider, L"ids.localhost", 100) == 1);
+    CHECK(cache.get_hits() == hits + 1);
+}
+
+int main() {
+    if (!write_certificate()) {
+        printf("Creating a certificate failed.\n");
+        return 1;
+    }
+    test_tickets();
+    test_ticket_keys();
+    test_session_ids();
+    std::remove(cert_file);
+    std::remove(key_file);
+    if (g_failures) {
+        printf("%d check(s) failed.\n", g_failures);
+        return 1;
+    }
+    printf("All checks passed.\n");
+    return 0;
+}
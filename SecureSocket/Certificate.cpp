@@ -3,34 +3,221 @@
 
 #pragma comment(lib, "Crypt32.lib")
 
-//TODO: Save a (name, cert_context) pair in a map and find a name in the map first.
+SRWLOCK My::Certificate::lock = SRWLOCK_INIT;
+HCERTSTORE My::Certificate::store = nullptr;
+HANDLE My::Certificate::store_changed = nullptr;
+std::vector<PCCERT_CONTEXT> My::Certificate::certs;
+std::wstring My::Certificate::store_file;
+My::Certificate::Index My::Certificate::index;
+
+static uint64_t to_time(const FILETIME& time)
+{
+    return ((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime;
+}
+
+static uint64_t now()
+{
+    FILETIME time;
+    GetSystemTimeAsFileTime(&time);
+    return to_time(time);
+}
+
 PCCERT_CONTEXT My::Certificate::get(const wchar_t * name)
 {
-    //NOTE: For UNICODE, AsCertOpenStore virtually has only an "A" version API while
-    //CertFindCertificateInStore has only a "W" version!
-    auto store = CertOpenStore(
-        CERT_STORE_PROV_SYSTEM_A,
-        0,
-        0,
-        CERT_STORE_OPEN_EXISTING_FLAG | CERT_STORE_READONLY_FLAG | CERT_SYSTEM_STORE_LOCAL_MACHINE,
-        "My"
-    );
-    if (!store) {
-        Log::error("CertOpenStore failed with error: ", GetLastError());
+    if (!name) {
         return nullptr;
     }
-    //NOTE:
-    //1) Wildcard subject and Subject Alternative Name are not supported!
-    //2) There may be multiple certificates matching the subject name. We don't
-    //   try to get the best one. For example, some may be expired while some not.
-    auto cert = CertFindCertificateInStore(
-        store,
-        PKCS_7_ASN_ENCODING | X509_ASN_ENCODING,
-        0,
-        CERT_FIND_SUBJECT_STR,
-        name,
-        nullptr
-    );
-    CertCloseStore(store, 0);
+    PCCERT_CONTEXT cert = nullptr;
+    AcquireSRWLockShared(&lock);
+    bool stale = is_stale();
+    if (!stale) {
+        auto entry = index.find(name);
+        if (entry) {
+            cert = CertDuplicateCertificateContext(entry->cert);
+        }
+    }
+    ReleaseSRWLockShared(&lock);
+    if (!stale) {
+        return cert;
+    }
+
+    AcquireSRWLockExclusive(&lock);
+    if (refresh_when_necessary()) {
+        auto entry = index.find(name);
+        if (entry) {
+            cert = CertDuplicateCertificateContext(entry->cert);
+        }
+    }
+    ReleaseSRWLockExclusive(&lock);
     return cert;
 }
+
+bool My::Certificate::use_store_file(const wchar_t * path)
+{
+    if (!path) {
+        return false;
+    }
+    AcquireSRWLockExclusive(&lock);
+    close_store();
+    store_file = path;
+    bool ok = open_store();
+    ReleaseSRWLockExclusive(&lock);
+    return ok;
+}
+
+void My::Certificate::invalidate()
+{
+    AcquireSRWLockExclusive(&lock);
+    index.invalidate();
+    ReleaseSRWLockExclusive(&lock);
+}
+
+bool My::Certificate::open_store()
+{
+    if (store_file.empty()) {
+        //NOTE: For UNICODE, AsCertOpenStore virtually has only an "A" version API while
+        //CertFindCertificateInStore has only a "W" version!
+        store = CertOpenStore(
+            CERT_STORE_PROV_SYSTEM_A,
+            0,
+            0,
+            CERT_STORE_OPEN_EXISTING_FLAG | CERT_STORE_READONLY_FLAG | CERT_SYSTEM_STORE_LOCAL_MACHINE,
+            "My"
+        );
+    }
+    else {
+        store = CertOpenStore(
+            CERT_STORE_PROV_FILENAME_W,
+            PKCS_7_ASN_ENCODING | X509_ASN_ENCODING,
+            0,
+            CERT_STORE_OPEN_EXISTING_FLAG | CERT_STORE_READONLY_FLAG,
+            store_file.c_str()
+        );
+    }
+    if (!store) {
+        Log::error("[Certificate::open_store] CertOpenStore failed with error: ", GetLastError());
+        return false;
+    }
+    if (store_file.empty()) {
+        //The event is signaled when the store is changed, by adding or deleting a certificate for example.
+        //It's a manual-reset one, so that checking it doesn't consume the signal.
+        store_changed = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+        if (store_changed && !CertControlStore(store, 0, CERT_STORE_CTRL_NOTIFY_CHANGE, &store_changed)) {
+            Log::warn("[Certificate::open_store] CertControlStore failed with error: ", GetLastError(),
+                ". Changes to the store won't be detected.");
+            CloseHandle(store_changed);
+            store_changed = nullptr;
+        }
+    }
+    index.invalidate();
+    return true;
+}
+
+void My::Certificate::close_store()
+{
+    clear_index();
+    if (store) {
+        CertCloseStore(store, 0);
+        store = nullptr;
+    }
+    if (store_changed) {
+        CloseHandle(store_changed);
+        store_changed = nullptr;
+    }
+}
+
+bool My::Certificate::is_stale()
+{
+    if (store_changed && WaitForSingleObject(store_changed, 0) == WAIT_OBJECT_0) {
+        return true;
+    }
+    return index.is_stale(now());
+}
+
+bool My::Certificate::refresh_when_necessary()
+{
+    if (!store && !open_store()) {
+        return false;
+    }
+    if (!is_stale()) {
+        return true;
+    }
+    if (store_changed && WaitForSingleObject(store_changed, 0) == WAIT_OBJECT_0) {
+        ResetEvent(store_changed);
+        //Bring the cached store up to date and get notified of the next change.
+        if (!CertControlStore(store, 0, CERT_STORE_CTRL_RESYNC, &store_changed)) {
+            Log::warn("[Certificate::refresh_when_necessary] CertControlStore failed with error: ", GetLastError());
+        }
+    }
+    clear_index();
+    build_index();
+    return true;
+}
+
+void My::Certificate::build_index()
+{
+    index.begin(now());
+    PCCERT_CONTEXT cert = nullptr;
+    //NOTE: CertEnumCertificatesInStore frees the previous context passed in, so the ones in index are duplicated.
+    while ((cert = CertEnumCertificatesInStore(store, cert)) != nullptr) {
+        //A server certificate is useless without a private key. But don't require it for a store file,
+        //which is usually a stand-in for tests.
+        DWORD size = 0;
+        if (store_file.empty() && !CertGetCertificateContextProperty(cert, CERT_KEY_PROV_INFO_PROP_ID, nullptr, &size)) {
+            continue;
+        }
+        auto info = cert->pCertInfo;
+        auto entry = index.add_cert(CertDuplicateCertificateContext(cert), to_time(info->NotBefore), to_time(info->NotAfter));
+        certs.push_back(entry.cert);
+        add_names(entry.cert, entry);
+    }
+    index.end();
+    Log::info("[Certificate::build_index] ", certs.size(), " certificate(s) and ", index.size(), " name(s) are indexed.");
+}
+
+void My::Certificate::add_names(PCCERT_CONTEXT cert, const Index::Entry& entry)
+{
+    //Subject CN
+    wchar_t name[256];
+    auto len = CertGetNameStringW(cert, CERT_NAME_ATTR_TYPE, 0, (void*)szOID_COMMON_NAME, name, sizeof(name) / sizeof(name[0]));
+    if (len > 1) {
+        index.add_name(name, entry);
+    }
+
+    //DNS names in Subject Alternative Name
+    auto info = cert->pCertInfo;
+    auto ext = CertFindExtension(szOID_SUBJECT_ALT_NAME2, info->cExtension, info->rgExtension);
+    if (!ext) {
+        return;
+    }
+    PCERT_ALT_NAME_INFO alt_names = nullptr;
+    DWORD size = 0;
+    if (!CryptDecodeObjectEx(
+        X509_ASN_ENCODING | PKCS_7_ASN_ENCODING,
+        X509_ALTERNATE_NAME,
+        ext->Value.pbData,
+        ext->Value.cbData,
+        CRYPT_DECODE_ALLOC_FLAG,
+        nullptr,
+        &alt_names,
+        &size)) {
+        Log::warn("[Certificate::add_names] CryptDecodeObjectEx failed with error: ", GetLastError());
+        return;
+    }
+    for (DWORD i = 0; i < alt_names->cAltEntry; i++) {
+        auto& alt = alt_names->rgAltEntry[i];
+        if (alt.dwAltNameChoice == CERT_ALT_NAME_DNS_NAME && alt.pwszDNSName) {
+            index.add_name(alt.pwszDNSName, entry);
+        }
+    }
+    LocalFree(alt_names);
+}
+
+void My::Certificate::clear_index()
+{
+    index.clear();
+    for (auto cert : certs) {
+        CertFreeCertificateContext(cert);
+    }
+    certs.clear();
+}
@@ -2,15 +2,71 @@
 
 #include "common.h"
 #include <Wincrypt.h>
+#include <string>
+#include <vector>
+#include "CertificateIndex.h"
 
 namespace My {
+    //Certificates in the "My" store of the local machine are indexed by the DNS names in their subject CN and
+    //Subject Alternative Name, so a lookup is a hash probe rather than a linear search of the store. The index
+    //is rebuilt when the store changes or when a certificate in it expires. Which certificate serves a name and
+    //when the index is stale for the validity of certificates are up to CertificateIndex.
     class Certificate
     {
     public:
+        //Return a certificate for the name, or nullptr if there's none. Wildcard certificates are matched. When
+        //multiple certificates match, a non-expired one with the latest expiry is preferred. The returned
+        //certificate must be released by free.
         static PCCERT_CONTEXT get(const wchar_t * name);
 
         static inline void free(PCCERT_CONTEXT cert) {
             CertFreeCertificateContext(cert);
         }
+
+        //Use a certificate store file (a serialized store, a PKCS #7 file or an encoded certificate), instead
+        //of the system store. Certificates in it are not required to have a private key, so it can stand in for
+        //the system store in tests. Changes to the file are not detected, call invalidate after changing it.
+        static bool use_store_file(const wchar_t * path);
+
+        //Drop the index. It'll be rebuilt on next get.
+        static void invalidate();
+
+        //Call f(const std::wstring& name, PCCERT_CONTEXT cert) for each indexed name.
+        template <typename F>
+        static void for_each(F f) {
+            AcquireSRWLockExclusive(&lock);
+            if (refresh_when_necessary()) {
+                index.for_each([&f](const std::wstring& name, const Index::Entry& entry) {
+                    f(name, entry.cert);
+                });
+            }
+            ReleaseSRWLockExclusive(&lock);
+        }
+
+    private:
+        typedef CertificateIndex<PCCERT_CONTEXT> Index;
+
+        static bool open_store();
+
+        static void close_store();
+
+        //Must be called with the lock held exclusively.
+        static bool refresh_when_necessary();
+
+        static bool is_stale();
+
+        static void build_index();
+
+        static void clear_index();
+
+        static void add_names(PCCERT_CONTEXT cert, const Index::Entry& entry);
+
+        static SRWLOCK lock;
+        static HCERTSTORE store;
+        static HANDLE store_changed;
+        //All certificates referenced by the index.
+        static std::vector<PCCERT_CONTEXT> certs;
+        static std::wstring store_file;
+        static Index index;
     };
 }
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "NameIndex.h"
+
+namespace My {
+    //Which certificate serves a name, and when the index of them must be rebuilt for the validity of certificates.
+    //Cert is a handle of a certificate, like PCCERT_CONTEXT for Certificate. Times are in 100-nanosecond intervals
+    //since January 1, 1601, like a FILETIME.
+    //
+    //It has no dependency on Windows, so it can be built and tested on any platform with a stand-in for the store.
+    template <typename Cert>
+    class CertificateIndex
+    {
+    public:
+        struct Entry {
+            Cert cert;
+            uint64_t not_after;
+            bool expired;
+        };
+
+        //A certificate not expired wins, and then the one which expires later.
+        struct Better {
+            bool operator () (const Entry& a, const Entry& b) const {
+                if (a.expired != b.expired) {
+                    return !a.expired;
+                }
+                return a.not_after > b.not_after;
+            }
+        };
+
+        //Like CertVerifyTimeValidity, it's -1 when the certificate is not valid yet at now, 1 when it has expired,
+        //and 0 otherwise.
+        static int validity(uint64_t now, uint64_t not_before, uint64_t not_after) {
+            if (now < not_before) {
+                return -1;
+            }
+            return now > not_after ? 1 : 0;
+        }
+
+        //Drop all entries and start a rebuild at now. Add the certificates of the store by add_cert and add_name,
+        //then call end.
+        void begin(uint64_t now) {
+            m_index.clear();
+            m_now = now;
+            m_next_refresh = UINT64_MAX;
+            m_indexed = false;
+        }
+
+        //Return the entry of a certificate, to be added for each of its names. The index will be stale when it
+        //becomes valid or expires.
+        Entry add_cert(Cert cert, uint64_t not_before, uint64_t not_after) {
+            auto v = validity(m_now, not_before, not_after);
+            if (v < 0 && not_before < m_next_refresh) {
+                m_next_refresh = not_before;
+            }
+            else if (v == 0 && not_after < m_next_refresh) {
+                m_next_refresh = not_after;
+            }
+            return Entry{ cert, not_after, v != 0 };
+        }
+
+        void add_name(const std::wstring& name, const Entry& entry) {
+            m_index.add(name, entry);
+        }
+
+        void end() {
+            m_indexed = true;
+        }
+
+        //Whether it must be rebuilt at now: it has never been built, it's been invalidated, or a certificate in it
+        //has expired or become valid since it was built.
+        bool is_stale(uint64_t now) const {
+            return !m_indexed || now >= m_next_refresh;
+        }
+
+        void invalidate() {
+            m_indexed = false;
+        }
+
+        void clear() {
+            m_index.clear();
+            m_indexed = false;
+        }
+
+        //Return nullptr when there's no match.
+        const Entry* find(const std::wstring& name) const {
+            return m_index.find(name);
+        }
+
+        //Call f(const std::wstring& name, const Entry& entry) for each indexed name.
+        template <typename F>
+        void for_each(F f) const {
+            m_index.for_each(f);
+        }
+
+        size_t size() const {
+            return m_index.size();
+        }
+
+        //The earliest time at which a certificate in the index expires or becomes valid.
+        uint64_t next_refresh() const {
+            return m_next_refresh;
+        }
+
+    private:
+        NameIndex<Entry, Better> m_index;
+        uint64_t m_now = 0;
+        uint64_t m_next_refresh = UINT64_MAX;
+        bool m_indexed = false;
+    };
+}
@@ -0,0 +1,160 @@
+#include "ClientHello.h"
+
+namespace {
+    //A bounds-checked big-endian reader.
+    class Reader
+    {
+    public:
+        Reader(const unsigned char* p = nullptr, size_t size = 0) : m_p(p), m_left(size) {}
+
+        bool u8(size_t& v) {
+            if (m_left < 1) {
+                return false;
+            }
+            v = m_p[0];
+            skip(1);
+            return true;
+        }
+
+        bool u16(size_t& v) {
+            if (m_left < 2) {
+                return false;
+            }
+            v = ((size_t)m_p[0] << 8) | m_p[1];
+            skip(2);
+            return true;
+        }
+
+        bool u24(size_t& v) {
+            if (m_left < 3) {
+                return false;
+            }
+            v = ((size_t)m_p[0] << 16) | ((size_t)m_p[1] << 8) | m_p[2];
+            skip(3);
+            return true;
+        }
+
+        bool skip(size_t n) {
+            if (m_left < n) {
+                return false;
+            }
+            m_p += n;
+            m_left -= n;
+            return true;
+        }
+
+        //Take the next n bytes as a sub-reader.
+        bool sub(size_t n, Reader& r) {
+            if (m_left < n) {
+                return false;
+            }
+            r = Reader(m_p, n);
+            skip(n);
+            return true;
+        }
+
+        const unsigned char* data() const {
+            return m_p;
+        }
+
+        size_t left() const {
+            return m_left;
+        }
+
+    private:
+        const unsigned char* m_p;
+        size_t m_left;
+    };
+}
+
+My::ClientHello::Result My::ClientHello::peek_server_name(const char* buf, size_t size, std::wstring& name)
+{
+    name.clear();
+    if (size < record_header_size) {
+        return Result::Incomplete;
+    }
+    auto p = (const unsigned char*)buf;
+    if (p[0] != content_type_handshake || p[1] != 3) {
+        return Result::Invalid;
+    }
+    size_t record_size = ((size_t)p[3] << 8) | p[4];
+    if (size < record_header_size + record_size) {
+        return Result::Incomplete;
+    }
+
+    Reader record(p + record_header_size, record_size);
+    size_t type, length;
+    if (!record.u8(type) || type != handshake_type_client_hello || !record.u24(length)) {
+        return Result::Invalid;
+    }
+    //NOTE: A ClientHello can be fragmented into multiple records. That's rare and we don't try to reassemble
+    //it. Just treat it as one without SNI.
+    Reader hello;
+    if (!record.sub(length, hello)) {
+        return Result::NotFound;
+    }
+
+    size_t n;
+    //client_version and random
+    if (!hello.skip(2 + 32)) {
+        return Result::Invalid;
+    }
+    //session_id
+    if (!hello.u8(n) || !hello.skip(n)) {
+        return Result::Invalid;
+    }
+    //cipher_suites
+    if (!hello.u16(n) || !hello.skip(n)) {
+        return Result::Invalid;
+    }
+    //compression_methods
+    if (!hello.u8(n) || !hello.skip(n)) {
+        return Result::Invalid;
+    }
+    if (!hello.left()) {
+        //No extension at all.
+        return Result::NotFound;
+    }
+    Reader extensions;
+    if (!hello.u16(n) || !hello.sub(n, extensions)) {
+        return Result::Invalid;
+    }
+    while (extensions.left()) {
+        size_t ext_type;
+        Reader ext;
+        if (!extensions.u16(ext_type) || !extensions.u16(n) || !extensions.sub(n, ext)) {
+            return Result::Invalid;
+        }
+        if (ext_type != extension_server_name) {
+            continue;
+        }
+        Reader list;
+        if (!ext.u16(n) || !ext.sub(n, list)) {
+            return Result::Invalid;
+        }
+        while (list.left()) {
+            size_t name_type;
+            if (!list.u8(name_type) || !list.u16(n) || n > list.left()) {
+                return Result::Invalid;
+            }
+            if (name_type == name_type_host_name) {
+                if (n == 0 || n > max_host_name_size) {
+                    return Result::Invalid;
+                }
+                //A host name is in ASCII, see RFC 6066.
+                auto host = list.data();
+                for (size_t i = 0; i < n; i++) {
+                    if (host[i] <= 0x20 || host[i] >= 0x7F) {
+                        name.clear();
+                        return Result::Invalid;
+                    }
+                    name.push_back((wchar_t)host[i]);
+                }
+                return Result::Found;
+            }
+            list.skip(n);
+        }
+        return Result::NotFound;
+    }
+    return Result::NotFound;
+}
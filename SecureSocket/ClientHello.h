@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+namespace My {
+    //A minimal parser of the TLS ClientHello message, just enough to peek the Server Name Indication(SNI)
+    //from the first bytes a client sends, before handing them to Schannel.
+    //
+    //It has no dependency on Windows, so it can be built and tested on any platform.
+    class ClientHello
+    {
+    public:
+        enum class Result {
+            Found = 0,
+            //It's a valid ClientHello without a host name in SNI.
+            NotFound,
+            //More bytes are needed to get the ClientHello.
+            Incomplete,
+            //It's not a ClientHello, or it's malformed.
+            Invalid
+        };
+
+        //buf should start with the first TLS record received from a client.
+        static Result peek_server_name(const char* buf, size_t size, std::wstring& name);
+
+    private:
+        static const unsigned char content_type_handshake = 22;
+        static const unsigned char handshake_type_client_hello = 1;
+        static const unsigned short extension_server_name = 0;
+        static const unsigned char name_type_host_name = 0;
+        static const size_t record_header_size = 5;
+        static const size_t max_host_name_size = 255;
+    };
+}
@@ -0,0 +1,202 @@
+//SCH_CREDENTIALS is defined only with SCHANNEL_USE_BLACKLISTS, and it needs UNICODE_STRING from SubAuth.h.
+#define SCHANNEL_USE_BLACKLISTS
+#include "CredentialCache.h"
+#include "Certificate.h"
+#include <SubAuth.h>
+#include <schannel.h>
+#include "Log.h"
+
+#pragma comment(lib, "Secur32.lib")
+
+SRWLOCK My::CredentialCache::lock = SRWLOCK_INIT;
+std::map<My::CredentialCache::Key, PCredHandle> My::CredentialCache::creds;
+PSecurityFunctionTable My::CredentialCache::sspi = nullptr;
+std::vector<PCredHandle> My::CredentialCache::unshared;
+DWORD My::CredentialCache::session_lifespan = 0;
+bool My::CredentialCache::shared = true;
+
+PCredHandle My::CredentialCache::get_server(const wchar_t* server_name)
+{
+    if (!server_name) {
+        return nullptr;
+    }
+    return get(true, server_name);
+}
+
+PCredHandle My::CredentialCache::get_client()
+{
+    return get(false, L"");
+}
+
+PCredHandle My::CredentialCache::get(bool server, const wchar_t* server_name)
+{
+    if (!shared) {
+        //Acquired out of the lock, as each socket did on its own.
+        AcquireSRWLockExclusive(&lock);
+        init_sspi();
+        ReleaseSRWLockExclusive(&lock);
+        auto cred = create(server, server_name);
+        if (cred) {
+            AcquireSRWLockExclusive(&lock);
+            unshared.push_back(cred);
+            ReleaseSRWLockExclusive(&lock);
+        }
+        return cred;
+    }
+
+    Key key(server, server_name);
+
+    AcquireSRWLockShared(&lock);
+    auto it = creds.find(key);
+    PCredHandle result = (it != creds.end()) ? it->second : nullptr;
+    ReleaseSRWLockShared(&lock);
+    if (result) {
+        return result;
+    }
+
+    //NOTE: The credential is created with the lock held. So concurrent first handshakes for the same key
+    //wait for one creation, rather than all creating their own.
+    AcquireSRWLockExclusive(&lock);
+    it = creds.find(key);
+    if (it != creds.end()) {
+        result = it->second;
+    }
+    else {
+        init_sspi();
+        result = create(server, server_name);
+        if (result) {
+            creds[key] = result;
+        }
+    }
+    ReleaseSRWLockExclusive(&lock);
+    return result;
+}
+
+void My::CredentialCache::init_sspi()
+{
+    if (!sspi) {
+        sspi = InitSecurityInterface();
+        if (!sspi) {
+            Log::error("[CredentialCache::init_sspi] InitSecurityInterface failed.");
+        }
+    }
+}
+
+PCredHandle My::CredentialCache::create(bool server, const wchar_t* server_name)
+{
+    if (!sspi) {
+        return nullptr;
+    }
+    auto cred = new CredHandle{};
+    bool ok = server ? create_server_cred(server_name, cred) : create_client_cred(cred);
+    if (!ok) {
+        delete cred;
+        return nullptr;
+    }
+    return cred;
+}
+
+void My::CredentialCache::clear()
+{
+    AcquireSRWLockExclusive(&lock);
+    for (auto& pair : creds) {
+        sspi->FreeCredentialsHandle(pair.second);
+        delete pair.second;
+    }
+    creds.clear();
+    for (auto cred : unshared) {
+        sspi->FreeCredentialsHandle(cred);
+        delete cred;
+    }
+    unshared.clear();
+    ReleaseSRWLockExclusive(&lock);
+}
+
+bool My::CredentialCache::create_server_cred(const wchar_t* server_name, CredHandle* cred)
+{
+    auto cert = Certificate::get(server_name);
+    if (!cert) {
+        //TODO: Log can output wstring.
+        Log::error("[CredentialCache::create_server_cred] Server certificate is not found!");
+        return false;
+    }
+    auto status = acquire(true, &cert, SCH_USE_STRONG_CRYPTO, cred);
+    //The credential holds its own reference to the certificate.
+    Certificate::free(cert);
+    if (status != SEC_E_OK) {
+        if (status == SEC_E_UNKNOWN_CREDENTIALS) {
+            Log::error("[CredentialCache::create_server_cred] AcquireCredentialsHandle failed with SEC_E_UNKNOWN_CREDENTIALS. The server certificate is probabaly invalid!");
+        }
+        else {
+            Log::error("[CredentialCache::create_server_cred] AcquireCredentialsHandle failed with: ", status);
+        }
+    }
+    return (status == SEC_E_OK);
+}
+
+bool My::CredentialCache::create_client_cred(CredHandle* cred)
+{
+    auto status = acquire(false, nullptr, SCH_CRED_MANUAL_CRED_VALIDATION | SCH_CRED_NO_DEFAULT_CREDS | SCH_USE_STRONG_CRYPTO, cred);
+    if (status != SEC_E_OK) {
+        Log::error("[CredentialCache::create_client_cred] AcquireCredentialsHandle failed with: ", status);
+    }
+    return (status == SEC_E_OK);
+}
+
+SECURITY_STATUS My::CredentialCache::acquire(bool server, PCCERT_CONTEXT* cert, DWORD flags, CredHandle* cred)
+{
+    TimeStamp ts;
+    //NOTE: by https://docs.microsoft.com/en-us/windows/win32/api/schannel/ns-schannel-sch_credentials
+    //SCH_CREDENTIALS has no list of enabled protocols but one of disabled protocols, in TLS_PARAMETERS. So disable
+    //everything except TLS 1.2 and 1.3, including versions newer than 1.3 until they are tried out. The system
+    //registry settings still take precedence, and TLS 1.3 is negotiated only where the system supports it.
+    TLS_PARAMETERS tls_params{};
+    tls_params.grbitDisabledProtocols = server ?
+        ~(DWORD)(SP_PROT_TLS1_2_SERVER | SP_PROT_TLS1_3_SERVER) : ~(DWORD)(SP_PROT_TLS1_2_CLIENT | SP_PROT_TLS1_3_CLIENT);
+    SCH_CREDENTIALS sch_cred{};
+    sch_cred.dwVersion = SCH_CREDENTIALS_VERSION;
+    sch_cred.cCreds = cert ? 1 : 0;
+    sch_cred.paCred = cert;
+    //An expired session is just dropped from the session cache, and the next connection from the client does
+    //a full handshake.
+    sch_cred.dwSessionLifespan = session_lifespan;
+    sch_cred.dwFlags = flags;
+    sch_cred.cTlsParameters = 1;
+    sch_cred.pTlsParameters = &tls_params;
+    auto status = sspi->AcquireCredentialsHandle(
+        nullptr,
+        const_cast<_TCHAR*>(UNISP_NAME),    //NOTE: What about SCHANNEL_NAME?
+        server ? SECPKG_CRED_INBOUND : SECPKG_CRED_OUTBOUND,
+        nullptr,
+        &sch_cred,
+        nullptr,
+        nullptr,
+        cred,
+        &ts
+    );
+    if (status == SEC_E_OK) {
+        return status;
+    }
+
+    //Older versions of Windows don't know SCH_CREDENTIALS. Fall back to SCHANNEL_CRED, which can't enable TLS 1.3.
+    Log::warn("[CredentialCache::acquire] AcquireCredentialsHandle with SCH_CREDENTIALS failed with: ", status,
+        ". Falling back to TLS 1.2.");
+    SCHANNEL_CRED schannel_cred{};
+    schannel_cred.dwVersion = SCHANNEL_CRED_VERSION;
+    schannel_cred.cCreds = cert ? 1 : 0;
+    schannel_cred.paCred = cert;
+    schannel_cred.grbitEnabledProtocols = server ? SP_PROT_TLS1_2_SERVER : SP_PROT_TLS1_2_CLIENT;
+    schannel_cred.dwSessionLifespan = session_lifespan;
+    schannel_cred.dwFlags = flags;
+    return sspi->AcquireCredentialsHandle(
+        nullptr,
+        const_cast<_TCHAR*>(UNISP_NAME),
+        server ? SECPKG_CRED_INBOUND : SECPKG_CRED_OUTBOUND,
+        nullptr,
+        &schannel_cred,
+        nullptr,
+        nullptr,
+        cred,
+        &ts
+    );
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "common.h"
+
+//SECURITY_WIN32 is required by sspi.h
+#define SECURITY_WIN32
+#include <sspi.h>
+#include <Wincrypt.h>
+
+#include <map>
+#include <vector>
+#include <string>
+
+namespace My {
+    //A process-wide cache of Schannel credential handles: one for each server name, and one for all clients.
+    //
+    //Acquiring a server credential means opening the system certificate store, searching it for the certificate
+    //and then calling AcquireCredentialsHandle, which is far more expensive than a handshake step. A credential
+    //handle can be shared by any number of security contexts on any thread, so it's acquired once per key.
+    //Sharing one handle per key also lets Schannel resume sessions, since its session cache is per credential.
+    //Client sessions are kept apart by the target name passed to InitializeSecurityContext, so one client handle
+    //serves every server.
+    class CredentialCache
+    {
+    public:
+        //Return nullptr on failure. The returned handle is owned by the cache and must not be freed by the caller.
+        static PCredHandle get_server(const wchar_t* server_name);
+
+        //The client credential has no certificate, so it's the same for all servers.
+        static PCredHandle get_client();
+
+        //Free all cached handles. It must be called only when no security context is using any of them.
+        static void clear();
+
+        //How long in milliseconds Schannel keeps a session for resumption. 0 for the system default, which is
+        //10 hours. It takes effect on handles acquired after it's set.
+        static DWORD session_lifespan;
+
+        //With false, every get acquires a handle of its own, as each socket did before the cache, to measure what
+        //the cache saves. The handles are kept until clear. It's for benchmarks only, see -u of HandshakeBench.
+        static bool shared;
+
+    private:
+        //Role and server name, which is empty for the client.
+        typedef std::pair<bool, std::wstring> Key;
+
+        static PCredHandle get(bool server, const wchar_t* server_name);
+
+        //Set up sspi, with the lock held.
+        static void init_sspi();
+
+        //Acquire a new handle, or return nullptr on failure. sspi must be set up.
+        static PCredHandle create(bool server, const wchar_t* server_name);
+
+        static bool create_server_cred(const wchar_t* server_name, CredHandle* cred);
+
+        static bool create_client_cred(CredHandle* cred);
+
+        //Acquire a handle enabling TLS 1.3 where possible. cert is nullptr for a client.
+        static SECURITY_STATUS acquire(bool server, PCCERT_CONTEXT* cert, DWORD flags, CredHandle* cred);
+
+        static SRWLOCK lock;
+        static std::map<Key, PCredHandle> creds;
+        //Handles acquired when not shared
+        static std::vector<PCredHandle> unshared;
+        static PSecurityFunctionTable sspi;
+    };
+}
@@ -0,0 +1,45 @@
+#include "CredentialTable.h"
+#include "CredentialCache.h"
+#include "Certificate.h"
+#include "Log.h"
+
+bool My::CredentialTable::add(const wchar_t* server_name)
+{
+    auto cred = CredentialCache::get_server(server_name);
+    if (!cred) {
+        Log::error("[CredentialTable::add] No credential for the server name.");
+        return false;
+    }
+    m_index.add(server_name, cred);
+    if (!m_default) {
+        m_default = cred;
+    }
+    return true;
+}
+
+bool My::CredentialTable::add_all()
+{
+    //NOTE: Names are collected before adding, since Certificate is locked in for_each and adding a name
+    //gets a certificate from it again.
+    std::vector<std::wstring> names;
+    Certificate::for_each([&names](const std::wstring& name, PCCERT_CONTEXT) {
+        names.push_back(name);
+    });
+    size_t added = 0;
+    for (auto& name : names) {
+        if (add(name.c_str())) {
+            added++;
+        }
+    }
+    Log::info("[CredentialTable::add_all] ", added, " of ", names.size(), " name(s) are added.");
+    return added > 0;
+}
+
+PCredHandle My::CredentialTable::find(const std::wstring& server_name) const
+{
+    if (server_name.empty()) {
+        return m_default;
+    }
+    auto cred = m_index.find(server_name);
+    return cred ? *cred : m_default;
+}
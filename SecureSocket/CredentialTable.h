@@ -0,0 +1,51 @@
+#pragma once
+
+#include "common.h"
+
+//SECURITY_WIN32 is required by sspi.h
+#define SECURITY_WIN32
+#include <sspi.h>
+
+#include <string>
+#include <vector>
+#include "NameIndex.h"
+
+namespace My {
+    //A pre-built table from server names to server credentials, for choosing a certificate by the Server Name
+    //Indication(SNI) of a client. All credentials are acquired while the table is built, so selecting one in a
+    //handshake is a hash probe without any certificate store lookup.
+    //
+    //The table must be fully built before it's used by any handshake. After that it's read-only and so it can
+    //be shared by any number of threads without a lock.
+    class CredentialTable
+    {
+    public:
+        //Add a server name, which may be a wildcard one like "*.example.com". The first name added successfully
+        //becomes the default one, for clients without SNI or asking for a name not in the table.
+        bool add(const wchar_t* server_name);
+
+        //Add every name of every certificate found by Certificate. Return false when none is added.
+        bool add_all();
+
+        //Return the credential for the name, or the default one if name is not found or empty.
+        PCredHandle find(const std::wstring& server_name) const;
+
+        PCredHandle get_default() const {
+            return m_default;
+        }
+
+        size_t size() const {
+            return m_index.size();
+        }
+
+    private:
+        struct KeepFirst {
+            bool operator () (PCredHandle, PCredHandle) const {
+                return false;
+            }
+        };
+
+        NameIndex<PCredHandle, KeepFirst> m_index;
+        PCredHandle m_default = nullptr;
+    };
+}
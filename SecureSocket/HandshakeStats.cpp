@@ -0,0 +1,25 @@
+#include "HandshakeStats.h"
+
+volatile LONG64 My::HandshakeStats::full = 0;
+volatile LONG64 My::HandshakeStats::resumed = 0;
+volatile LONG64 My::HandshakeStats::tls13 = 0;
+
+void My::HandshakeStats::record(ITlsSession* session)
+{
+    if (session->is_resumed()) {
+        InterlockedIncrement64(&resumed);
+    }
+    else {
+        InterlockedIncrement64(&full);
+    }
+    if (session->is_tls13()) {
+        InterlockedIncrement64(&tls13);
+    }
+}
+
+double My::HandshakeStats::get_hit_rate()
+{
+    LONG64 r = resumed;
+    LONG64 total = full + r;
+    return total ? r * 100.0 / total : 0;
+}
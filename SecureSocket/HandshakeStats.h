@@ -0,0 +1,40 @@
+#pragma once
+
+#include "common.h"
+#include "ITlsSession.h"
+
+namespace My {
+    //Counts of full and resumed TLS handshakes, to tell how well session resumption works.
+    //
+    //NOTE: Schannel keeps the session cache itself, which is shared by all threads in a process. A client resumes
+    //a session by the target name and credential handle, and a server by the session ID or ticket a client
+    //offers. So the point for a server is to keep sessions long enough, and for a client to reuse the credential
+    //handle, see CredentialCache.
+    class HandshakeStats
+    {
+    public:
+        //Record a session whose handshake is just done.
+        static void record(ITlsSession* session);
+
+        static LONG64 get_full() {
+            return full;
+        }
+
+        static LONG64 get_resumed() {
+            return resumed;
+        }
+
+        //Handshakes, full or resumed, which negotiated TLS 1.3.
+        static LONG64 get_tls13() {
+            return tls13;
+        }
+
+        //Resumed handshakes out of all, in percentage.
+        static double get_hit_rate();
+
+    private:
+        static volatile LONG64 full;
+        static volatile LONG64 resumed;
+        static volatile LONG64 tls13;
+    };
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace My {
+    enum class TlsStatus {
+        //The handshake is done, or a record of application data is decrypted.
+        Ok = 0,
+        //The handshake goes on, or a record without application data (like a TLS 1.3 post-handshake message)
+        //is processed. Send the output if any, then call again with the input left, or more input if none left.
+        Continue,
+        //More input is needed.
+        Incomplete,
+        //The peer has closed the TLS session.
+        Closed,
+        Error
+    };
+
+    //Sizes of a TLS record. An encrypted record of n bytes payload takes at most header + n + trailer bytes.
+    struct TlsSizes {
+        size_t header;
+        size_t trailer;
+        //Max size of a whole record
+        size_t max_message;
+
+        size_t max_payload() const {
+            return max_message - header - trailer;
+        }
+    };
+
+    //The TLS state of one connection. It only transforms bytes and never touches a socket, so the caller can
+    //carry the bytes in any way, blocking or overlapped.
+    //
+    //Input is taken from the start of in, and consumed tells how many bytes are used on return. The caller
+    //should drop them and pass the rest in again, with more bytes received appended. Bytes to send to the peer
+    //are appended to out, which may happen in decrypt too since TLS 1.3 has post-handshake messages.
+    //
+    //After the handshake, encrypt may be called on one thread while decrypt is called on another, like by a server
+    //with a send and a receive in flight at once. The session serializes them where it must, like for a
+    //post-handshake message (a KeyUpdate) that changes the keys encrypt uses.
+    class ITlsSession
+    {
+    public:
+        //A client calls it with no input first, to get the ClientHello message.
+        virtual TlsStatus handshake(const char* in, size_t in_size, size_t& consumed, std::vector<char>& out) = 0;
+
+        //It's valid only after the handshake is done.
+        virtual const TlsSizes& get_sizes() = 0;
+
+        //Encrypt at most max_payload bytes into one record. out_size must be at least header + size + trailer,
+        //and written is the size of the record.
+        virtual bool encrypt(const char* data, size_t size, char* out, size_t out_size, size_t& written) = 0;
+
+        //Decrypt at most one record of application data into plain. in may be modified, since some
+        //implementations decrypt in place.
+        virtual TlsStatus decrypt(char* in, size_t in_size, size_t& consumed, char* plain, size_t plain_size,
+            size_t& written, std::vector<char>& out) = 0;
+
+        //Return true if some input consumed is not returned by decrypt yet. Then decrypt should be called before
+        //receiving more, even with no input.
+        virtual bool has_pending() = 0;
+
+        //Get the close_notify alert in out.
+        virtual bool shutdown(std::vector<char>& out) = 0;
+
+        //The following are valid only after the handshake is done.
+        virtual bool is_resumed() = 0;
+
+        virtual bool is_tls13() = 0;
+
+        virtual ~ITlsSession() {}
+    };
+
+    class ITlsProvider
+    {
+    public:
+        //Return nullptr on failure. The session is owned by the caller.
+        virtual ITlsSession* create_server_session() = 0;
+
+        //server_name is optional. It's both the name sent in SNI and the key to resume a session.
+        virtual ITlsSession* create_client_session(const wchar_t* server_name) = 0;
+
+        virtual ~ITlsProvider() {}
+    };
+}
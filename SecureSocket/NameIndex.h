@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <cwctype>
+
+namespace My {
+    //A hash index from DNS names to values, which supports wildcard names like "*.example.com".
+    //
+    //Names are case-insensitive. A wildcard name matches exactly one label in its leftmost position, so
+    //"*.example.com" matches "www.example.com" but neither "example.com" nor "a.b.example.com". An exact name
+    //is preferred to a wildcard one. So a lookup costs at most two hash probes.
+    //
+    //When more than one value is added for a name, the one for which better(new, old) is true wins.
+    //
+    //It has no dependency on Windows, so it can be built and tested on any platform.
+    template <typename T, typename Better>
+    class NameIndex
+    {
+    public:
+        explicit NameIndex(Better better = Better()) : m_better(better) {}
+
+        void add(const std::wstring& name, const T& value) {
+            if (name.empty()) {
+                return;
+            }
+            auto key = normalize(name);
+            auto it = m_map.find(key);
+            if (it == m_map.end()) {
+                m_map.emplace(key, value);
+            }
+            else if (m_better(value, it->second)) {
+                it->second = value;
+            }
+        }
+
+        //Return nullptr when there's no match.
+        const T* find(const std::wstring& name) const {
+            if (name.empty() || m_map.empty()) {
+                return nullptr;
+            }
+            auto key = normalize(name);
+            auto it = m_map.find(key);
+            if (it != m_map.end()) {
+                return &it->second;
+            }
+            auto dot = key.find(L'.');
+            if (dot == std::wstring::npos || dot == 0 || dot + 1 == key.size()) {
+                return nullptr;
+            }
+            it = m_map.find(L"*" + key.substr(dot));
+            return it != m_map.end() ? &it->second : nullptr;
+        }
+
+        template <typename F>
+        void for_each(F f) const {
+            for (auto& pair : m_map) {
+                f(pair.first, pair.second);
+            }
+        }
+
+        size_t size() const {
+            return m_map.size();
+        }
+
+        void clear() {
+            m_map.clear();
+        }
+
+    private:
+        static std::wstring normalize(const std::wstring& name) {
+            std::wstring result(name);
+            for (auto& c : result) {
+                c = (wchar_t)std::towlower(c);
+            }
+            //A fully qualified name may end with a dot.
+            if (!result.empty() && result.back() == L'.') {
+                result.pop_back();
+            }
+            return result;
+        }
+
+        std::unordered_map<std::wstring, T> m_map;
+        Better m_better;
+    };
+}
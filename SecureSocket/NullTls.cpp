@@ -0,0 +1,119 @@
+#include "NullTls.h"
+#include <cstring>
+#include "Log.h"
+
+namespace {
+    //Content types and the size of the record header, as in TLS.
+    const unsigned char alert = 21;
+    const unsigned char handshake_type = 22;
+    const unsigned char application_data = 23;
+    const size_t record_header_size = 5;
+}
+
+const My::TlsSizes My::NullTlsProvider::schannel_sizes = { 13, 16, 16384 };
+
+void My::NullTlsSession::put_record(unsigned char type, std::vector<char>& out)
+{
+    auto offset = out.size();
+    out.resize(offset + m_sizes.header + m_sizes.trailer, 0);
+    auto length = m_sizes.header - record_header_size + m_sizes.trailer;
+    auto p = out.data() + offset;
+    p[0] = type;
+    p[1] = 3;
+    p[2] = 3;
+    p[3] = (char)(length >> 8);
+    p[4] = (char)length;
+}
+
+size_t My::NullTlsSession::get_record(const char* in, size_t in_size, unsigned char& type)
+{
+    if (in_size < record_header_size) {
+        return 0;
+    }
+    auto p = (const unsigned char*)in;
+    size_t size = record_header_size + ((p[3] << 8) | p[4]);
+    if (in_size < size) {
+        return 0;
+    }
+    type = p[0];
+    return size;
+}
+
+My::TlsStatus My::NullTlsSession::handshake(const char* in, size_t in_size, size_t& consumed, std::vector<char>& out)
+{
+    consumed = 0;
+    if (!m_server && !m_hello_sent) {
+        put_record(handshake_type, out);
+        m_hello_sent = true;
+        return TlsStatus::Continue;
+    }
+    unsigned char type = 0;
+    auto size = get_record(in, in_size, type);
+    if (!size) {
+        return TlsStatus::Incomplete;
+    }
+    if (type != handshake_type) {
+        Log::error("[NullTlsSession::handshake] Unexpected content type: ", (int)type);
+        return TlsStatus::Error;
+    }
+    consumed = size;
+    if (m_server) {
+        put_record(handshake_type, out);
+    }
+    return TlsStatus::Ok;
+}
+
+bool My::NullTlsSession::encrypt(const char* data, size_t size, char* out, size_t out_size, size_t& written)
+{
+    if (size > m_sizes.max_payload() || out_size < m_sizes.header + size + m_sizes.trailer) {
+        Log::error("[NullTlsSession::encrypt] Invalid size.");
+        return false;
+    }
+    auto length = m_sizes.header - record_header_size + size + m_sizes.trailer;
+    out[0] = application_data;
+    out[1] = 3;
+    out[2] = 3;
+    out[3] = (char)(length >> 8);
+    out[4] = (char)length;
+    memset(out + record_header_size, 0, m_sizes.header - record_header_size);
+    memcpy(out + m_sizes.header, data, size);
+    memset(out + m_sizes.header + size, 0, m_sizes.trailer);
+    written = m_sizes.header + size + m_sizes.trailer;
+    return true;
+}
+
+My::TlsStatus My::NullTlsSession::decrypt(char* in, size_t in_size, size_t& consumed, char* plain, size_t plain_size,
+    size_t& written, std::vector<char>& out)
+{
+    consumed = 0;
+    written = 0;
+    unsigned char type = 0;
+    auto size = get_record(in, in_size, type);
+    if (!size) {
+        return TlsStatus::Incomplete;
+    }
+    if (type == alert) {
+        //The only alert sent is close_notify.
+        consumed = size;
+        return TlsStatus::Closed;
+    }
+    if (type != application_data || size < m_sizes.header + m_sizes.trailer) {
+        Log::error("[NullTlsSession::decrypt] Invalid record of type ", (int)type, " and size ", size);
+        return TlsStatus::Error;
+    }
+    auto payload = size - m_sizes.header - m_sizes.trailer;
+    if (payload > plain_size) {
+        Log::error("[NullTlsSession::decrypt] Input buffer is not big enough. At least ", payload, " bytes is required.");
+        return TlsStatus::Error;
+    }
+    memcpy(plain, in + m_sizes.header, payload);
+    written = payload;
+    consumed = size;
+    return TlsStatus::Ok;
+}
+
+bool My::NullTlsSession::shutdown(std::vector<char>& out)
+{
+    put_record(alert, out);
+    return true;
+}
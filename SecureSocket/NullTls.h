@@ -0,0 +1,73 @@
+#pragma once
+
+#include "common.h"
+#include "ITlsSession.h"
+
+namespace My {
+    //NOTE: For benchmarking only, it's NOT secure at all!
+    //A TLS session with real record framing but an identity "cipher": a record is made of a header, the payload as
+    //is, and a zero-filled trailer, in the sizes as Schannel reports in SecPkgContext_StreamSizes. So the same
+    //buffer management is exercised as with a real provider, with the cost of crypto removed. The handshake is a
+    //single record in each direction.
+    class NullTlsSession : public ITlsSession
+    {
+    public:
+        NullTlsSession(bool server, const TlsSizes& sizes) : m_server(server), m_sizes(sizes) {}
+
+        virtual TlsStatus handshake(const char* in, size_t in_size, size_t& consumed, std::vector<char>& out) override;
+
+        virtual const TlsSizes& get_sizes() override {
+            return m_sizes;
+        }
+
+        virtual bool encrypt(const char* data, size_t size, char* out, size_t out_size, size_t& written) override;
+
+        virtual TlsStatus decrypt(char* in, size_t in_size, size_t& consumed, char* plain, size_t plain_size,
+            size_t& written, std::vector<char>& out) override;
+
+        virtual bool has_pending() override {
+            return false;
+        }
+
+        virtual bool shutdown(std::vector<char>& out) override;
+
+        virtual bool is_resumed() override {
+            return false;
+        }
+
+        virtual bool is_tls13() override {
+            return false;
+        }
+
+    private:
+        //Append a record of the content type with an empty payload to out.
+        void put_record(unsigned char type, std::vector<char>& out);
+
+        //Return the size of the whole record at the start of in, or 0 if it's incomplete.
+        static size_t get_record(const char* in, size_t in_size, unsigned char& type);
+
+        bool m_server;
+        bool m_hello_sent = false;
+        TlsSizes m_sizes;
+    };
+
+    class NullTlsProvider : public ITlsProvider
+    {
+    public:
+        //The sizes of TLS 1.2 with AES-GCM by Schannel, where an 8 bytes explicit nonce is counted in the header.
+        static const TlsSizes schannel_sizes;
+
+        explicit NullTlsProvider(const TlsSizes& sizes = schannel_sizes) : m_sizes(sizes) {}
+
+        virtual ITlsSession* create_server_session() override {
+            return new NullTlsSession(true, m_sizes);
+        }
+
+        virtual ITlsSession* create_client_session(const wchar_t* server_name) override {
+            return new NullTlsSession(false, m_sizes);
+        }
+
+    private:
+        TlsSizes m_sizes;
+    };
+}
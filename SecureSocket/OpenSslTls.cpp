@@ -0,0 +1,456 @@
+#include "OpenSslTls.h"
+
+#ifdef MY_TLS_OPENSSL
+
+#include <openssl/err.h>
+#include <openssl/rand.h>
+#include <openssl/core_names.h>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include "Log.h"
+
+#ifdef _MSC_VER
+#pragma comment(lib, "libssl.lib")
+#pragma comment(lib, "libcrypto.lib")
+#endif
+
+namespace {
+    void log_openssl_error(const char* where) {
+        char text[256];
+        auto error = ERR_get_error();
+        ERR_error_string_n(error, text, sizeof(text));
+        My::Log::error(where, " ", text);
+        ERR_clear_error();
+    }
+
+    //Client sessions of up to 4096 servers are kept for 10 hours, the default of Schannel.
+    const size_t client_session_capacity = 4096;
+    const std::chrono::hours client_session_lifetime(10);
+    //Server sessions of up to 64K clients are kept for 2 hours, the default of OpenSSL.
+    const size_t server_session_capacity = 64 * 1024;
+    const std::chrono::hours server_session_lifetime(2);
+
+    std::vector<unsigned char> serialize(SSL_SESSION* session) {
+        std::vector<unsigned char> data;
+        auto size = i2d_SSL_SESSION(session, nullptr);
+        if (size > 0) {
+            data.resize(size);
+            auto p = data.data();
+            i2d_SSL_SESSION(session, &p);
+        }
+        return data;
+    }
+
+    std::string session_id(SSL_SESSION* session) {
+        unsigned int size = 0;
+        auto id = SSL_SESSION_get_id(session, &size);
+        return std::string((const char*)id, size);
+    }
+}
+
+My::SessionCache My::OpenSslTlsProvider::client_sessions(client_session_capacity, client_session_lifetime);
+My::SessionCache My::OpenSslTlsProvider::server_sessions(server_session_capacity, server_session_lifetime);
+
+My::OpenSslTlsSession::OpenSslTlsSession(SSL* ssl) : m_ssl(ssl)
+{
+    m_in = BIO_new(BIO_s_mem());
+    m_out = BIO_new(BIO_s_mem());
+    //A drained memory BIO reports "retry" rather than EOF, which turns into SSL_ERROR_WANT_READ.
+    BIO_set_mem_eof_return(m_in, -1);
+    BIO_set_mem_eof_return(m_out, -1);
+    SSL_set_bio(m_ssl, m_in, m_out);
+
+    m_sizes.header = SSL3_RT_HEADER_LENGTH;
+    //The worst case of all ciphers, for padding, MAC and explicit IV.
+    m_sizes.trailer = SSL3_RT_MAX_ENCRYPTED_OVERHEAD;
+    m_sizes.max_message = m_sizes.header + SSL3_RT_MAX_PLAIN_LENGTH + m_sizes.trailer;
+}
+
+My::OpenSslTlsSession::~OpenSslTlsSession()
+{
+    //The BIOs are freed with it.
+    SSL_free(m_ssl);
+}
+
+void My::OpenSslTlsSession::flush(std::vector<char>& out)
+{
+    auto pending = BIO_ctrl_pending(m_out);
+    if (pending) {
+        auto offset = out.size();
+        out.resize(offset + pending);
+        BIO_read(m_out, out.data() + offset, (int)pending);
+    }
+}
+
+My::TlsStatus My::OpenSslTlsSession::handshake(const char* in, size_t in_size, size_t& consumed, std::vector<char>& out)
+{
+    consumed = 0;
+    if (in_size) {
+        //A memory BIO grows as needed and takes all.
+        BIO_write(m_in, in, (int)in_size);
+        consumed = in_size;
+    }
+    auto result = SSL_do_handshake(m_ssl);
+    flush(out);
+    if (result == 1) {
+        return TlsStatus::Ok;
+    }
+    if (SSL_get_error(m_ssl, result) == SSL_ERROR_WANT_READ) {
+        return out.empty() ? TlsStatus::Incomplete : TlsStatus::Continue;
+    }
+    log_openssl_error("[OpenSslTlsSession::handshake] SSL_do_handshake failed:");
+    return TlsStatus::Error;
+}
+
+bool My::OpenSslTlsSession::encrypt(const char* data, size_t size, char* out, size_t out_size, size_t& written)
+{
+    if (size > m_sizes.max_payload() || out_size < m_sizes.header + size + m_sizes.trailer) {
+        Log::error("[OpenSslTlsSession::encrypt] Invalid size.");
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_lock);
+    return encrypt_locked(data, size, out, out_size, written);
+}
+
+bool My::OpenSslTlsSession::encrypt_locked(const char* data, size_t size, char* out, size_t out_size, size_t& written)
+{
+    if (SSL_write(m_ssl, data, (int)size) != (int)size) {
+        log_openssl_error("[OpenSslTlsSession::encrypt] SSL_write failed:");
+        return false;
+    }
+    auto pending = BIO_ctrl_pending(m_out);
+    if (pending > out_size) {
+        Log::error("[OpenSslTlsSession::encrypt] ", pending, " bytes are out of the buffer of ", out_size, " bytes.");
+        return false;
+    }
+    written = BIO_read(m_out, out, (int)pending);
+    return true;
+}
+
+My::TlsStatus My::OpenSslTlsSession::decrypt(char* in, size_t in_size, size_t& consumed, char* plain, size_t plain_size,
+    size_t& written, std::vector<char>& out)
+{
+    consumed = 0;
+    written = 0;
+    int result;
+    int error;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (in_size) {
+            BIO_write(m_in, in, (int)in_size);
+            consumed = in_size;
+        }
+        result = SSL_read(m_ssl, plain, (int)plain_size);
+        //Post-handshake messages, like a KeyUpdate, may need a response.
+        flush(out);
+        //NOTE: The error queue of OpenSSL is of the thread, so it's still there after the lock is released, but the
+        //state SSL_get_error reads is of the SSL.
+        error = result > 0 ? SSL_ERROR_NONE : SSL_get_error(m_ssl, result);
+    }
+    if (result > 0) {
+        written = result;
+        return TlsStatus::Ok;
+    }
+    switch (error) {
+    case SSL_ERROR_WANT_READ:
+        return TlsStatus::Incomplete;
+    case SSL_ERROR_ZERO_RETURN:
+        return TlsStatus::Closed;
+    default:
+        log_openssl_error("[OpenSslTlsSession::decrypt] SSL_read failed:");
+        return TlsStatus::Error;
+    }
+}
+
+bool My::OpenSslTlsSession::has_pending()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return SSL_pending(m_ssl) > 0 || BIO_ctrl_pending(m_in) > 0;
+}
+
+bool My::OpenSslTlsSession::shutdown(std::vector<char>& out)
+{
+    //It only sends close_notify, without waiting for the one from peer.
+    if (SSL_shutdown(m_ssl) < 0) {
+        log_openssl_error("[OpenSslTlsSession::shutdown] SSL_shutdown failed:");
+        return false;
+    }
+    flush(out);
+    return true;
+}
+
+bool My::OpenSslTlsSession::is_resumed()
+{
+    return SSL_session_reused(m_ssl) == 1;
+}
+
+bool My::OpenSslTlsSession::is_tls13()
+{
+    return SSL_version(m_ssl) == TLS1_3_VERSION;
+}
+
+bool My::TicketKeys::init(std::chrono::seconds period)
+{
+    std::unique_lock<std::shared_mutex> lock(m_lock);
+    m_period = period;
+    m_has_previous = false;
+    return make(m_current);
+}
+
+bool My::TicketKeys::rotate()
+{
+    std::unique_lock<std::shared_mutex> lock(m_lock);
+    return rotate_locked();
+}
+
+bool My::TicketKeys::rotate_locked()
+{
+    Key key;
+    if (!make(key)) {
+        return false;
+    }
+    m_previous = m_current;
+    m_has_previous = true;
+    m_current = key;
+    return true;
+}
+
+bool My::TicketKeys::make(Key& key)
+{
+    if (RAND_bytes(key.name, sizeof(key.name)) != 1 || RAND_bytes(key.aes, sizeof(key.aes)) != 1 ||
+        RAND_bytes(key.hmac, sizeof(key.hmac)) != 1) {
+        log_openssl_error("[TicketKeys::make] RAND_bytes failed:");
+        return false;
+    }
+    key.created = Clock::now();
+    return true;
+}
+
+bool My::TicketKeys::use(const Key& key, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int encrypt)
+{
+    //AES-256-CBC with HMAC-SHA256, the same as the keys OpenSSL makes by itself.
+    char digest[] = "SHA256";
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, (void*)key.hmac, sizeof(key.hmac)),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+        OSSL_PARAM_construct_end()
+    };
+    if (EVP_CipherInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aes, iv, encrypt) != 1 ||
+        EVP_MAC_CTX_set_params(mac, params) != 1) {
+        log_openssl_error("[TicketKeys::use] Setting up the ticket key failed:");
+        return false;
+    }
+    return true;
+}
+
+int My::TicketKeys::on_ticket(unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac,
+    int encrypt)
+{
+    if (encrypt) {
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1) {
+            log_openssl_error("[TicketKeys::on_ticket] RAND_bytes failed:");
+            return -1;
+        }
+        {
+            std::shared_lock<std::shared_mutex> lock(m_lock);
+            if (Clock::now() - m_current.created < m_period) {
+                memcpy(name, m_current.name, sizeof(m_current.name));
+                return use(m_current, iv, cipher, mac, encrypt) ? 1 : -1;
+            }
+        }
+        //The period is over. Only the first thread to see it rotates.
+        std::unique_lock<std::shared_mutex> lock(m_lock);
+        if (Clock::now() - m_current.created >= m_period && !rotate_locked()) {
+            return -1;
+        }
+        memcpy(name, m_current.name, sizeof(m_current.name));
+        return use(m_current, iv, cipher, mac, encrypt) ? 1 : -1;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(m_lock);
+    if (memcmp(name, m_current.name, sizeof(m_current.name)) == 0) {
+        return use(m_current, iv, cipher, mac, encrypt) ? 1 : -1;
+    }
+    //2 tells OpenSSL to take the ticket and issue a new one with the current key.
+    if (m_has_previous && memcmp(name, m_previous.name, sizeof(m_previous.name)) == 0) {
+        return use(m_previous, iv, cipher, mac, encrypt) ? 2 : -1;
+    }
+    //An unknown key, or one rotated out, is not an error but a full handshake.
+    return 0;
+}
+
+My::OpenSslTlsProvider::~OpenSslTlsProvider()
+{
+    SSL_CTX_free(m_server_ctx);
+    SSL_CTX_free(m_client_ctx);
+}
+
+SSL_CTX* My::OpenSslTlsProvider::create_ctx(const SSL_METHOD* method)
+{
+    auto ctx = SSL_CTX_new(method);
+    if (!ctx) {
+        log_openssl_error("[OpenSslTlsProvider::create_ctx] SSL_CTX_new failed:");
+        return nullptr;
+    }
+    //The same protocols as enabled for Schannel, see CredentialCache.
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_max_proto_version(ctx, TLS1_3_VERSION);
+    //A record can be encrypted again from another buffer after a short write, like Schannel.
+    SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    return ctx;
+}
+
+bool My::OpenSslTlsProvider::init_server(const char* cert_file, const char* key_file, bool tickets)
+{
+    if (m_server_ctx) {
+        return true;
+    }
+    auto ctx = create_ctx(TLS_server_method());
+    if (!ctx) {
+        return false;
+    }
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        log_openssl_error("[OpenSslTlsProvider::init_server] Loading certificate failed:");
+        SSL_CTX_free(ctx);
+        return false;
+    }
+    //NOTE: Sessions are resumed by tickets (stateless), whose keys are rotated by m_ticket_keys rather than kept by
+    //OpenSSL for the life of the context, and by session IDs from server_sessions rather than the internal cache,
+    //which is one list under one lock. A key lives as long as a session, so a ticket can be used for the whole
+    //lifetime of its session.
+    if (!tickets) {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    }
+    else if (!m_ticket_keys.init(std::chrono::duration_cast<std::chrono::seconds>(server_session_lifetime)) ||
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, on_ticket) != 1) {
+        log_openssl_error("[OpenSslTlsProvider::init_server] Setting up ticket keys failed:");
+        SSL_CTX_free(ctx);
+        return false;
+    }
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+    static const unsigned char id_context[] = "IocpServer";
+    SSL_CTX_set_session_id_context(ctx, id_context, sizeof(id_context) - 1);
+    SSL_CTX_set_timeout(ctx, (long)std::chrono::seconds(server_session_lifetime).count());
+    SSL_CTX_sess_set_new_cb(ctx, on_new_server_session);
+    SSL_CTX_sess_set_get_cb(ctx, on_get_server_session);
+    SSL_CTX_sess_set_remove_cb(ctx, on_remove_server_session);
+    SSL_CTX_set_app_data(ctx, this);
+    m_server_ctx = ctx;
+    return true;
+}
+
+bool My::OpenSslTlsProvider::init_client()
+{
+    if (m_client_ctx) {
+        return true;
+    }
+    auto ctx = create_ctx(TLS_client_method());
+    if (!ctx) {
+        return false;
+    }
+    //NOTE: The server certificate is not validated, the same as SCH_CRED_MANUAL_CRED_VALIDATION for Schannel.
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, on_new_session);
+    m_client_ctx = ctx;
+    return true;
+}
+
+My::ITlsSession* My::OpenSslTlsProvider::create_server_session()
+{
+    if (!m_server_ctx) {
+        Log::error("[OpenSslTlsProvider::create_server_session] Server is not initialized.");
+        return nullptr;
+    }
+    auto ssl = SSL_new(m_server_ctx);
+    if (!ssl) {
+        log_openssl_error("[OpenSslTlsProvider::create_server_session] SSL_new failed:");
+        return nullptr;
+    }
+    SSL_set_accept_state(ssl);
+    return new OpenSslTlsSession(ssl);
+}
+
+My::ITlsSession* My::OpenSslTlsProvider::create_client_session(const wchar_t* server_name)
+{
+    if (!m_client_ctx) {
+        Log::error("[OpenSslTlsProvider::create_client_session] Client is not initialized.");
+        return nullptr;
+    }
+    auto ssl = SSL_new(m_client_ctx);
+    if (!ssl) {
+        log_openssl_error("[OpenSslTlsProvider::create_client_session] SSL_new failed:");
+        return nullptr;
+    }
+    SSL_set_connect_state(ssl);
+    if (server_name && *server_name) {
+        //Host names are in ASCII.
+        std::wstring wname(server_name);
+        std::string name(wname.begin(), wname.end());
+        SSL_set_tlsext_host_name(ssl, name.c_str());
+
+        std::vector<unsigned char> data;
+        if (client_sessions.get(name, data)) {
+            const unsigned char* p = data.data();
+            auto session = d2i_SSL_SESSION(nullptr, &p, (long)data.size());
+            if (session) {
+                SSL_set_session(ssl, session);
+                SSL_SESSION_free(session);
+            }
+        }
+    }
+    return new OpenSslTlsSession(ssl);
+}
+
+int My::OpenSslTlsProvider::on_new_session(SSL* ssl, SSL_SESSION* session)
+{
+    auto name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (!name) {
+        return 0;
+    }
+    auto data = serialize(session);
+    if (!data.empty()) {
+        client_sessions.put(name, data);
+    }
+    //The session is serialized and not kept.
+    return 0;
+}
+
+int My::OpenSslTlsProvider::on_new_server_session(SSL* ssl, SSL_SESSION* session)
+{
+    auto data = serialize(session);
+    if (!data.empty()) {
+        server_sessions.put(session_id(session), data);
+    }
+    return 0;
+}
+
+SSL_SESSION* My::OpenSslTlsProvider::on_get_server_session(SSL* ssl, const unsigned char* id, int size, int* copy)
+{
+    //The session is made anew from the cache, so OpenSSL takes it without another reference.
+    *copy = 0;
+    std::vector<unsigned char> data;
+    if (!server_sessions.get(std::string((const char*)id, size), data)) {
+        return nullptr;
+    }
+    const unsigned char* p = data.data();
+    return d2i_SSL_SESSION(nullptr, &p, (long)data.size());
+}
+
+void My::OpenSslTlsProvider::on_remove_server_session(SSL_CTX* ctx, SSL_SESSION* session)
+{
+    //A session is removed when it's found expired or broken, or a TLS 1.3 ticket is used, which is good once.
+    server_sessions.remove(session_id(session));
+}
+
+int My::OpenSslTlsProvider::on_ticket(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher,
+    EVP_MAC_CTX* mac, int encrypt)
+{
+    auto provider = (OpenSslTlsProvider*)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    return provider->m_ticket_keys.on_ticket(name, iv, cipher, mac, encrypt);
+}
+
+#endif
@@ -0,0 +1,175 @@
+#pragma once
+
+//The OpenSSL provider is built only with MY_TLS_OPENSSL defined, and OpenSSL in the include and library paths.
+//It has no dependency on Windows, so it can be built and tested on any platform, see OpenSslTlsTest.
+#ifdef MY_TLS_OPENSSL
+
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include "ITlsSession.h"
+#include "SessionCache.h"
+#include <openssl/ssl.h>
+
+namespace My {
+    //A TLS session by OpenSSL. It talks to OpenSSL through a pair of memory BIOs, so that the bytes are carried
+    //by the caller as with Schannel, rather than by OpenSSL on a socket.
+    class OpenSslTlsSession : public ITlsSession
+    {
+    public:
+        //The session owns ssl.
+        explicit OpenSslTlsSession(SSL* ssl);
+
+        OpenSslTlsSession(const OpenSslTlsSession&) = delete;
+
+        OpenSslTlsSession& operator = (const OpenSslTlsSession&) = delete;
+
+        ~OpenSslTlsSession();
+
+        virtual TlsStatus handshake(const char* in, size_t in_size, size_t& consumed, std::vector<char>& out) override;
+
+        virtual const TlsSizes& get_sizes() override {
+            return m_sizes;
+        }
+
+        virtual bool encrypt(const char* data, size_t size, char* out, size_t out_size, size_t& written) override;
+
+        virtual TlsStatus decrypt(char* in, size_t in_size, size_t& consumed, char* plain, size_t plain_size,
+            size_t& written, std::vector<char>& out) override;
+
+        //OpenSSL takes in all input at once, so it may have whole records left after a decrypt.
+        virtual bool has_pending() override;
+
+        virtual bool shutdown(std::vector<char>& out) override;
+
+        virtual bool is_resumed() override;
+
+        virtual bool is_tls13() override;
+
+    private:
+        //Move the bytes OpenSSL has written to the network BIO into out.
+        void flush(std::vector<char>& out);
+
+        bool encrypt_locked(const char* data, size_t size, char* out, size_t out_size, size_t& written);
+
+        SSL* m_ssl;
+        //Network side of the connection. Both are owned by m_ssl.
+        BIO* m_in;
+        BIO* m_out;
+        TlsSizes m_sizes;
+        //An SSL may not be used by two threads at once, so encrypt and decrypt take it in turn. It's only
+        //contended by the send and the receive of the same connection.
+        std::mutex m_lock;
+    };
+
+    //Keys of the session tickets of a server. Tickets are issued with the current key, which is replaced by a new one
+    //once it's older than the rotation period. The previous key is kept only to decrypt the tickets it issued, which
+    //are then renewed with the current key, so a ticket can be decrypted for one to two periods.
+    //
+    //NOTE: It needs OpenSSL 3.0 or later, for SSL_CTX_set_tlsext_ticket_key_evp_cb.
+    class TicketKeys
+    {
+    public:
+        TicketKeys() {}
+
+        TicketKeys(const TicketKeys&) = delete;
+
+        TicketKeys& operator = (const TicketKeys&) = delete;
+
+        //Make the first key. Return false on failure.
+        bool init(std::chrono::seconds period);
+
+        //Make a new current key, and keep the current one as the previous, as when the period is over.
+        bool rotate();
+
+        //The callback of SSL_CTX_set_tlsext_ticket_key_evp_cb, where encrypt is 1 to issue a ticket and 0 to
+        //decrypt one.
+        int on_ticket(unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int encrypt);
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Key {
+            unsigned char name[16];
+            unsigned char aes[32];
+            unsigned char hmac[32];
+            Clock::time_point created;
+        };
+
+        static bool make(Key& key);
+
+        //Set up cipher and mac for the key. Return false on failure.
+        static bool use(const Key& key, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int encrypt);
+
+        //Must be called with the lock held exclusively.
+        bool rotate_locked();
+
+        std::shared_mutex m_lock;
+        Key m_current = {};
+        Key m_previous = {};
+        bool m_has_previous = false;
+        std::chrono::seconds m_period = std::chrono::seconds(0);
+    };
+
+    //Server sessions use one certificate, with no SNI selection. They're resumed by stateless tickets, or by
+    //session IDs from a SessionCache shared by all workers, which takes the place of the internal cache of OpenSSL.
+    //Client sessions are resumed from another SessionCache, keyed by server name.
+    class OpenSslTlsProvider : public ITlsProvider
+    {
+    public:
+        OpenSslTlsProvider() {}
+
+        OpenSslTlsProvider(const OpenSslTlsProvider&) = delete;
+
+        OpenSslTlsProvider& operator = (const OpenSslTlsProvider&) = delete;
+
+        ~OpenSslTlsProvider();
+
+        //cert_file is the PEM certificate chain, and key_file the PEM private key. A self-signed certificate
+        //works as well, like a client with Schannel doesn't validate the server certificate either. With no
+        //tickets, all sessions are resumed by session IDs from the cache, including TLS 1.3 ones, whose tickets are
+        //then just IDs of the cache.
+        bool init_server(const char* cert_file, const char* key_file, bool tickets = true);
+
+        //Rotate the keys of the session tickets ahead of the period, like when a key may have leaked. It's for a
+        //server, which rotates them by itself.
+        bool rotate_ticket_keys() {
+            return m_ticket_keys.rotate();
+        }
+
+        //The cache of server sessions, for its size and hit rate
+        static const SessionCache& get_server_sessions() {
+            return server_sessions;
+        }
+
+        bool init_client();
+
+        virtual ITlsSession* create_server_session() override;
+
+        virtual ITlsSession* create_client_session(const wchar_t* server_name) override;
+
+    private:
+        static SSL_CTX* create_ctx(const SSL_METHOD* method);
+
+        static int on_new_session(SSL* ssl, SSL_SESSION* session);
+
+        //Callbacks of the server cache, by session ID
+        static int on_new_server_session(SSL* ssl, SSL_SESSION* session);
+
+        static SSL_SESSION* on_get_server_session(SSL* ssl, const unsigned char* id, int size, int* copy);
+
+        static void on_remove_server_session(SSL_CTX* ctx, SSL_SESSION* session);
+
+        static int on_ticket(SSL* ssl, unsigned char* name, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac,
+            int encrypt);
+
+        SSL_CTX* m_server_ctx = nullptr;
+        SSL_CTX* m_client_ctx = nullptr;
+        TicketKeys m_ticket_keys;
+
+        static SessionCache client_sessions;
+        static SessionCache server_sessions;
+    };
+}
+
+#endif
@@ -1,26 +1,16 @@
 #include "SecureSocket.h"
-#include "Certificate.h"
-#include <schannel.h>
+#include "SspiTls.h"
+#include "HandshakeStats.h"
 #include <vector>
 #include <cstring>
 #include <cassert>
 #include "Log.h"
 
-#pragma comment(lib, "Secur32.lib")
-
-PSecurityFunctionTable My::SecureSocket::sspi = nullptr;
-
 My::SecureSocket::~SecureSocket()
 {
     Log::info("[SecureSocket::~SecureSocket]");
     m_secured = false;
-    if (sspi) {
-        sspi->DeleteSecurityContext(&m_ctx);
-        sspi->FreeCredentialsHandle(&m_cred);
-    }
-    if (m_cert) {
-        Certificate::free(m_cert);
-    }
+    delete m_session;
 }
 
 //If init failed, the state of the object is undefined. Then a new object should be used to make
@@ -30,729 +20,228 @@ bool My::SecureSocket::init()
     if (m_secured) {
         return true;
     }
-    //NOTE: A server name can be got by Server Name Indication(SNI) from a client in handshake. And
-    //that requires parsing the ClientHello message and thus the knowledge of TLS record protocal.
-    //Here we simplify the procedure by using a fixed name no matter what name the client requests.
-    //And a client can refuse the server for a different name from the requested one, or accept it.
-    //That depends on the client's choice, like accepting a self-issued certificate.
-    if (m_server && !m_server_name) {
-        //For server socket, a name is required to get a certificate associated with the name.
+    //NOTE: When a CredentialTable is given, a server picks its certificate by the Server Name Indication(SNI)
+    //in the ClientHello message. Otherwise it uses a fixed name no matter what name the client requests. And
+    //a client can refuse the server for a different name from the requested one, or accept it. That depends
+    //on the client's choice, like accepting a self-issued certificate.
+    if (m_server && !m_server_name && !m_creds && !m_provider) {
+        //For server socket, a name or a table is required to get a certificate.
         //For client socket, it's optional.
         return false;
     }
-    if (!sspi) {
-        sspi = InitSecurityInterface();
-        if (!sspi) {
+    if (!m_session) {
+        m_session = create_session();
+        if (!m_session) {
             return false;
         }
     }
-    return m_server ? create_server_cred() && negotiate_as_server() :
-        create_client_cred() &&  negotiate_as_client();
+    return negotiate();
 }
 
-int My::SecureSocket::max_message_size()
+My::ITlsSession* My::SecureSocket::create_session()
 {
-    return m_size.cbMaximumMessage;
-}
-
-//When buf is too big to be sent in one message, just send as much buf as possible in one message.
-int My::SecureSocket::send(const char* buf, int length)
-{
-    if (length == 0) {
-        //Allow sending zero-size buf, do nothing.
-        return 0;
+    if (m_provider) {
+        return m_server ? m_provider->create_server_session() : m_provider->create_client_session(m_server_name);
     }
-
-    if (!m_secured || !buf || length < 0) {
-        return -1;
+    if (m_server) {
+        return m_creds ? SspiTlsSession::create_server(m_creds) : SspiTlsSession::create_server(m_server_name);
     }
+    return SspiTlsSession::create_client(m_server_name);
+}
 
-    int send_length = max_payload();
-    if (send_length > length) {
-        send_length = length;
-    }
-
-    std::vector<char> send_buf(send_length + m_size.cbHeader + m_size.cbTrailer);
-    memcpy(send_buf.data() + m_size.cbHeader, buf, send_length);
-
-    SecBuffer out_buf[4];
-    SecBufferDesc msg;
-
-    msg.ulVersion = SECBUFFER_VERSION;
-    msg.cBuffers = 4;
-    msg.pBuffers = out_buf;
-
-    out_buf[0].pvBuffer = send_buf.data();
-    out_buf[0].cbBuffer = m_size.cbHeader;
-    out_buf[0].BufferType = SECBUFFER_STREAM_HEADER;
-
-    out_buf[1].pvBuffer = send_buf.data() + m_size.cbHeader;
-    out_buf[1].cbBuffer = send_length;
-    out_buf[1].BufferType = SECBUFFER_DATA;
-
-    out_buf[2].pvBuffer = send_buf.data() + m_size.cbHeader + send_length;
-    out_buf[2].cbBuffer = m_size.cbTrailer;
-    out_buf[2].BufferType = SECBUFFER_STREAM_TRAILER;
-
-    out_buf[3].BufferType = SECBUFFER_EMPTY;
-
-    auto status = sspi->EncryptMessage(&m_ctx, 0, &msg, 0);
-    int result = -1;
-    if (SUCCEEDED(status))
-    {
-        int total = out_buf[0].cbBuffer + out_buf[1].cbBuffer + out_buf[2].cbBuffer;
-        int sent = Socket::send(send_buf.data(), total);
-        if (sent == total) {
-            result = send_length;
-        }
-        else {
-            Log::error("[SecureSocket::send] Socket::send failed with: ", sent, ". Total bytes to send: ", total);
-        }
-    }
-    else {
-        Log::error("[SecureSocket::send] EncryptMessage failed with error: ", status);
-    }
-    return result;
+int My::SecureSocket::max_message_size()
+{
+    return (int)m_sizes.max_message;
 }
 
-//The caller should call max_message_size first and ensure the buf is at least that big, otherwise receive may fail
-//due to short buf and lose the current and next messages.
-int My::SecureSocket::receive(char* buf, int length)
+bool My::SecureSocket::send_all(const std::vector<char>& out)
 {
-    if (!m_secured || !buf || length <= 0) {
-        return -1;
+    if (out.empty()) {
+        return true;
     }
-
-    //NOTE: according to https://docs.microsoft.com/en-us/windows/win32/secauthn/decryptmessage--schannel
-    //there should only be 2 buffers here, and the second must be of type SECBUFFER_TOKEN with a "security token"(what?).
-    SecBuffer in_buf[4];
-    SecBufferDesc msg;
-    msg.ulVersion = SECBUFFER_VERSION;
-    msg.cBuffers = 4;
-    msg.pBuffers = in_buf;
-
-    SECURITY_STATUS status = SEC_E_INCOMPLETE_MESSAGE;
-
-    auto read = m_buf.size();
-    if (read > 0) {
-        //There are already some (extra) content received in buffer in previous call of receive, or from negotiation.
-        in_buf[0].pvBuffer = m_buf.data();
-        in_buf[0].cbBuffer = (unsigned long)read;
-        in_buf[0].BufferType = SECBUFFER_DATA;
-        in_buf[1].BufferType = SECBUFFER_EMPTY;
-        in_buf[2].BufferType = SECBUFFER_EMPTY;
-        in_buf[3].BufferType = SECBUFFER_EMPTY;
-
-        status = sspi->DecryptMessage(&m_ctx, &msg, 0, nullptr);
-        Log::info("[SecureSocket::receive] DecryptMessage: ", status);
+    int sent = Socket::send(out.data(), (int)out.size());
+    if (sent != (int)out.size()) {
+        Log::error("[SecureSocket::send_all] sent: ", sent, " total: ", out.size());
+        return false;
     }
+    return true;
+}
 
-    while (status == SEC_E_INCOMPLETE_MESSAGE)
-    {
-        if (read == m_buf.size()) {
-            std::size_t to_size = m_buf.size() * 2;
-            if (to_size < init_buf_size) {
-                to_size = init_buf_size;
-            }
-            m_buf.resize(to_size);
-        }
-
-        int received = Socket::receive(m_buf.data() + read, (int)(m_buf.size() - read));
-        if (received <= 0) {
-            Log::error("[SecureSocket::receive] Socket::receive failed with: ", received);
-            break;
+bool My::SecureSocket::negotiate()
+{
+    const char* role = m_server ? "server" : "client";
+    std::vector<char> out;
+    size_t read = 0;
+    size_t consumed = 0;
+    auto status = TlsStatus::Incomplete;
+
+    if (!m_server) {
+        //Client speaks first, with the ClientHello message.
+        Log::info("[SecureSocket::negotiate] Sending ClientHello message...");
+        status = m_session->handshake(nullptr, 0, consumed, out);
+        if (status != TlsStatus::Continue || !send_all(out)) {
+            Log::error("[SecureSocket::negotiate] Failed sending ClientHello message.");
+            return false;
         }
-        read += received;
-
-        in_buf[0].pvBuffer = m_buf.data();
-        in_buf[0].cbBuffer = (unsigned long)read;
-        in_buf[0].BufferType = SECBUFFER_DATA;
-        in_buf[1].BufferType = SECBUFFER_EMPTY;
-        in_buf[2].BufferType = SECBUFFER_EMPTY;
-        in_buf[3].BufferType = SECBUFFER_EMPTY;
-
-        status = sspi->DecryptMessage(&m_ctx, &msg, 0, nullptr);
-        Log::info("[SecureSocket::receive] DecryptMessage: ", status);
     }
 
-    int result = -1;
-    if (status == SEC_E_OK)
-    {
-        PSecBuffer data_buf = nullptr;
-        for (int i = 1; i < 4; i++) //NOTE: Why from 1, not 0?
-        {
-            if (in_buf[i].BufferType == SECBUFFER_DATA)
-            {
-                data_buf = &in_buf[i];
+    while (status == TlsStatus::Continue || status == TlsStatus::Incomplete) {
+        //Read more unless some input is left and the last call made progress with it.
+        if (status == TlsStatus::Incomplete || read == 0 || consumed == 0) {
+            grow_buf_when_full(read);
+            int received = Socket::receive(m_buf.data() + read, (int)(m_buf.size() - read));
+            if (received <= 0) {
+                Log::error("[SecureSocket::negotiate] Socket::receive failed with: ", received);
+                status = TlsStatus::Error;
                 break;
             }
+            read += received;
         }
 
-        if (data_buf)
-        {
-            if (data_buf->cbBuffer > (unsigned long)length) {
-                //NOTE: Is there a way to avoid/alleviate the short-buffer problem?
-                Log::error("[SecureSocket::receive] Input buffer is not big enough. At least ", data_buf->cbBuffer, " bytes is required.");
-            }
-            else {
-                //NOTE: It seems the data_buf->pvBuffer points to an address in our m_buf.
-                //Also note that data_buf->cbBuffer can be 0, according to the document. HOWEVER, receiving zero-size buf
-                //is a sign of SHUTDOWN for plain socket recv call. And we'd better have ISocket::receive the same semantics
-                //no matter of its implementation.
-                if (data_buf->cbBuffer == 0) {
-                    Log::warn("[SecureSocket::receive] received zero-size message payload.");
-                }
-                memcpy(buf, data_buf->pvBuffer, data_buf->cbBuffer);
-                result = data_buf->cbBuffer;
-
-                //Save extra content read in buf
-                PSecBuffer extra_buf = nullptr;
-                for (int i = 1; i < 4; i++)
-                {
-                    if (in_buf[i].BufferType == SECBUFFER_EXTRA)
-                    {
-                        extra_buf = &in_buf[i];
-                        break;
-                    }
-                }
-                if (extra_buf)
-                {
-                    Log::info("[SecureSocket::receive] Extra content of ", extra_buf->cbBuffer, " bytes is detected.");
-                    //NOTE: Here memmove is used, rather than memcpy, because there may be overlap in src and dst.
-                    assert(extra_buf->pvBuffer == m_buf.data() + read - extra_buf->cbBuffer);
-                    memmove(m_buf.data(), extra_buf->pvBuffer, extra_buf->cbBuffer);
-                    m_buf.resize(extra_buf->cbBuffer);
-                }
-                else {
-                    m_buf.clear();
-                }
-            }
-        }
-    }
-    else if (status == SEC_I_CONTEXT_EXPIRED) {
-        Log::info("[SecureSocket::receive] SEC_I_CONTEXT_EXPIRED is received!");
-        //TLS is shutting down.
-        //NOTE: The document says we need to shutdown the TLS session:
-        //https://docs.microsoft.com/en-us/windows/win32/secauthn/shutting-down-an-schannel-connection
-        //However we simply skip the shutdown operation here and just mark the socket as "down".
-        m_secured = false;
-        result = -2;
-    }
-    else if (status == SEC_I_RENEGOTIATE) {
-        Log::info("[SecureSocket::receive] SEC_I_RENEGOTIATE is received!");
-        //NOTE: Renegotiation is not supported. User should shutdown the session in this case.
-        m_secured = false;
-        result = -3;
-    }
-    else {
-        Log::error("[SecureSocket::receive] DecryptMessage failed with error: ", status);
-    }
-    if (result < 0) {
-        m_buf.clear();
-    }
-    return result;
-}
-
-void My::SecureSocket::shutdown()
-{
-    DWORD dwType = SCHANNEL_SHUTDOWN;
-    SecBuffer out_buf[1];
-    SecBufferDesc out_buf_desc;
-    SECURITY_STATUS status;
-
-    out_buf[0].pvBuffer = &dwType;
-    out_buf[0].BufferType = SECBUFFER_TOKEN;
-    out_buf[0].cbBuffer = sizeof(dwType);
-
-    out_buf_desc.cBuffers = 1;
-    out_buf_desc.pBuffers = out_buf;
-    out_buf_desc.ulVersion = SECBUFFER_VERSION;
-
-    status = sspi->ApplyControlToken(&m_ctx, &out_buf_desc);
-    if (SUCCEEDED(status))
-    {
-        DWORD req_context_flags;
-        if (m_server) {
-            req_context_flags = ASC_REQ_ALLOCATE_MEMORY | ASC_REQ_CONFIDENTIALITY | ASC_REQ_EXTENDED_ERROR |
-                ASC_REQ_REPLAY_DETECT | ASC_REQ_SEQUENCE_DETECT | ASC_REQ_STREAM;
-        }
-        else {
-            req_context_flags = ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_CONFIDENTIALITY | ISC_REQ_EXTENDED_ERROR |
-                ISC_REQ_REPLAY_DETECT | ISC_REQ_SEQUENCE_DETECT | ISC_REQ_STREAM;
-        }
-        DWORD ret_context_flags;
-        TimeStamp ts;
-
-        out_buf[0].pvBuffer = nullptr;
-        out_buf[0].BufferType = SECBUFFER_TOKEN;
-        out_buf[0].cbBuffer = 0;
-
-        out_buf_desc.cBuffers = 1;
-        out_buf_desc.pBuffers = out_buf;
-        out_buf_desc.ulVersion = SECBUFFER_VERSION;
-
-        //NOTE: It seems we need to a loop of calls to AcceptSecurityContext, according to
-        //https://docs.microsoft.com/en-us/windows/win32/secauthn/shutting-down-an-schannel-connection
-        //However we simply call it once here.
-        if (m_server) {
-            status = sspi->AcceptSecurityContext(
-                &m_cred,
-                &m_ctx,
-                nullptr,
-                req_context_flags,
-                0,
-                nullptr,
-                &out_buf_desc,
-                &ret_context_flags,
-                &ts
-            );
-            if (FAILED(status)) {
-                Log::warn("[SecureSocket::shutdown] AcceptSecurityContext failed with: ", status);
-            }
+        out.clear();
+        status = m_session->handshake(m_buf.data(), read, consumed, out);
+        if (!send_all(out)) {
+            status = TlsStatus::Error;
+            break;
         }
-        else {
-            status = sspi->InitializeSecurityContext(
-                &m_cred,
-                &m_ctx,
-                nullptr,
-                req_context_flags,
-                0,
-                0,
-                nullptr,
-                0,
-                nullptr,
-                &out_buf_desc,
-                &ret_context_flags,
-                &ts
-            );
-            if (FAILED(status)) {
-                Log::warn("[SecureSocket::shutdown] InitializeSecurityContext failed with: ", status);
-            }
+        if (consumed) {
+            //NOTE: Here memmove is used, rather than memcpy, because there may be overlap in src and dst.
+            memmove(m_buf.data(), m_buf.data() + consumed, read - consumed);
+            read -= consumed;
         }
+    }
 
-        if (out_buf[0].pvBuffer != nullptr && out_buf[0].cbBuffer != 0)
-        {
-            int sent = Socket::send((const char *)out_buf[0].pvBuffer, out_buf[0].cbBuffer);
-            sspi->FreeContextBuffer(out_buf[0].pvBuffer);
-            if (sent != out_buf[0].cbBuffer) {
-                Log::warn("[SecureSocket::shutdown] send: ", sent, " total: ", out_buf[0].cbBuffer);
-            }
-        }
+    if (status != TlsStatus::Ok) {
+        Log::error("[SecureSocket::negotiate] Handshake as ", role, " failed.");
+        //Clear any content in buffer
+        m_buf.clear();
+        return false;
     }
-    else {
-        Log::warn("[SecureSocket::shutdown] ApplyControlToken failed with: ", status);
+    if (read) {
+        Log::info("[SecureSocket::negotiate] Extra content of ", read, " bytes is detected.");
     }
-    m_secured = false;
-    Socket::shutdown();
+    //Save any extra content read in
+    m_buf.resize(read);
+    m_sizes = m_session->get_sizes();
+    m_secured = true;
+    HandshakeStats::record(m_session);
+    return true;
 }
 
-bool My::SecureSocket::negotiate_as_server()
+//When buf is too big to be sent in one message, just send as much buf as possible in one message.
+int My::SecureSocket::send(const char* buf, int length)
 {
-    bool ok = false;
-    int read = 0;
-
-    while (true) {
-        //Increase buffer when necessary
-        if (read == m_buf.size()) {
-            auto to_size = m_buf.size() * 2;
-            if (to_size < init_buf_size) {
-                to_size = init_buf_size;
-            }
-            m_buf.resize(to_size);
-        }
-
-        //Read in buffer
-        int received = Socket::receive(m_buf.data() + read, (int)(m_buf.size() - read));
-        if (received <= 0)
-            break;
-        read += received;
-
-        Log::info("[SecureSocket::negotiate_as_server] received:");
-        Log::mem(m_buf.data(), read);
-
-        //AcceptSecurityContext
-        DWORD req_context_flags = ASC_REQ_ALLOCATE_MEMORY | ASC_REQ_CONFIDENTIALITY | ASC_REQ_EXTENDED_ERROR |
-            ASC_REQ_REPLAY_DETECT | ASC_REQ_SEQUENCE_DETECT | ASC_REQ_STREAM;
-        DWORD ret_context_flags = 0;
-        TimeStamp ts;
-
-        //NOTE: Shall we have a third in-buffer of type SECBUFFER_ALERT as said in
-        //https://docs.microsoft.com/en-us/windows/win32/secauthn/acceptsecuritycontext--schannel ?
-        SecBuffer in_buf[2];
-        SecBuffer out_buf[1];
-        SecBufferDesc in_buf_desc;
-        SecBufferDesc out_buf_desc;
-
-        in_buf[0].pvBuffer = m_buf.data();
-        in_buf[0].cbBuffer = read;
-        in_buf[0].BufferType = SECBUFFER_TOKEN;
-
-        in_buf[1].pvBuffer = nullptr;
-        in_buf[1].cbBuffer = 0;
-        in_buf[1].BufferType = SECBUFFER_EMPTY;
-
-        out_buf[0] = {};
-
-        in_buf_desc.cBuffers = 2;
-        in_buf_desc.pBuffers = in_buf;
-        in_buf_desc.ulVersion = SECBUFFER_VERSION;
-
-        out_buf_desc.cBuffers = 1;
-        out_buf_desc.pBuffers = out_buf;
-        out_buf_desc.ulVersion = SECBUFFER_VERSION;
-
-        auto status = sspi->AcceptSecurityContext(
-            &m_cred,
-            m_ctx.dwLower != 0 || m_ctx.dwUpper != 0 ? &m_ctx : nullptr,
-            &in_buf_desc,
-            req_context_flags,
-            0,
-            m_ctx.dwLower != 0 || m_ctx.dwUpper != 0 ? nullptr : &m_ctx,
-            &out_buf_desc,
-            &ret_context_flags,
-            &ts
-        );
-
-        //Send content in out_buf if any
-        if (out_buf[0].cbBuffer != 0 && out_buf[0].pvBuffer != nullptr)
-        {
-            Log::info("[SecureSocket::negotiate_as_server] send:");
-            Log::mem(out_buf[0].pvBuffer, out_buf[0].cbBuffer);
-
-            auto sent = Socket::send((char *)out_buf[0].pvBuffer, out_buf[0].cbBuffer);
-            sspi->FreeContextBuffer(out_buf[0].pvBuffer);
-            if (sent != out_buf[0].cbBuffer) {
-                Log::error("[SecureSocket::negotiate_as_server] sent: ", sent, " total: ", out_buf[0].cbBuffer);
-                break;
-            }
-        }
-
-        if (status == SEC_E_INCOMPLETE_MESSAGE) {
-            Log::info("[SecureSocket::negotiate_as_server] SEC_E_INCOMPLETE_MESSAGE");
-            //Continue to read more...
-            continue;
-        }
-
-        if (status == SEC_I_CONTINUE_NEEDED) {
-            Log::info("[SecureSocket::negotiate_as_server] SEC_I_CONTINUE_NEEDED");
-            if (in_buf[1].BufferType == SECBUFFER_EXTRA) {
-                Log::error("[SecureSocket::negotiate_as_server] Extra content of ", in_buf[1].cbBuffer, " bytes is detected.");
-                break;
-            }
-            else {
-                read = 0;
-                continue;
-            }
-        }
-
-        if (status == SEC_E_OK)
-        {
-            Log::info("[SecureSocket::negotiate_as_server] SEC_E_OK");
-            if (in_buf[1].BufferType == SECBUFFER_EXTRA) {
-                Log::info("[SecureSocket::negotiate_as_server] Extra content of ", in_buf[1].cbBuffer, " bytes is detected.");
-                //Save any extra content read in
-                //NOTE: Here memmove is used, rather than memcpy, because there may be overlap in src and dst.
-                memmove(m_buf.data(), m_buf.data() + read - in_buf[1].cbBuffer, in_buf[1].cbBuffer);
-                m_buf.resize(in_buf[1].cbBuffer);
-            }
-            else {
-                m_buf.clear();
-            }
-            ok = true;
-            break;
-        }
+    if (length == 0) {
+        //Allow sending zero-size buf, do nothing.
+        return 0;
+    }
 
-        Log::error("[SecureSocket::negotiate_as_server] AcceptSecurityContext failed with: ", status);
-        break;
+    if (!m_secured || !buf || length < 0) {
+        return -1;
     }
 
-    if (ok) {
-        auto status = sspi->QueryContextAttributes(&m_ctx, SECPKG_ATTR_STREAM_SIZES, &m_size);
-        if (status == SEC_E_OK) {
-            m_secured = true;
-        }
-        else {
-            Log::error("[SecureSocket::negotiate_as_server] QueryContextAttributes failed with: ", status);
-            ok = false;
-        }
+    size_t send_length = m_sizes.max_payload();
+    if (send_length > (size_t)length) {
+        send_length = length;
     }
 
-    if (!ok) {
-        //Clear any content in buffer
-        m_buf.clear();
+    std::vector<char> send_buf(send_length + m_sizes.header + m_sizes.trailer);
+    size_t total = 0;
+    if (!m_session->encrypt(buf, send_length, send_buf.data(), send_buf.size(), total)) {
+        Log::error("[SecureSocket::send] Encryption failed.");
+        return -1;
+    }
+    int sent = Socket::send(send_buf.data(), (int)total);
+    if (sent != (int)total) {
+        Log::error("[SecureSocket::send] Socket::send failed with: ", sent, ". Total bytes to send: ", total);
+        return -1;
     }
-    return ok;
+    return (int)send_length;
 }
 
-bool My::SecureSocket::negotiate_as_client()
+//The caller should call max_message_size first and ensure the buf is at least that big, otherwise receive may fail
+//due to short buf and lose the current and next messages.
+int My::SecureSocket::receive(char* buf, int length)
 {
-    if (!send_client_hello()) {
-        return false;
+    if (!m_secured || !buf || length <= 0) {
+        return -1;
     }
 
-    bool ok = false;
-    int read = 0;
+    //There may be already some (extra) content received in buffer in previous call of receive, or from negotiation.
+    size_t read = m_buf.size();
+    int result = -1;
+    std::vector<char> out;
 
     while (true) {
-        //Increase buffer when necessary
-        if (read == m_buf.size()) {
-            auto to_size = m_buf.size() * 2;
-            if (to_size < init_buf_size) {
-                to_size = init_buf_size;
+        auto status = TlsStatus::Incomplete;
+        size_t consumed = 0;
+        size_t written = 0;
+        if (read > 0 || m_session->has_pending()) {
+            out.clear();
+            status = m_session->decrypt(m_buf.data(), read, consumed, buf, length, written, out);
+            Log::info("[SecureSocket::receive] decrypt: ", (int)status);
+            if (!send_all(out)) {
+                break;
+            }
+            if (consumed) {
+                //NOTE: Here memmove is used, rather than memcpy, because there may be overlap in src and dst.
+                memmove(m_buf.data(), m_buf.data() + consumed, read - consumed);
+                read -= consumed;
             }
-            m_buf.resize(to_size);
         }
 
-        //Read in buffer
-        int received = Socket::receive(m_buf.data() + read, (int)(m_buf.size() - read));
-        if (received <= 0)
-            break;
-        read += received;
-
-        //InitializeSecurityContext
-        //NOTE: Should we use the returned context flags from send_client_hello?
-        DWORD req_flags = ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_CONFIDENTIALITY | ISC_REQ_EXTENDED_ERROR |
-            ISC_REQ_REPLAY_DETECT | ISC_REQ_SEQUENCE_DETECT | ISC_REQ_STREAM |
-            ISC_REQ_MANUAL_CRED_VALIDATION; // Allow manual validation of server certificate.
-        DWORD ret_flags = 0;
-        TimeStamp ts;
-
-        SecBuffer in_buf[2];
-        SecBuffer out_buf[1];
-        SecBufferDesc in_buf_desc;
-        SecBufferDesc out_buf_desc;
-
-        in_buf[0].pvBuffer = m_buf.data();
-        in_buf[0].cbBuffer = read;
-        in_buf[0].BufferType = SECBUFFER_TOKEN;
-
-        in_buf[1].pvBuffer = nullptr;
-        in_buf[1].cbBuffer = 0;
-        in_buf[1].BufferType = SECBUFFER_EMPTY;
-
-        in_buf_desc.cBuffers = 2;
-        in_buf_desc.pBuffers = in_buf;
-        in_buf_desc.ulVersion = SECBUFFER_VERSION;
-
-        out_buf[0].pvBuffer = nullptr;
-        out_buf[0].BufferType = SECBUFFER_TOKEN;
-        out_buf[0].cbBuffer = 0;
-
-        out_buf_desc.cBuffers = 1;
-        out_buf_desc.pBuffers = out_buf;
-        out_buf_desc.ulVersion = SECBUFFER_VERSION;
-
-        auto status = sspi->InitializeSecurityContext(
-            &m_cred,
-            &m_ctx,
-            nullptr,
-            req_flags,
-            0,
-            0,
-            &in_buf_desc,
-            0,
-            nullptr,
-            &out_buf_desc,
-            &ret_flags,
-            &ts
-        );
-
-        //Send content in out_buf if any
-        if (out_buf[0].cbBuffer != 0 && out_buf[0].pvBuffer)
-        {
-            int sent = Socket::send((char *)out_buf[0].pvBuffer, out_buf[0].cbBuffer);
-            sspi->FreeContextBuffer(out_buf[0].pvBuffer);
-            if (sent != out_buf[0].cbBuffer)
-            {
-                Log::error("[SecureSocket::negotiate_as_client] sent: ", sent, " total: ", out_buf[0].cbBuffer);
-                break;
+        if (status == TlsStatus::Ok) {
+            //NOTE: written can be 0, according to the document. HOWEVER, receiving zero-size buf is a sign of
+            //SHUTDOWN for plain socket recv call. And we'd better have ISocket::receive the same semantics
+            //no matter of its implementation.
+            if (written == 0) {
+                Log::warn("[SecureSocket::receive] received zero-size message payload.");
             }
+            result = (int)written;
+            break;
         }
-
-        //Here we can validate server certificate by QueryContextAttributes with SECPKG_ATTR_REMOTE_CERT_CONTEXT.
-        //If we don't do validation, then we accept any certificate server sent.
-        //
-        //PCCERT_CONTEXT server_cert = nullptr;
-        //HRESULT hr = sspi->QueryContextAttributes(&m_cred, SECPKG_ATTR_REMOTE_CERT_CONTEXT, &server_cert);
-        //if (SUCCEEDED(hr)) {
-        //    //Validate sever_cert here...
-        //}
-
-        //if status == SEC_I_INCOMPLETE_CREDENTIALS, it means server is requesting a client certificate.
-        //Then we need to build a new client CredHandle with a certificate, and call InitializeSecurityContext
-        //with the new CredHandle hereafter.
-
-        if (status == SEC_E_INCOMPLETE_MESSAGE) {
-            Log::info("[SecureSocket::negotiate_as_client] SEC_E_INCOMPLETE_MESSAGE");
+        if (status == TlsStatus::Continue) {
+            //A post-handshake message is processed. Go on with what's left.
             continue;
         }
-
-        if (status == SEC_I_CONTINUE_NEEDED) {
-            Log::info("[SecureSocket::negotiate_as_client] SEC_I_CONTINUE_NEEDED");
-            if (in_buf[1].BufferType == SECBUFFER_EXTRA) {
-                Log::error("[SecureSocket::negotiate_as_client] Extra content of ", in_buf[1].cbBuffer, " bytes is detected.");
+        if (status == TlsStatus::Incomplete) {
+            grow_buf_when_full(read);
+            int received = Socket::receive(m_buf.data() + read, (int)(m_buf.size() - read));
+            if (received <= 0) {
+                Log::error("[SecureSocket::receive] Socket::receive failed with: ", received);
                 break;
             }
-            else {
-                read = 0;
-                continue;
-            }
+            read += received;
+            continue;
         }
-
-        if (status == SEC_E_OK)
-        {
-            Log::info("[SecureSocket::negotiate_as_client] SEC_E_OK");
-            if (in_buf[1].BufferType == SECBUFFER_EXTRA) {
-                Log::info("[SecureSocket::negotiate_as_client] Extra content of ", in_buf[1].cbBuffer, " bytes is detected.");
-                //Save any extra content read in
-                //NOTE: Here memmove is used, rather than memcpy, because there may be overlap in src and dst.
-                memmove(m_buf.data(), m_buf.data() + read - in_buf[1].cbBuffer, in_buf[1].cbBuffer);
-                m_buf.resize(in_buf[1].cbBuffer);
-            }
-            else {
-                m_buf.clear();
-            }
-            ok = true;
+        if (status == TlsStatus::Closed) {
+            Log::info("[SecureSocket::receive] TLS session is closed by peer!");
+            //TLS is shutting down.
+            m_secured = false;
+            result = -2;
             break;
         }
-
-        Log::error("[SecureSocket::negotiate_as_client] InitializeSecurityContext failed with: ", status);
+        Log::error("[SecureSocket::receive] decrypt failed!");
         break;
     }
 
-    if (ok) {
-        auto status = sspi->QueryContextAttributes(&m_ctx, SECPKG_ATTR_STREAM_SIZES, &m_size);
-        if (status == SEC_E_OK) {
-            m_secured = true;
-        }
-        else {
-            Log::error("[SecureSocket::negotiate_as_client] QueryContextAttributes failed with: ", status);
-            ok = false;
-        }
-    }
-
-    if (!ok) {
-        //Clear any content in buffer
+    if (result < 0) {
         m_buf.clear();
     }
-    return ok;
-}
-
-//Also get m_ctx for client.
-bool My::SecureSocket::send_client_hello()
-{
-    DWORD req_flags = ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_CONFIDENTIALITY | ISC_REQ_EXTENDED_ERROR |
-        ISC_REQ_REPLAY_DETECT | ISC_REQ_SEQUENCE_DETECT | ISC_REQ_STREAM |
-        ISC_REQ_MANUAL_CRED_VALIDATION; // Allow manual validation of server certificate.
-
-    TimeStamp ts;
-    SecBuffer out_buf[1];
-    SecBufferDesc out_buf_desc;
-
-    out_buf[0].pvBuffer = nullptr;
-    out_buf[0].BufferType = SECBUFFER_TOKEN;
-    out_buf[0].cbBuffer = 0;
-
-    out_buf_desc.cBuffers = 1;
-    out_buf_desc.pBuffers = out_buf;
-    out_buf_desc.ulVersion = SECBUFFER_VERSION;
-
-    auto status = sspi->InitializeSecurityContextW(
-        &m_cred,
-        nullptr,
-        const_cast<wchar_t *>(m_server_name),
-        req_flags,
-        0,
-        0,
-        nullptr,
-        0,
-        &m_ctx,
-        &out_buf_desc,
-        &req_flags,
-        &ts
-    );
-
-    bool ok = false;
-    if (status == SEC_I_CONTINUE_NEEDED && out_buf[0].cbBuffer > 0 && out_buf[0].pvBuffer)
-    {
-        Log::info("[SecureSocket::send_client_hello] Sending ClientHello message...");
-        int sent = Socket::send((char*)out_buf[0].pvBuffer, out_buf[0].cbBuffer);
-        sspi->FreeContextBuffer(out_buf[0].pvBuffer);
-        if (sent == out_buf[0].cbBuffer)
-        {
-            ok = true;
-        }
-    }
     else {
-        Log::error("[SecureSocket::send_client_hello] InitializeSecurityContextW failed with: ", status);
+        m_buf.resize(read);
     }
-    return ok;
+    return result;
 }
 
-bool My::SecureSocket::create_server_cred()
+void My::SecureSocket::shutdown()
 {
-    m_cert = Certificate::get(m_server_name);
-    if (!m_cert) {
-        //TODO: Log can output wstring.
-        Log::error("[SecureSocket::create_server_cred] Server certificate is not found!");
-        return false;
-    }
-    SCHANNEL_CRED schannel_cred{};
-    TimeStamp ts;
-    schannel_cred.dwVersion = SCHANNEL_CRED_VERSION;
-    schannel_cred.cCreds = 1;
-    schannel_cred.paCred = &m_cert;
-    //NOTE: by https://docs.microsoft.com/en-us/windows/win32/api/schannel/ns-schannel-schannel_cred
-    //"
-    //If this member is zero, Schannel selects the protocol. For new development, applications should
-    //set grbitEnabledProtocols to zero and use the protocol versions enabled on the system by default.
-    //This member is used only by the Microsoft Unified Security Protocol Provider security package.
-    //The global system registry settings take precedence over this value. For example, if SSL3 is
-    //disabled in the registry, it cannot be enabled using this member.
-    //"
-    schannel_cred.grbitEnabledProtocols = SP_PROT_TLS1_2_SERVER;
-    //NOTE: Do we need to set this and what will happen when the session expires?
-    //schannel_cred.dwSessionLifespan = ?
-    schannel_cred.dwFlags = SCH_USE_STRONG_CRYPTO;
-    auto status = sspi->AcquireCredentialsHandle(
-        nullptr,
-        const_cast<_TCHAR*>(UNISP_NAME),    //NOTE: What about SCHANNEL_NAME?
-        SECPKG_CRED_INBOUND,
-        nullptr,
-        &schannel_cred,
-        nullptr,
-        nullptr,
-        &m_cred,
-        &ts
-    );
-    if (status != SEC_E_OK) {
-        if (status == SEC_E_UNKNOWN_CREDENTIALS) {
-            Log::error("[SecureSocket::create_server_cred] AcquireCredentialsHandle failed with SEC_E_UNKNOWN_CREDENTIALS. The server certificate is probabaly invalid!");
-        }
-        else {
-            Log::error("[SecureSocket::create_server_cred] AcquireCredentialsHandle failed with: ", status);
+    if (m_secured) {
+        std::vector<char> out;
+        if (m_session->shutdown(out)) {
+            send_all(out);
         }
     }
-    return (status == SEC_E_OK);
-}
-
-bool My::SecureSocket::create_client_cred()
-{
-    SCHANNEL_CRED schannel_cred{};
-    TimeStamp ts;
-    schannel_cred.dwVersion = SCHANNEL_CRED_VERSION;
-    schannel_cred.grbitEnabledProtocols = SP_PROT_TLS1_2_CLIENT;
-    schannel_cred.dwFlags = SCH_CRED_MANUAL_CRED_VALIDATION | SCH_CRED_NO_DEFAULT_CREDS | SCH_USE_STRONG_CRYPTO;
-    auto status = sspi->AcquireCredentialsHandle(
-        nullptr,
-        const_cast<_TCHAR*>(UNISP_NAME),
-        SECPKG_CRED_OUTBOUND,
-        nullptr,
-        &schannel_cred,
-        nullptr,
-        nullptr,
-        &m_cred,
-        &ts
-    );
-    return (status == SEC_E_OK);
+    m_secured = false;
+    Socket::shutdown();
 }
@@ -1,16 +1,11 @@
 #pragma once
 
 #include "common.h"
-
-//SECURITY_WIN32 is required by sspi.h
-#define SECURITY_WIN32
-#include <sspi.h>
-
-#include <Wincrypt.h>
 #include "Socket.h"
+#include "ITlsSession.h"
+#include "CredentialTable.h"
 #include <vector>
 
-
 namespace My {
     class SecureSocket : public Socket
     {
@@ -18,6 +13,15 @@ namespace My {
         SecureSocket(SOCKET s, bool server, const wchar_t * server_name = nullptr) :
             Socket(s), m_server(server), m_server_name(server_name) {}
 
+        //For server only. The certificate is chosen from creds by the Server Name Indication(SNI) of the client.
+        //creds must outlive the socket.
+        SecureSocket(SOCKET s, const CredentialTable* creds) :
+            Socket(s), m_server(true), m_server_name(nullptr), m_creds(creds) {}
+
+        //TLS by the provider rather than Schannel. provider must outlive the socket.
+        SecureSocket(SOCKET s, ITlsProvider* provider, bool server, const wchar_t * server_name = nullptr) :
+            Socket(s), m_server(server), m_server_name(server_name), m_provider(provider) {}
+
         ~SecureSocket();
 
         bool init();
@@ -31,33 +35,33 @@ namespace My {
         virtual void shutdown() override;
 
     private:
-        bool negotiate_as_server();
-
-        bool negotiate_as_client();
+        ITlsSession* create_session();
 
-        bool send_client_hello();
+        bool negotiate();
 
-        bool create_server_cred();
+        bool send_all(const std::vector<char>& out);
 
-        bool create_client_cred();
-
-        inline int max_payload() {
-            return m_size.cbMaximumMessage - m_size.cbHeader - m_size.cbTrailer;
+        inline void grow_buf_when_full(size_t used) {
+            if (used == m_buf.size()) {
+                auto to_size = m_buf.size() * 2;
+                if (to_size < init_buf_size) {
+                    to_size = init_buf_size;
+                }
+                m_buf.resize(to_size);
+            }
         }
 
         bool m_secured = false;
         bool m_server;
         const wchar_t* m_server_name;
-        PCCERT_CONTEXT m_cert{};    //Only required by server
-        CredHandle m_cred{};
-        CtxtHandle m_ctx{};
-        SecPkgContext_StreamSizes m_size{};
+        const CredentialTable* m_creds = nullptr;
+        ITlsProvider* m_provider = nullptr;
+        ITlsSession* m_session = nullptr;
+        TlsSizes m_sizes{};
         //TODO: do not resize m_buf frequently.
         std::vector<char> m_buf;
-        static PSecurityFunctionTable sspi;
-        //NOTE: 16KiB is the max size of a TLS message, bigger buf may incur some performance loss 
+        //NOTE: 16KiB is the max size of a TLS message, bigger buf may incur some performance loss
         //due to moving extra content in m_buf after one message is processed.
         static const int init_buf_size = 1024 * 16;
     };
 }
-
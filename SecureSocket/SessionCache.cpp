@@ -0,0 +1,99 @@
+#include "SessionCache.h"
+#include <mutex>
+
+My::SessionCache::SessionCache(size_t capacity, std::chrono::milliseconds lifetime) :
+    m_shard_capacity((capacity + shard_count - 1) / shard_count), m_lifetime(lifetime)
+{
+    if (!m_shard_capacity) {
+        m_shard_capacity = 1;
+    }
+}
+
+void My::SessionCache::put(const std::string& key, const std::vector<unsigned char>& session)
+{
+    auto& shard = shard_of(key);
+    auto expire_at = Clock::now() + m_lifetime;
+    std::unique_lock<std::shared_mutex> lock(shard.lock);
+    auto it = shard.map.find(key);
+    if (it != shard.map.end()) {
+        it->second->session = session;
+        it->second->expire_at = expire_at;
+        shard.items.splice(shard.items.begin(), shard.items, it->second);
+    }
+    else {
+        shard.items.push_front(Item{ key, session, expire_at });
+        shard.map[key] = shard.items.begin();
+        if (shard.items.size() > m_shard_capacity) {
+            shard.map.erase(shard.items.back().key);
+            shard.items.pop_back();
+        }
+    }
+}
+
+bool My::SessionCache::get(const std::string& key, std::vector<unsigned char>& session)
+{
+    auto& shard = shard_of(key);
+    bool found = false;
+    //NOTE: It's an exclusive lock even for lookup, since a hit moves the item to the front.
+    std::unique_lock<std::shared_mutex> lock(shard.lock);
+    auto it = shard.map.find(key);
+    if (it != shard.map.end()) {
+        if (Clock::now() < it->second->expire_at) {
+            session = it->second->session;
+            shard.items.splice(shard.items.begin(), shard.items, it->second);
+            found = true;
+        }
+        else {
+            shard.items.erase(it->second);
+            shard.map.erase(it);
+        }
+    }
+    if (found) {
+        shard.hits++;
+    }
+    else {
+        shard.misses++;
+    }
+    return found;
+}
+
+void My::SessionCache::remove(const std::string& key)
+{
+    auto& shard = shard_of(key);
+    std::unique_lock<std::shared_mutex> lock(shard.lock);
+    auto it = shard.map.find(key);
+    if (it != shard.map.end()) {
+        shard.items.erase(it->second);
+        shard.map.erase(it);
+    }
+}
+
+size_t My::SessionCache::size() const
+{
+    size_t n = 0;
+    for (auto& shard : m_shards) {
+        std::shared_lock<std::shared_mutex> lock(shard.lock);
+        n += shard.map.size();
+    }
+    return n;
+}
+
+int64_t My::SessionCache::get_hits() const
+{
+    int64_t n = 0;
+    for (auto& shard : m_shards) {
+        std::shared_lock<std::shared_mutex> lock(shard.lock);
+        n += shard.hits;
+    }
+    return n;
+}
+
+int64_t My::SessionCache::get_misses() const
+{
+    int64_t n = 0;
+    for (auto& shard : m_shards) {
+        std::shared_lock<std::shared_mutex> lock(shard.lock);
+        n += shard.misses;
+    }
+    return n;
+}
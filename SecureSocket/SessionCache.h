@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+
+namespace My {
+    //A sharded, bounded and concurrent cache of TLS sessions, from session IDs (or any other key) to serialized
+    //sessions. It's for a TLS implementation which lets the application store sessions, so that the sessions
+    //are shared by all worker threads, like OpenSSL for both servers and clients, see OpenSslTlsProvider.
+    //Schannel keeps its own cache and doesn't need it, see HandshakeStats.
+    //
+    //Each shard has its own lock and least-recently-used list, so threads contend only when keys fall into the
+    //same shard. When a shard is full, its least recently used session is evicted. A session also expires after
+    //a lifetime, like dwSessionLifespan of Schannel.
+    //
+    //It has no dependency on Windows, like OpenSslTlsProvider, so both can be built and tested on any platform.
+    //
+    //NOTE: The shards are aligned to cache lines and so is the cache. Define it as a static, or a member of a
+    //static, rather than creating it by new.
+    class SessionCache
+    {
+    public:
+        //capacity is the max count of sessions in all shards.
+        SessionCache(size_t capacity, std::chrono::milliseconds lifetime);
+
+        SessionCache(const SessionCache&) = delete;
+        SessionCache& operator = (const SessionCache&) = delete;
+
+        void put(const std::string& key, const std::vector<unsigned char>& session);
+
+        //Return false when the key is not found or the session has expired.
+        bool get(const std::string& key, std::vector<unsigned char>& session);
+
+        void remove(const std::string& key);
+
+        //Counts are added up shard by shard, so they are not a consistent snapshot under load.
+        size_t size() const;
+        int64_t get_hits() const;
+        int64_t get_misses() const;
+
+    private:
+        static const size_t shard_count = 16;
+
+        typedef std::chrono::steady_clock Clock;
+
+        struct Item {
+            std::string key;
+            std::vector<unsigned char> session;
+            Clock::time_point expire_at;
+        };
+
+        typedef std::list<Item> ItemList;
+
+        struct alignas(64) Shard {
+            mutable std::shared_mutex lock;
+            //The most recently used first.
+            ItemList items;
+            std::unordered_map<std::string, ItemList::iterator> map;
+            //Updated with lock held.
+            int64_t hits = 0;
+            int64_t misses = 0;
+        };
+
+        Shard& shard_of(const std::string& key) {
+            return m_shards[std::hash<std::string>()(key) % shard_count];
+        }
+
+        size_t m_shard_capacity;
+        std::chrono::milliseconds m_lifetime;
+        Shard m_shards[shard_count];
+    };
+}
@@ -0,0 +1,398 @@
+#include "SspiTls.h"
+#include "CredentialCache.h"
+#include "ClientHello.h"
+#include <schannel.h>
+#include <cstring>
+#include "Log.h"
+
+#pragma comment(lib, "Secur32.lib")
+
+PSecurityFunctionTable My::SspiTlsSession::sspi = nullptr;
+unsigned long My::SspiTlsSession::max_token = 0;
+
+bool My::SspiTlsSession::init_sspi()
+{
+    //NOTE: InitSecurityInterface returns the same table on every call, so a race here is harmless.
+    if (!sspi) {
+        auto table = InitSecurityInterface();
+        if (!table) {
+            Log::error("[SspiTlsSession::init_sspi] InitSecurityInterface failed.");
+            return false;
+        }
+        PSecPkgInfoW info = nullptr;
+        auto status = table->QuerySecurityPackageInfoW(const_cast<wchar_t*>(UNISP_NAME_W), &info);
+        if (status != SEC_E_OK) {
+            Log::error("[SspiTlsSession::init_sspi] QuerySecurityPackageInfo failed with: ", status);
+            return false;
+        }
+        max_token = info->cbMaxToken;
+        table->FreeContextBuffer(info);
+        sspi = table;
+    }
+    return sspi != nullptr;
+}
+
+My::SspiTlsSession* My::SspiTlsSession::create_server(const CredentialTable* creds)
+{
+    if (!creds || !init_sspi()) {
+        return nullptr;
+    }
+    return new SspiTlsSession(true, nullptr, creds, nullptr);
+}
+
+My::SspiTlsSession* My::SspiTlsSession::create_server(const wchar_t* server_name)
+{
+    if (!server_name || !init_sspi()) {
+        return nullptr;
+    }
+    auto cred = CredentialCache::get_server(server_name);
+    if (!cred) {
+        Log::error("[SspiTlsSession::create_server] No server credential!");
+        return nullptr;
+    }
+    return new SspiTlsSession(true, cred, nullptr, server_name);
+}
+
+My::SspiTlsSession* My::SspiTlsSession::create_client(const wchar_t* server_name)
+{
+    if (!init_sspi()) {
+        return nullptr;
+    }
+    auto cred = CredentialCache::get_client();
+    if (!cred) {
+        Log::error("[SspiTlsSession::create_client] No client credential!");
+        return nullptr;
+    }
+    return new SspiTlsSession(false, cred, nullptr, server_name);
+}
+
+My::SspiTlsSession::~SspiTlsSession()
+{
+    if (m_ctx.dwLower != 0 || m_ctx.dwUpper != 0) {
+        sspi->DeleteSecurityContext(&m_ctx);
+    }
+}
+
+My::TlsStatus My::SspiTlsSession::handshake(const char* in, size_t in_size, size_t& consumed, std::vector<char>& out)
+{
+    consumed = 0;
+    if (m_server && !m_cred) {
+        //Choose a credential by SNI in ClientHello, which is the first message from client.
+        std::wstring name;
+        if (ClientHello::peek_server_name(in, in_size, name) == ClientHello::Result::Incomplete) {
+            return TlsStatus::Incomplete;
+        }
+        m_cred = m_creds->find(name);
+        if (!m_cred) {
+            Log::error("[SspiTlsSession::handshake] No credential for the client.");
+            return TlsStatus::Error;
+        }
+    }
+
+    size_t extra = 0;
+    auto status = next_token(in, in_size, extra, out);
+    if (status == SEC_E_INCOMPLETE_MESSAGE) {
+        return TlsStatus::Incomplete;
+    }
+    //NOTE: Unlike a blocking loop, which could simply read on, here SECBUFFER_EXTRA is the start of the next
+    //handshake message(s) and is left to the caller to pass in again.
+    consumed = in_size - extra;
+    if (status == SEC_I_CONTINUE_NEEDED) {
+        return TlsStatus::Continue;
+    }
+    if (status == SEC_E_OK) {
+        return on_established() ? TlsStatus::Ok : TlsStatus::Error;
+    }
+    //if status == SEC_I_INCOMPLETE_CREDENTIALS, it means server is requesting a client certificate.
+    //Then we need to build a new client CredHandle with a certificate, and call InitializeSecurityContext
+    //with the new CredHandle hereafter.
+    Log::error("[SspiTlsSession::handshake] Handshake failed with: ", status);
+    return TlsStatus::Error;
+}
+
+SECURITY_STATUS My::SspiTlsSession::next_token(const char* in, size_t in_size, size_t& in_extra, std::vector<char>& out)
+{
+    bool has_ctx = (m_ctx.dwLower != 0 || m_ctx.dwUpper != 0);
+    DWORD ret_flags = 0;
+    TimeStamp ts;
+
+    //NOTE: Shall we have a third in-buffer of type SECBUFFER_ALERT as said in
+    //https://docs.microsoft.com/en-us/windows/win32/secauthn/acceptsecuritycontext--schannel ?
+    SecBuffer in_buf[2];
+    SecBuffer out_buf[1];
+    SecBufferDesc in_buf_desc;
+    SecBufferDesc out_buf_desc;
+
+    in_buf[0].pvBuffer = (void*)in;
+    in_buf[0].cbBuffer = (unsigned long)in_size;
+    in_buf[0].BufferType = SECBUFFER_TOKEN;
+
+    in_buf[1].pvBuffer = nullptr;
+    in_buf[1].cbBuffer = 0;
+    in_buf[1].BufferType = SECBUFFER_EMPTY;
+
+    in_buf_desc.cBuffers = 2;
+    in_buf_desc.pBuffers = in_buf;
+    in_buf_desc.ulVersion = SECBUFFER_VERSION;
+    //No input for ClientHello or shutdown.
+    auto in_desc = in_size ? &in_buf_desc : nullptr;
+
+    //NOTE: The output token is written into out directly, rather than into a buffer allocated by SSPI with
+    //ASC_REQ_ALLOCATE_MEMORY, so that a caller reusing out allocates nothing. max_token is enough for any token.
+    auto offset = out.size();
+    out.resize(offset + max_token);
+    out_buf[0].pvBuffer = out.data() + offset;
+    out_buf[0].BufferType = SECBUFFER_TOKEN;
+    out_buf[0].cbBuffer = max_token;
+
+    out_buf_desc.cBuffers = 1;
+    out_buf_desc.pBuffers = out_buf;
+    out_buf_desc.ulVersion = SECBUFFER_VERSION;
+
+    SECURITY_STATUS status;
+    if (m_server) {
+        DWORD req_flags = ASC_REQ_CONFIDENTIALITY | ASC_REQ_EXTENDED_ERROR |
+            ASC_REQ_REPLAY_DETECT | ASC_REQ_SEQUENCE_DETECT | ASC_REQ_STREAM;
+        status = sspi->AcceptSecurityContext(
+            m_cred,
+            has_ctx ? &m_ctx : nullptr,
+            in_desc,
+            req_flags,
+            0,
+            has_ctx ? nullptr : &m_ctx,
+            &out_buf_desc,
+            &ret_flags,
+            &ts
+        );
+    }
+    else {
+        DWORD req_flags = ISC_REQ_CONFIDENTIALITY | ISC_REQ_EXTENDED_ERROR |
+            ISC_REQ_REPLAY_DETECT | ISC_REQ_SEQUENCE_DETECT | ISC_REQ_STREAM |
+            ISC_REQ_MANUAL_CRED_VALIDATION; // Allow manual validation of server certificate.
+        status = sspi->InitializeSecurityContextW(
+            m_cred,
+            has_ctx ? &m_ctx : nullptr,
+            //The target name is also the key of the client session cache.
+            has_ctx ? nullptr : const_cast<wchar_t*>(m_server_name),
+            req_flags,
+            0,
+            0,
+            in_desc,
+            0,
+            has_ctx ? nullptr : &m_ctx,
+            &out_buf_desc,
+            &ret_flags,
+            &ts
+        );
+    }
+
+    //NOTE: The output may be an alert even on failure, which is sent as well. cbBuffer is set to the size written,
+    //but it may be left untouched on some failures, when nothing is taken as written. An alert is never as large as
+    //max_token, while a token on success may be.
+    auto written = out_buf[0].cbBuffer;
+    if (written > max_token) {
+        Log::error("[SspiTlsSession::next_token] Token of ", written, " bytes is over the buffer.");
+        out.resize(offset);
+        in_extra = 0;
+        return SEC_E_INTERNAL_ERROR;
+    }
+    if (FAILED(status) && written == max_token) {
+        written = 0;
+    }
+    out.resize(offset + written);
+    in_extra = (in_buf[1].BufferType == SECBUFFER_EXTRA) ? in_buf[1].cbBuffer : 0;
+    return status;
+}
+
+bool My::SspiTlsSession::on_established()
+{
+    SecPkgContext_StreamSizes sizes{};
+    auto status = sspi->QueryContextAttributes(&m_ctx, SECPKG_ATTR_STREAM_SIZES, &sizes);
+    if (status != SEC_E_OK) {
+        Log::error("[SspiTlsSession::on_established] QueryContextAttributes failed with: ", status);
+        return false;
+    }
+    m_sizes.header = sizes.cbHeader;
+    m_sizes.trailer = sizes.cbTrailer;
+    m_sizes.max_message = sizes.cbMaximumMessage;
+
+    SecPkgContext_SessionInfo session_info{};
+    status = sspi->QueryContextAttributes(&m_ctx, SECPKG_ATTR_SESSION_INFO, &session_info);
+    m_resumed = (status == SEC_E_OK && (session_info.dwFlags & SSL_SESSION_RECONNECT));
+
+    SecPkgContext_ConnectionInfo connection_info{};
+    status = sspi->QueryContextAttributes(&m_ctx, SECPKG_ATTR_CONNECTION_INFO, &connection_info);
+    m_tls13 = (status == SEC_E_OK && (connection_info.dwProtocol & SP_PROT_TLS1_3));
+    return true;
+}
+
+bool My::SspiTlsSession::encrypt(const char* data, size_t size, char* out, size_t out_size, size_t& written)
+{
+    if (size > m_sizes.max_payload() || out_size < m_sizes.header + size + m_sizes.trailer) {
+        Log::error("[SspiTlsSession::encrypt] Invalid size.");
+        return false;
+    }
+    memcpy(out + m_sizes.header, data, size);
+
+    SecBuffer out_buf[4];
+    SecBufferDesc msg;
+
+    msg.ulVersion = SECBUFFER_VERSION;
+    msg.cBuffers = 4;
+    msg.pBuffers = out_buf;
+
+    out_buf[0].pvBuffer = out;
+    out_buf[0].cbBuffer = (unsigned long)m_sizes.header;
+    out_buf[0].BufferType = SECBUFFER_STREAM_HEADER;
+
+    out_buf[1].pvBuffer = out + m_sizes.header;
+    out_buf[1].cbBuffer = (unsigned long)size;
+    out_buf[1].BufferType = SECBUFFER_DATA;
+
+    out_buf[2].pvBuffer = out + m_sizes.header + size;
+    out_buf[2].cbBuffer = (unsigned long)m_sizes.trailer;
+    out_buf[2].BufferType = SECBUFFER_STREAM_TRAILER;
+
+    out_buf[3].BufferType = SECBUFFER_EMPTY;
+
+    AcquireSRWLockShared(&m_lock);
+    auto status = sspi->EncryptMessage(&m_ctx, 0, &msg, 0);
+    ReleaseSRWLockShared(&m_lock);
+    if (FAILED(status)) {
+        Log::error("[SspiTlsSession::encrypt] EncryptMessage failed with error: ", status);
+        return false;
+    }
+    //NOTE: The trailer may be shorter than cbTrailer, so the real sizes are added up.
+    written = out_buf[0].cbBuffer + out_buf[1].cbBuffer + out_buf[2].cbBuffer;
+    return true;
+}
+
+My::TlsStatus My::SspiTlsSession::decrypt(char* in, size_t in_size, size_t& consumed, char* plain, size_t plain_size,
+    size_t& written, std::vector<char>& out)
+{
+    consumed = 0;
+    written = 0;
+    if (!in_size) {
+        return TlsStatus::Incomplete;
+    }
+
+    //NOTE: according to https://docs.microsoft.com/en-us/windows/win32/secauthn/decryptmessage--schannel
+    //there should only be 2 buffers here, and the second must be of type SECBUFFER_TOKEN with a "security token"(what?).
+    SecBuffer in_buf[4];
+    SecBufferDesc msg;
+    msg.ulVersion = SECBUFFER_VERSION;
+    msg.cBuffers = 4;
+    msg.pBuffers = in_buf;
+
+    in_buf[0].pvBuffer = in;
+    in_buf[0].cbBuffer = (unsigned long)in_size;
+    in_buf[0].BufferType = SECBUFFER_DATA;
+    in_buf[1].BufferType = SECBUFFER_EMPTY;
+    in_buf[2].BufferType = SECBUFFER_EMPTY;
+    in_buf[3].BufferType = SECBUFFER_EMPTY;
+
+    auto status = sspi->DecryptMessage(&m_ctx, &msg, 0, nullptr);
+    if (status == SEC_E_INCOMPLETE_MESSAGE) {
+        return TlsStatus::Incomplete;
+    }
+
+    PSecBuffer data_buf = nullptr;
+    PSecBuffer extra_buf = nullptr;
+    for (int i = 1; i < 4; i++) //NOTE: Why from 1, not 0?
+    {
+        if (!data_buf && in_buf[i].BufferType == SECBUFFER_DATA) {
+            data_buf = &in_buf[i];
+        }
+        if (!extra_buf && in_buf[i].BufferType == SECBUFFER_EXTRA) {
+            extra_buf = &in_buf[i];
+        }
+    }
+    size_t extra = extra_buf ? extra_buf->cbBuffer : 0;
+
+    if (status == SEC_I_CONTEXT_EXPIRED) {
+        //TLS is shutting down.
+        //NOTE: The document says we need to shutdown the TLS session:
+        //https://docs.microsoft.com/en-us/windows/win32/secauthn/shutting-down-an-schannel-connection
+        //However we simply skip the shutdown operation here.
+        consumed = in_size - extra;
+        return TlsStatus::Closed;
+    }
+
+    if (status == SEC_I_RENEGOTIATE && m_tls13) {
+        //NOTE: TLS 1.3 has no renegotiation. SEC_I_RENEGOTIATE means a post-handshake message, like a
+        //NewSessionTicket or a KeyUpdate. It's passed to the handshake function with the input in SECBUFFER_EXTRA,
+        //and any response is sent back.
+        size_t offset = in_size - extra;
+        size_t left = 0;
+        AcquireSRWLockExclusive(&m_lock);
+        auto result = next_token(in + offset, extra, left, out);
+        ReleaseSRWLockExclusive(&m_lock);
+        if (result != SEC_E_OK) {
+            Log::error("[SspiTlsSession::decrypt] Processing post-handshake message failed with: ", result);
+            return TlsStatus::Error;
+        }
+        consumed = in_size - left;
+        return TlsStatus::Continue;
+    }
+
+    if (status == SEC_I_RENEGOTIATE) {
+        //NOTE: Renegotiation is not supported. User should shutdown the session in this case.
+        Log::error("[SspiTlsSession::decrypt] SEC_I_RENEGOTIATE is received! Renegotiation is not supported.");
+        return TlsStatus::Error;
+    }
+
+    if (status != SEC_E_OK) {
+        Log::error("[SspiTlsSession::decrypt] DecryptMessage failed with error: ", status);
+        return TlsStatus::Error;
+    }
+
+    if (!data_buf) {
+        return TlsStatus::Error;
+    }
+    if (data_buf->cbBuffer > plain_size) {
+        //NOTE: Is there a way to avoid/alleviate the short-buffer problem?
+        Log::error("[SspiTlsSession::decrypt] Input buffer is not big enough. At least ", data_buf->cbBuffer, " bytes is required.");
+        return TlsStatus::Error;
+    }
+    //NOTE: data_buf->pvBuffer points to an address in the input, since the record is decrypted in place.
+    memcpy(plain, data_buf->pvBuffer, data_buf->cbBuffer);
+    written = data_buf->cbBuffer;
+    consumed = in_size - extra;
+    return TlsStatus::Ok;
+}
+
+bool My::SspiTlsSession::shutdown(std::vector<char>& out)
+{
+    if (m_ctx.dwLower == 0 && m_ctx.dwUpper == 0) {
+        return false;
+    }
+
+    DWORD type = SCHANNEL_SHUTDOWN;
+    SecBuffer out_buf[1];
+    SecBufferDesc out_buf_desc;
+
+    out_buf[0].pvBuffer = &type;
+    out_buf[0].BufferType = SECBUFFER_TOKEN;
+    out_buf[0].cbBuffer = sizeof(type);
+
+    out_buf_desc.cBuffers = 1;
+    out_buf_desc.pBuffers = out_buf;
+    out_buf_desc.ulVersion = SECBUFFER_VERSION;
+
+    auto status = sspi->ApplyControlToken(&m_ctx, &out_buf_desc);
+    if (FAILED(status)) {
+        Log::warn("[SspiTlsSession::shutdown] ApplyControlToken failed with: ", status);
+        return false;
+    }
+
+    //NOTE: It seems we need to a loop of calls to AcceptSecurityContext, according to
+    //https://docs.microsoft.com/en-us/windows/win32/secauthn/shutting-down-an-schannel-connection
+    //However we simply call it once here.
+    size_t extra = 0;
+    status = next_token(nullptr, 0, extra, out);
+    if (FAILED(status)) {
+        Log::warn("[SspiTlsSession::shutdown] Getting the shutdown message failed with: ", status);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "common.h"
+
+//SECURITY_WIN32 is required by sspi.h
+#define SECURITY_WIN32
+#include <sspi.h>
+
+#include "ITlsSession.h"
+#include "CredentialTable.h"
+
+namespace My {
+    //A TLS session by Schannel through SSPI.
+    class SspiTlsSession : public ITlsSession
+    {
+    public:
+        //The certificate is chosen from creds by the Server Name Indication(SNI) of the client. creds must
+        //outlive the session.
+        static SspiTlsSession* create_server(const CredentialTable* creds);
+
+        //The certificate of server_name is used, no matter what name the client asks for.
+        static SspiTlsSession* create_server(const wchar_t* server_name);
+
+        static SspiTlsSession* create_client(const wchar_t* server_name);
+
+        SspiTlsSession(const SspiTlsSession&) = delete;
+
+        SspiTlsSession& operator = (const SspiTlsSession&) = delete;
+
+        ~SspiTlsSession();
+
+        virtual TlsStatus handshake(const char* in, size_t in_size, size_t& consumed, std::vector<char>& out) override;
+
+        virtual const TlsSizes& get_sizes() override {
+            return m_sizes;
+        }
+
+        virtual bool encrypt(const char* data, size_t size, char* out, size_t out_size, size_t& written) override;
+
+        virtual TlsStatus decrypt(char* in, size_t in_size, size_t& consumed, char* plain, size_t plain_size,
+            size_t& written, std::vector<char>& out) override;
+
+        virtual bool has_pending() override {
+            //Schannel consumes a whole record at a time and keeps nothing.
+            return false;
+        }
+
+        virtual bool shutdown(std::vector<char>& out) override;
+
+        virtual bool is_resumed() override {
+            return m_resumed;
+        }
+
+        virtual bool is_tls13() override {
+            return m_tls13;
+        }
+
+    private:
+        SspiTlsSession(bool server, PCredHandle cred, const CredentialTable* creds, const wchar_t* server_name) :
+            m_server(server), m_cred(cred), m_creds(creds), m_server_name(server_name) {}
+
+        static bool init_sspi();
+
+        //Call AcceptSecurityContext or InitializeSecurityContext with the input token. in_extra is the size of
+        //the input left, and any output token is appended to out.
+        SECURITY_STATUS next_token(const char* in, size_t in_size, size_t& in_extra, std::vector<char>& out);
+
+        bool on_established();
+
+        bool m_server;
+        //Shared by all server sessions of the same certificate, or by all client sessions. It's owned by
+        //CredentialCache.
+        PCredHandle m_cred;
+        const CredentialTable* m_creds;
+        const wchar_t* m_server_name;
+        CtxtHandle m_ctx{};
+        TlsSizes m_sizes{};
+        bool m_resumed = false;
+        bool m_tls13 = false;
+        //EncryptMessage may run at the same time as DecryptMessage, but not as AcceptSecurityContext for a
+        //post-handshake message, which may update the keys. The former takes it shared, and the latter exclusive.
+        SRWLOCK m_lock = SRWLOCK_INIT;
+
+        static PSecurityFunctionTable sspi;
+        //Max size of a token from Schannel
+        static unsigned long max_token;
+    };
+
+    class SspiTlsProvider : public ITlsProvider
+    {
+    public:
+        //creds is for server sessions. It must outlive the provider and all sessions.
+        explicit SspiTlsProvider(const CredentialTable* creds = nullptr) : m_creds(creds) {}
+
+        virtual ITlsSession* create_server_session() override {
+            return m_creds ? SspiTlsSession::create_server(m_creds) : nullptr;
+        }
+
+        virtual ITlsSession* create_client_session(const wchar_t* server_name) override {
+            return SspiTlsSession::create_client(server_name);
+        }
+
+    private:
+        const CredentialTable* m_creds;
+    };
+}
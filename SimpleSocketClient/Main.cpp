@@ -15,6 +15,7 @@
 #include "..\SecureSocket\Log.h"
 #include "..\SecureSocket\Socket.h"
 #include "..\SecureSocket\SecureSocket.h"
+#include "..\SecureSocket\NullTls.h"
 
 
 // Need to link with Ws2_32.lib, Mswsock.lib, and Advapi32.lib
@@ -74,14 +75,20 @@ int __cdecl main(int argc, char** argv)
 
     // Validate the parameters
     if (argc < 2) {
-        printf("usage: %s server-name [-t]\n", argv[0]);
+        printf("usage: %s server-name [-t|-p]\n", argv[0]);
         return 1;
     }
 
     bool using_tls = false;
+    //TLS framing without crypto, for benchmarking only
+    bool null_tls = false;
     if (argc == 3 && strcmp(argv[2], "-t") == 0) {
         using_tls = true;
     }
+    else if (argc == 3 && strcmp(argv[2], "-p") == 0) {
+        using_tls = true;
+        null_tls = true;
+    }
 
     // Initialize Winsock
     result = WSAStartup(MAKEWORD(2, 2), &wsa_data);
@@ -136,7 +143,9 @@ int __cdecl main(int argc, char** argv)
     std::unique_ptr<My::ISocket> client = nullptr;
     if (using_tls) {
         My::Log::info("[main] Enabling TLS...");
-        auto ss = new My::SecureSocket(connect_socket, false);
+        static My::NullTlsProvider null_provider;
+        auto ss = null_tls ? new My::SecureSocket(connect_socket, &null_provider, false) :
+            new My::SecureSocket(connect_socket, false);
         if (!ss->init()) {
             My::Log::error("[main] Init TLS failed!");
             delete ss;